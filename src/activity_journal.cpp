@@ -0,0 +1,335 @@
+#include "activity_journal.h"
+#include <esp_crc.h>
+#include <time.h>
+
+// Anything earlier means SNTP has not set the clock yet
+#define JOURNAL_MIN_VALID_TIME  1700000000UL
+
+// =============================================
+// CLASS IMPLEMENTATION
+// =============================================
+
+ActivityJournal::ActivityJournal() : mutex(nullptr), ready(false), ackedSeq(0), nextSeq(1)
+{
+    memset(&stats, 0, sizeof(stats));
+}
+
+bool ActivityJournal::begin()
+{
+    mutex = xSemaphoreCreateMutex();
+    if (mutex == NULL)
+    {
+        return false;
+    }
+
+    // Mounts the "spiffs" data partition, formatting it on first boot
+    if (!LittleFS.begin(true))
+    {
+        Serial.println("LittleFS mount failed - activity journal disabled");
+        return false;
+    }
+
+    size_t expectedSize = sizeof(JournalHeader) + (size_t)JOURNAL_CAPACITY * sizeof(JournalRecord);
+    if (LittleFS.exists(JOURNAL_FILE))
+    {
+        file = LittleFS.open(JOURNAL_FILE, "r+");
+    }
+
+    if (!file || file.size() != expectedSize || !loadHeader())
+    {
+        if (file)
+        {
+            file.close();
+            Serial.println("Activity journal unreadable or resized, starting a new one");
+        }
+        if (!createFile())
+        {
+            Serial.println("Failed to create activity journal");
+            return false;
+        }
+    }
+
+    // Continue the sequence after the newest record still on flash
+    nextSeq = ackedSeq + 1;
+    for (uint16_t slot = 0; slot < JOURNAL_CAPACITY; slot++)
+    {
+        JournalRecord record;
+        if (readRecordAt(sizeof(JournalHeader) + (uint32_t)slot * sizeof(JournalRecord), record) &&
+            record.seq >= nextSeq)
+        {
+            nextSeq = record.seq + 1;
+        }
+    }
+
+    ready = true;
+    Serial.printf("Activity journal ready: %lu of %u records pending\n", (unsigned long)getDepth(), JOURNAL_CAPACITY);
+    return true;
+}
+
+bool ActivityJournal::createFile()
+{
+    file = LittleFS.open(JOURNAL_FILE, "w+");
+    if (!file)
+    {
+        return false;
+    }
+
+    ackedSeq = 0;
+    nextSeq = 1;
+    if (!writeHeader())
+    {
+        return false;
+    }
+
+    // Preallocate every slot so appends never grow the file
+    JournalRecord empty;
+    memset(&empty, 0, sizeof(empty));
+    for (uint16_t slot = 0; slot < JOURNAL_CAPACITY; slot++)
+    {
+        if (file.write((const uint8_t *)&empty, sizeof(empty)) != sizeof(empty))
+        {
+            return false;
+        }
+    }
+    file.flush();
+    return true;
+}
+
+bool ActivityJournal::loadHeader()
+{
+    JournalHeader header;
+    if (!file.seek(0, SeekSet) || file.read((uint8_t *)&header, sizeof(header)) != sizeof(header))
+    {
+        return false;
+    }
+
+    if (header.magic != JOURNAL_HEADER_MAGIC || header.version != JOURNAL_FORMAT_VERSION ||
+        header.capacity != JOURNAL_CAPACITY || header.crc != headerCrc(header))
+    {
+        return false;
+    }
+
+    ackedSeq = header.ackedSeq;
+    return true;
+}
+
+bool ActivityJournal::writeHeader()
+{
+    JournalHeader header;
+    header.magic = JOURNAL_HEADER_MAGIC;
+    header.version = JOURNAL_FORMAT_VERSION;
+    header.capacity = JOURNAL_CAPACITY;
+    header.ackedSeq = ackedSeq;
+    header.crc = headerCrc(header);
+
+    if (!file.seek(0, SeekSet) || file.write((const uint8_t *)&header, sizeof(header)) != sizeof(header))
+    {
+        return false;
+    }
+    file.flush();
+    return true;
+}
+
+bool ActivityJournal::readRecordAt(uint32_t offset, JournalRecord &record)
+{
+    if (!file.seek(offset, SeekSet) || file.read((uint8_t *)&record, sizeof(record)) != sizeof(record))
+    {
+        return false;
+    }
+    return record.magic == JOURNAL_RECORD_MAGIC && record.crc == recordCrc(record);
+}
+
+bool ActivityJournal::readSlot(uint32_t seq, JournalRecord &record)
+{
+    // A slot still holding a record from the previous lap is as bad as a torn one
+    return readRecordAt(slotOffset(seq), record) && record.seq == seq;
+}
+
+bool ActivityJournal::writeSlot(const JournalRecord &record)
+{
+    if (!file.seek(slotOffset(record.seq), SeekSet) ||
+        file.write((const uint8_t *)&record, sizeof(record)) != sizeof(record))
+    {
+        return false;
+    }
+    file.flush();
+    return true;
+}
+
+void ActivityJournal::advanceTail()
+{
+    // Swallow records finished out of order and slots lost in a power cut
+    uint32_t previousSeq = ackedSeq;
+    JournalRecord record;
+    while (ackedSeq + 1 < nextSeq)
+    {
+        if (readSlot(ackedSeq + 1, record))
+        {
+            if ((record.flags & JOURNAL_FLAG_DONE) == 0)
+            {
+                break;
+            }
+        }
+        else
+        {
+            stats.corrupt++;
+        }
+        ackedSeq++;
+    }
+
+    if (ackedSeq != previousSeq && !writeHeader())
+    {
+        Serial.println("Failed to update activity journal header");
+    }
+}
+
+void ActivityJournal::finish(uint32_t seq)
+{
+    if (seq == ackedSeq + 1)
+    {
+        ackedSeq = seq;
+        writeHeader();
+    }
+    else
+    {
+        // Older records are still pending, only mark this one
+        JournalRecord record;
+        if (readSlot(seq, record))
+        {
+            record.flags |= JOURNAL_FLAG_DONE;
+            record.crc = recordCrc(record);
+            writeSlot(record);
+        }
+    }
+    advanceTail();
+}
+
+uint32_t ActivityJournal::currentTime()
+{
+    time_t now = time(nullptr);
+    return now >= (time_t)JOURNAL_MIN_VALID_TIME ? (uint32_t)now : 0;
+}
+
+uint32_t ActivityJournal::slotOffset(uint32_t seq)
+{
+    return sizeof(JournalHeader) + (seq % JOURNAL_CAPACITY) * sizeof(JournalRecord);
+}
+
+uint32_t ActivityJournal::recordCrc(const JournalRecord &record)
+{
+    return esp_crc32_le(0, (const uint8_t *)&record, offsetof(JournalRecord, crc));
+}
+
+uint32_t ActivityJournal::headerCrc(const JournalHeader &header)
+{
+    return esp_crc32_le(0, (const uint8_t *)&header, offsetof(JournalHeader, crc));
+}
+
+bool ActivityJournal::append(const String &memberID, int institution)
+{
+    if (!ready)
+    {
+        return false;
+    }
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+
+    // Full ring: the oldest record gives way to the newest tap
+    if (getDepth() >= JOURNAL_CAPACITY)
+    {
+        ackedSeq++;
+        writeHeader();
+        advanceTail();
+        stats.dropped++;
+        Serial.println("Activity journal full - oldest record dropped");
+    }
+
+    JournalRecord record;
+    memset(&record, 0, sizeof(record));
+    record.magic = JOURNAL_RECORD_MAGIC;
+    record.seq = nextSeq;
+    record.institution = (uint8_t)institution;
+    record.tappedAt = currentTime();
+    strncpy(record.memberID, memberID.c_str(), sizeof(record.memberID) - 1);
+    record.crc = recordCrc(record);
+
+    bool success = writeSlot(record);
+    if (success)
+    {
+        nextSeq++;
+        stats.appended++;
+    }
+
+    xSemaphoreGive(mutex);
+    return success;
+}
+
+bool ActivityJournal::peek(JournalRecord &record)
+{
+    return peekBatch(&record, 1) == 1;
+}
+
+uint8_t ActivityJournal::peekBatch(JournalRecord *records, uint8_t maxRecords)
+{
+    if (!ready)
+    {
+        return 0;
+    }
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+
+    // Only finish() moves the tail, a run of unreadable or done slots at
+    // the front would otherwise be read again on every call
+    advanceTail();
+
+    uint8_t count = 0;
+    for (uint32_t seq = ackedSeq + 1; seq < nextSeq && count < maxRecords; seq++)
+    {
+        // Unreadable and done slots are dropped when the tail passes them
+        if (readSlot(seq, records[count]) && (records[count].flags & JOURNAL_FLAG_DONE) == 0)
+        {
+            count++;
+        }
+    }
+
+    xSemaphoreGive(mutex);
+    return count;
+}
+
+void ActivityJournal::acknowledge(uint32_t seq)
+{
+    if (!ready)
+    {
+        return;
+    }
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    if (seq > ackedSeq && seq < nextSeq)
+    {
+        finish(seq);
+        stats.uploaded++;
+    }
+    xSemaphoreGive(mutex);
+}
+
+void ActivityJournal::reject(uint32_t seq)
+{
+    if (!ready)
+    {
+        return;
+    }
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    if (seq > ackedSeq && seq < nextSeq)
+    {
+        finish(seq);
+        stats.rejected++;
+    }
+    xSemaphoreGive(mutex);
+}
+
+// =============================================
+// GLOBAL INSTANCE
+// =============================================
+
+ActivityJournal activityJournal;
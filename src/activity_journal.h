@@ -0,0 +1,111 @@
+#ifndef ACTIVITY_JOURNAL_H
+#define ACTIVITY_JOURNAL_H
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include "config.h"
+#include "card_payload_parser.h"
+
+#define JOURNAL_RECORD_MAGIC    0x4A524543  // "JREC"
+#define JOURNAL_HEADER_MAGIC    0x4A524E4C  // "JRNL"
+#define JOURNAL_FORMAT_VERSION  2
+#define JOURNAL_FLAG_DONE       0x01        // Finished out of order, waiting for the tail
+
+// =============================================
+// JOURNAL RECORD
+// =============================================
+
+// One activity log waiting for the server. Fixed size so slot N of the
+// ring always lives at the same file offset.
+struct JournalRecord {
+    uint32_t magic;
+    uint32_t seq;                           // 1, 2, 3, ... never reused
+    uint8_t institution;
+    uint8_t flags;
+    uint8_t reserved[2];
+    uint32_t tappedAt;                      // Unix time of the tap, 0 before NTP sync
+    char memberID[CARD_INDUK_MAX_LENGTH];
+    uint32_t crc;                           // Over everything above
+};
+
+// File header, rewritten each time the uploader acknowledges a record
+struct JournalHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t capacity;
+    uint32_t ackedSeq;                      // Last record the server has
+    uint32_t crc;
+};
+
+struct JournalStats {
+    uint32_t appended;
+    uint32_t uploaded;
+    uint32_t dropped;                       // Overwritten while the ring was full
+    uint32_t rejected;                      // Refused by the server, skipped
+    uint32_t corrupt;                       // Failed CRC on read, skipped
+};
+
+// =============================================
+// ACTIVITY JOURNAL CLASS
+// =============================================
+
+// Crash-safe ring of activity logs in a preallocated LittleFS file. Every
+// append and acknowledge rewrites one fixed slot and syncs the file, which
+// LittleFS commits atomically, so a power cut loses at most the record
+// being written. Records are handed out strictly in sequence order; one
+// finished ahead of an older record is flagged done until the tail
+// reaches it.
+class ActivityJournal {
+private:
+    File file;
+    SemaphoreHandle_t mutex;
+    bool ready;
+    uint32_t ackedSeq;
+    uint32_t nextSeq;
+    JournalStats stats;
+
+    bool createFile();
+    bool loadHeader();
+    bool writeHeader();
+    bool readRecordAt(uint32_t offset, JournalRecord& record);
+    bool readSlot(uint32_t seq, JournalRecord& record);
+    bool writeSlot(const JournalRecord& record);
+    void advanceTail();
+    void finish(uint32_t seq);
+    static uint32_t currentTime();
+
+    static uint32_t slotOffset(uint32_t seq);
+    static uint32_t recordCrc(const JournalRecord& record);
+    static uint32_t headerCrc(const JournalHeader& header);
+
+public:
+    ActivityJournal();
+
+    bool begin();
+    bool isReady() const { return ready; }
+
+    // Queue a log for later upload; when full the oldest record is dropped
+    bool append(const String& memberID, int institution);
+    // Oldest record not yet acknowledged, false when the journal is empty
+    bool peek(JournalRecord& record);
+    // Up to maxRecords unfinished records, oldest first
+    uint8_t peekBatch(JournalRecord* records, uint8_t maxRecords);
+    // Remove a record returned by peek()/peekBatch()
+    void acknowledge(uint32_t seq);
+    // Remove it without uploading, the server refused it
+    void reject(uint32_t seq);
+
+    uint32_t getDepth() const { return nextSeq - 1 - ackedSeq; }
+    uint16_t getCapacity() const { return JOURNAL_CAPACITY; }
+    const JournalStats& getStats() const { return stats; }
+};
+
+// =============================================
+// GLOBAL INSTANCE
+// =============================================
+
+extern ActivityJournal activityJournal;
+
+#endif // ACTIVITY_JOURNAL_H
@@ -0,0 +1,75 @@
+#include "alloc_counter.h"
+
+// Plain zero-initialised globals: the wrappers run long before any
+// constructor, and from every task at once
+static volatile TaskHandle_t trackedTasks[ALLOC_TASK_COUNT] = {};
+static volatile uint32_t trackedAllocations[ALLOC_TASK_COUNT] = {};
+static volatile bool wrappersActive = false;
+
+static inline void noteAllocation()
+{
+    wrappersActive = true;
+    TaskHandle_t current = xTaskGetCurrentTaskHandle();
+    for (int i = 0; i < ALLOC_TASK_COUNT; i++)
+    {
+        if (trackedTasks[i] != NULL && current == trackedTasks[i])
+        {
+            // Only the tracked task increments its own count, no lock needed
+            trackedAllocations[i]++;
+            return;
+        }
+    }
+}
+
+// =============================================
+// LINKER WRAPPERS
+// =============================================
+
+extern "C" {
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *pointer, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    noteAllocation();
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+    noteAllocation();
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *pointer, size_t size)
+{
+    noteAllocation();
+    return __real_realloc(pointer, size);
+}
+}
+
+// =============================================
+// CLASS IMPLEMENTATION
+// =============================================
+
+void AllocationCounter::trackTask(TaskHandle_t task, AllocationTask slot)
+{
+    trackedTasks[slot] = task;
+}
+
+uint32_t AllocationCounter::getCount(AllocationTask slot) const
+{
+    return trackedAllocations[slot];
+}
+
+bool AllocationCounter::isActive() const
+{
+    return wrappersActive;
+}
+
+// =============================================
+// GLOBAL INSTANCE
+// =============================================
+
+AllocationCounter allocationCounter;
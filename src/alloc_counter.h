@@ -0,0 +1,37 @@
+#ifndef ALLOC_COUNTER_H
+#define ALLOC_COUNTER_H
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+// =============================================
+// ALLOCATION COUNTER CLASS
+// =============================================
+
+// Which of the tracked tasks a count belongs to
+enum AllocationTask {
+    ALLOC_TASK_STATE_MACHINE,
+    ALLOC_TASK_SERVER_SYNC,
+    ALLOC_TASK_COUNT
+};
+
+// Counts malloc/calloc/realloc calls made by each tracked task. The heap functions
+// reach the wrappers in alloc_counter.cpp through the linker flags
+//   -Wl,--wrap=malloc -Wl,--wrap=calloc -Wl,--wrap=realloc
+// in platformio.ini; without them isActive() stays false.
+class AllocationCounter {
+public:
+    // Only allocations made by tracked tasks are counted, each on its own
+    void trackTask(TaskHandle_t task, AllocationTask slot = ALLOC_TASK_STATE_MACHINE);
+    uint32_t getCount(AllocationTask slot = ALLOC_TASK_STATE_MACHINE) const;
+    bool isActive() const;
+};
+
+// =============================================
+// GLOBAL INSTANCE
+// =============================================
+
+extern AllocationCounter allocationCounter;
+
+#endif // ALLOC_COUNTER_H
@@ -1,260 +1,1674 @@
 #include "api_client.h"
+#include "alloc_counter.h"
+#include "server_ca.h"
 #include <WiFi.h>
+#include <limits.h>
+
+#define ACTIVITY_BODY_FORMAT    ((BodyFormat)API_BODY_FORMAT)
+
+// =============================================
+// REQUEST LOCK
+// =============================================
+
+// Held for a whole public call, so the other task can neither share the
+// connection nor overwrite responseBuffer before it has been parsed. A
+// caller that passes waiting is counted there while it blocks, which tells
+// the holder to give up the lock as early as it can.
+class APIRequestLock {
+private:
+    SemaphoreHandle_t mutex;
+    bool locked;
+
+public:
+    APIRequestLock(SemaphoreHandle_t mutex, TickType_t wait = portMAX_DELAY, volatile uint8_t *waiting = nullptr)
+        : mutex(mutex)
+    {
+        locked = xSemaphoreTakeRecursive(mutex, 0) == pdTRUE;
+        if (!locked && wait > 0)
+        {
+            if (waiting != nullptr)
+            {
+                (*waiting)++;
+            }
+            locked = xSemaphoreTakeRecursive(mutex, wait) == pdTRUE;
+            if (waiting != nullptr)
+            {
+                (*waiting)--;
+            }
+        }
+    }
+    ~APIRequestLock()
+    {
+        if (locked)
+        {
+            xSemaphoreGiveRecursive(mutex);
+        }
+    }
+    bool isLocked() const { return locked; }
+};
+
+// Passes a streamed download on to its sink until a tap starts waiting for
+// requestMutex, then refuses further bytes so writeToStream() gives up and
+// the lock is released
+class TapYieldingSink : public Stream {
+private:
+    Stream &sink;
+    volatile uint8_t &tapsWaiting;
+    bool yielded;
+
+public:
+    TapYieldingSink(Stream &sink, volatile uint8_t &tapsWaiting)
+        : sink(sink), tapsWaiting(tapsWaiting), yielded(false)
+    {
+    }
+
+    size_t write(uint8_t value) override { return write(&value, 1); }
+    size_t write(const uint8_t *buffer, size_t size) override
+    {
+        if (yielded || tapsWaiting > 0)
+        {
+            yielded = true;
+            return 0;
+        }
+        return sink.write(buffer, size);
+    }
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+    bool gaveWay() const { return yielded; }
+};
+
+// =============================================
+// CLASS IMPLEMENTATION
+// =============================================
+
+APIClient::APIClient() : baseURL("http://192.168.87.83:7894"), requestTimeout(5000), endpointCount(0),
+    activeEndpoint(0), probeEndpoint(-1), requestEndpoint(0), asyncEndpoint(0), asyncCapable(false),
+    wifiWasConnected(false), lastWarmUpCheck(0), combinedTapSupport(-1), batchLogSupport(-1), uidLookupSupport(-1),
+    capabilitiesCheckedAt(0), capabilitiesFailedAt(0), tapTask(NULL), tapRequestsWaiting(0), answeredFromCache(false), asyncTargetStart(0),
+    asyncTargetEnd(0), asyncHeadersStart(0), lastRequestAllocations(0), lastBatchAllocations(0)
+{ // 5 second timeout
+    deviceID[0] = '\0';
+    responseBuffer[0] = '\0';
+    responseLength = 0;
+    lastResponseCode = 0;
+    lastResponseBody = "";
+
+    // One filter for every JSON response, each only has its own fields
+    responseFilter["valid"] = true;
+    responseFilter["logged"] = true;
+    responseFilter["message"] = true;
+    responseFilter["success"] = true;
+    responseFilter["combined_tap"] = true;
+    responseFilter["batch_log"] = true;
+    responseFilter["uid_lookup"] = true;
+    responseFilter["found"] = true;
+    responseFilter["id_santri"] = true;
+    responseFilter["results"][0]["seq"] = true;
+    responseFilter["results"][0]["status"] = true;
+    responseFilter.shrinkToFit();
+    memset(&connStats, 0, sizeof(connStats));
+    memset(&prefetchStats, 0, sizeof(prefetchStats));
+    memset(&failoverStats, 0, sizeof(failoverStats));
+    memset(&hedge, 0, sizeof(hedge));
+    requestMutex = xSemaphoreCreateRecursiveMutex();
+    parseServerURLs();
+}
+
+void APIClient::begin(const char* serverURL)
+{
+    if (serverURL) {
+        baseURL = String(serverURL);
+        Serial.printf("API Client initialized with URL: %s\n", serverURL);
+    } else {
+        Serial.printf("API Client initialized with default URL: %s\n", baseURL.c_str());
+    }
+    
+    parseServerURLs();
+    configureTLS();
+    getDeviceID();
+
+    // Initialize HTTP client if needed
+    httpClient.setTimeout(requestTimeout);
+    httpClient.setReuse(true);
+}
+
+void APIClient::setServerURL(const char* serverURL)
+{
+    APIRequestLock lock(requestMutex);
+    if (serverURL) {
+        baseURL = String(serverURL);
+        parseServerURLs();
+        configureTLS();
+        combinedTapSupport = -1;
+        batchLogSupport = -1;
+        uidLookupSupport = -1;
+        Serial.printf("API Server URL updated to: %s\n", serverURL);
+    }
+}
+
+void APIClient::parseServerURLs()
+{
+    closeConnection();
+    endpointCount = 0;
+    activeEndpoint = 0;
+
+    int start = 0;
+    while (endpointCount < API_MAX_ENDPOINTS)
+    {
+        int comma = baseURL.indexOf(',', start);
+        String url = comma >= 0 ? baseURL.substring(start, comma) : baseURL.substring(start);
+        url.trim();
+        if (url.length() > 0)
+        {
+            parseServerURL(endpoints[endpointCount++], url);
+        }
+        if (comma < 0)
+        {
+            break;
+        }
+        start = comma + 1;
+    }
+    if (endpointCount == 0)
+    {
+        parseServerURL(endpoints[endpointCount++], baseURL);
+    }
+
+    // AsyncTCP has no TLS, one https server keeps every request blocking
+    asyncCapable = true;
+    for (uint8_t i = 0; i < endpointCount; i++)
+    {
+        asyncCapable = asyncCapable && endpoints[i].persistent && !endpoints[i].secure;
+        if (endpointCount > 1)
+        {
+            Serial.printf("API server %u: %s\n", i + 1, endpoints[i].baseURL.c_str());
+        }
+    }
+}
+
+void APIClient::parseServerURL(APIEndpoint &endpoint, const String &url)
+{
+    endpoint.baseURL = url;
+    endpoint.host = "";
+    endpoint.port = 0;
+    endpoint.path = "";
+    endpoint.measuredAt = 0;
+    endpoint.requests = 0;
+    endpoint.health.reset();
+
+    endpoint.secure = url.startsWith("https://");
+    endpoint.persistent = endpoint.secure || url.startsWith("http://");
+    if (!endpoint.persistent)
+    {
+        endpoint.dns.setHost("");
+        return;
+    }
+
+    String hostPort = url.substring(endpoint.secure ? 8 : 7);
+    int slashIndex = hostPort.indexOf('/');
+    if (slashIndex >= 0)
+    {
+        endpoint.path = hostPort.substring(slashIndex);
+        hostPort = hostPort.substring(0, slashIndex);
+    }
+
+    int colonIndex = hostPort.indexOf(':');
+    if (colonIndex >= 0)
+    {
+        endpoint.host = hostPort.substring(0, colonIndex);
+        endpoint.port = hostPort.substring(colonIndex + 1).toInt();
+    }
+    else
+    {
+        endpoint.host = hostPort;
+        endpoint.port = endpoint.secure ? 443 : 80;
+    }
+    endpoint.dns.setHost(endpoint.host);
+}
+
+void APIClient::configureTLS()
+{
+    // Without a CA the chain is not checked, verifyServerCertificate()
+    // compares the fingerprint right after the handshake instead
+    bool anySecure = false;
+    for (uint8_t i = 0; i < API_MAX_ENDPOINTS; i++)
+    {
+        WiFiClientSecure &client = endpoints[i].secureClient;
+        client.setHandshakeTimeout(API_TLS_HANDSHAKE_TIMEOUT);
+        if (API_TLS_CA_CERT[0] != '\0')
+        {
+            client.setCACert(API_TLS_CA_CERT);
+        }
+        else
+        {
+            client.setInsecure();
+        }
+        anySecure = anySecure || (i < endpointCount && endpoints[i].secure);
+    }
+
+    if (API_TLS_CA_CERT[0] != '\0')
+    {
+        Serial.println("HTTPS: server certificate checked against the pinned CA");
+    }
+    else if (strlen(API_TLS_FINGERPRINT) > 0)
+    {
+        Serial.println("HTTPS: server certificate checked against the pinned fingerprint");
+    }
+    else if (anySecure)
+    {
+        Serial.println("HTTPS: no CA or fingerprint pinned, the server is NOT verified");
+    }
+}
+
+bool APIClient::verifyServerCertificate(APIEndpoint &endpoint)
+{
+    if (API_TLS_CA_CERT[0] != '\0' || strlen(API_TLS_FINGERPRINT) == 0)
+    {
+        return true;
+    }
+    return endpoint.secureClient.verify(API_TLS_FINGERPRINT, endpoint.host.c_str());
+}
+
+// =============================================
+// SERVER SELECTION
+// =============================================
+
+uint8_t APIClient::selectEndpoint()
+{
+    // A server with an open (or probing) circuit is out; the others compete
+    // on expected time to an answer. The active one keeps its place unless
+    // another beats it by API_ENDPOINT_SWITCH_MARGIN, so close calls do not
+    // flip back and forth.
+    uint8_t best = activeEndpoint;
+    unsigned long bestTime = ULONG_MAX;
+    if (endpoints[best].health.getState() == BREAKER_CLOSED)
+    {
+        bestTime = endpoints[best].health.getExpectedTime(requestTimeout);
+    }
+    unsigned long threshold = bestTime / 100 * (100 - API_ENDPOINT_SWITCH_MARGIN);
+
+    for (uint8_t i = 0; i < endpointCount; i++)
+    {
+        if (i == activeEndpoint || endpoints[i].health.getState() != BREAKER_CLOSED)
+        {
+            continue;
+        }
+        unsigned long expected = endpoints[i].health.getExpectedTime(requestTimeout);
+        if (expected < threshold)
+        {
+            best = i;
+            threshold = expected;
+        }
+    }
+
+    if (best != activeEndpoint)
+    {
+        failoverStats.switches++;
+        Serial.printf("API server switched from %s to %s (expected answer in %lu ms)\n",
+                      endpoints[activeEndpoint].host.c_str(), endpoints[best].host.c_str(), threshold);
+        activeEndpoint = best;
+    }
+    return best;
+}
+
+uint8_t APIClient::nextEndpoint(uint8_t from)
+{
+    for (uint8_t i = 1; i < endpointCount; i++)
+    {
+        uint8_t index = (from + i) % endpointCount;
+        if (endpoints[index].health.getState() != BREAKER_OPEN)
+        {
+            return index;
+        }
+    }
+    return from;
+}
+
+void APIClient::recordOutcome(APIEndpoint &endpoint, int status, unsigned long rttMs, bool timed)
+{
+    endpoint.measuredAt = millis();
+    if (isRetryableStatus(status))
+    {
+        endpoint.health.recordFailure();
+        if (status == HTTPC_ERROR_CONNECTION_REFUSED)
+        {
+            endpoint.dns.markStale();
+        }
+        return;
+    }
+    if (timed)
+    {
+        endpoint.health.addSample(rttMs);
+    }
+    endpoint.health.recordSuccess();
+}
+
+bool APIClient::isCircuitOpen() const
+{
+    for (uint8_t i = 0; i < endpointCount; i++)
+    {
+        if (!endpoints[i].health.isOpen())
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// =============================================
+// CONNECTION KEEP-ALIVE
+// =============================================
+
+void APIClient::closeIdleAsyncConnections()
+{
+    asyncHttp.closeIdleConnections();
+}
+
+void APIClient::maintainConnection()
+{
+    // The uploader is using the connection, that keeps it warm as well
+    APIRequestLock lock(requestMutex, 0);
+    if (!lock.isLocked())
+    {
+        return;
+    }
+
+    if (!isReady())
+    {
+        if (wifiWasConnected)
+        {
+            closeConnection();
+            wifiWasConnected = false;
+        }
+        return;
+    }
+
+    // Connect right after WiFi (re)connects, then look again every
+    // API_WARMUP_INTERVAL in case the server closed the idle connection
+    if (wifiWasConnected && millis() - lastWarmUpCheck < API_WARMUP_INTERVAL)
+    {
+        return;
+    }
+    wifiWasConnected = true;
+    lastWarmUpCheck = millis();
+
+    // A server with an open circuit would only make this wait for the
+    // connect timeout; its probe reconnects once it answers again
+    APIEndpoint &endpoint = endpoints[selectEndpoint()];
+    if (endpoint.health.isOpen())
+    {
+        return;
+    }
+    if (endpoint.persistent && !endpoint.connection().connected())
+    {
+        warmUpConnection();
+    }
+
+    // Ask once per server; a failed attempt is retried on the next check
+    if (needsCapabilities())
+    {
+        discoverCapabilities();
+    }
+}
+
+bool APIClient::warmUpConnection()
+{
+    APIRequestLock lock(requestMutex);
+    APIEndpoint &endpoint = endpoints[activeEndpoint];
+    if (!endpoint.persistent || !isReady() || endpoint.health.isOpen())
+    {
+        return false;
+    }
+    if (endpoint.connection().connected())
+    {
+        return true;
+    }
+
+    unsigned long connectUs = 0;
+    if (!openConnection(endpoint, connectUs))
+    {
+        return false;
+    }
+
+    connStats.warmUps++;
+    Serial.printf("API connection warmed up to %s:%u in %lu us%s\n", endpoint.host.c_str(), endpoint.port, connectUs,
+                  endpoint.secure ? " (TLS handshake included)" : "");
+    return true;
+}
+
+bool APIClient::openConnection(APIEndpoint &endpoint, unsigned long &connectUs)
+{
+    WiFiClient &client = endpoint.connection();
+    client.stop();
+
+    // The cached address skips the DNS query; TLS still gets the host name
+    // for SNI and the certificate check
+    IPAddress address;
+    bool cached = endpoint.dns.lookup(address);
+    const char *caCert = API_TLS_CA_CERT[0] != '\0' ? API_TLS_CA_CERT : nullptr;
+
+    unsigned long connectStart = micros();
+    bool connected;
+    if (!cached)
+    {
+        connected = client.connect(endpoint.host.c_str(), endpoint.port, API_CONNECT_TIMEOUT);
+    }
+    else if (endpoint.secure)
+    {
+        connected = endpoint.secureClient.connect(address, endpoint.port, endpoint.host.c_str(), caCert, nullptr,
+                                                  nullptr);
+    }
+    else
+    {
+        connected = endpoint.wifiClient.connect(address, endpoint.port, API_CONNECT_TIMEOUT);
+    }
+    connectUs = micros() - connectStart;
+
+    if (!connected)
+    {
+        if (cached)
+        {
+            endpoint.dns.markStale();
+        }
+        lastError = "Failed to connect to " + endpoint.host;
+        return false;
+    }
+
+    if (endpoint.secure)
+    {
+        connStats.tlsHandshakes++;
+        connStats.lastHandshakeUs = connectUs;
+        connStats.totalHandshakeUs += connectUs;
+        if (connectUs > connStats.maxHandshakeUs)
+        {
+            connStats.maxHandshakeUs = connectUs;
+        }
+        if (!verifyServerCertificate(endpoint))
+        {
+            client.stop();
+            connStats.tlsRejected++;
+            lastError = "Server certificate does not match the pinned fingerprint";
+            Serial.println(lastError);
+            return false;
+        }
+    }
+    else
+    {
+        // Requests are single writes, no point waiting for more data to coalesce
+        endpoint.wifiClient.setNoDelay(true);
+    }
+
+    connStats.connects++;
+    if (connectUs > connStats.maxConnectUs)
+    {
+        connStats.maxConnectUs = connectUs;
+    }
+    return true;
+}
+
+void APIClient::closeConnection()
+{
+    for (uint8_t i = 0; i < API_MAX_ENDPOINTS; i++)
+    {
+        endpoints[i].wifiClient.stop();
+        endpoints[i].secureClient.stop();
+    }
+}
+
+bool APIClient::beginRequest(APIEndpoint &endpoint, const String &path, bool &reused, unsigned long timeoutMs)
+{
+    httpClient.setTimeout(timeoutMs);
+    connStats.requests++;
+    connStats.lastConnectUs = 0;
+    reused = false;
+
+    if (!endpoint.persistent)
+    {
+        return httpClient.begin(endpoint.baseURL + path);
+    }
+
+    // HTTPClient skips its own connect when the client is still connected
+    WiFiClient &client = endpoint.connection();
+    reused = client.connected();
+    if (reused)
+    {
+        connStats.reusedRequests++;
+    }
+    else
+    {
+        unsigned long connectUs = 0;
+        if (!openConnection(endpoint, connectUs))
+        {
+            return false;
+        }
+        connStats.lastConnectUs = connectUs;
+        connStats.totalConnectUs += connectUs;
+    }
+
+    return httpClient.begin(client, endpoint.baseURL + path);
+}
+
+bool APIClient::isStaleConnectionError(int code, bool idempotent)
+{
+    // Failures of a reused connection while sending: the request never
+    // reached the server, so sending it again is safe
+    if (code == HTTPC_ERROR_SEND_HEADER_FAILED || code == HTTPC_ERROR_SEND_PAYLOAD_FAILED ||
+        code == HTTPC_ERROR_NOT_CONNECTED)
+    {
+        return true;
+    }
+    // Lost while waiting for the headers: the whole request was written and
+    // may have been processed, only a GET may run twice
+    return idempotent && code == HTTPC_ERROR_CONNECTION_LOST;
+}
+
+uint8_t APIClient::getReuseRatePercent() const
+{
+    if (connStats.requests == 0)
+    {
+        return 0;
+    }
+    return (uint8_t)((connStats.reusedRequests * 100UL) / connStats.requests);
+}
+
+bool APIClient::isReady()
+{
+    return WiFi.status() == WL_CONNECTED;
+}
+
+bool APIClient::validateSantriCard(const String &cardUID, const String &santriID)
+{
+    APIRequestLock lock(requestMutex, portMAX_DELAY, tapWaitCounter());
+    resetLastResponse();
+
+    // Repeat taps and known-bad cards need no round trip
+    ValidationCache::Lookup cached = lookupValidationCache(cardUID, santriID);
+    if (cached != ValidationCache::CACHE_MISS)
+    {
+        answeredFromCache = true;
+        return cached == ValidationCache::CACHE_VALID;
+    }
+
+    if (!isReady())
+    {
+        lastError = "WiFi not connected";
+        return false;
+    }
+
+    bodyBuilder.reset();
+    buildValidationQuery(bodyBuilder, cardUID, santriID);
+    String path = String(VALIDATE_UID_ENDPOINT) + bodyBuilder.c_str();
+
+    Serial.print("Validating card - UID: ");
+    Serial.print(cardUID);
+    Serial.print(", Santri ID: ");
+    Serial.println(santriID);
+    Serial.print("Request path: ");
+    Serial.println(path);
+
+    int responseCode = sendGETRequest(path);
+
+    if (responseCode == 200)
+    {
+        bool result = false;
+        if (!parseValidationVerdict(responseBuffer, result))
+        {
+            return false;
+        }
+        validationCache.store(cardUID, santriID, result);
+        return result;
+    }
+    else
+    {
+        lastError = "HTTP request failed with code: " + String(responseCode);
+        return false;
+    }
+}
+
+bool APIClient::validateSantriCard(const CardSession &session, const String &santriID)
+{
+    return validateSantriCard(session.uidHex, santriID);
+}
+
+void APIClient::buildValidationQuery(RequestBuilder &out, const String &cardUID, const String &santriID)
+{
+    out.append("?id_card=");
+    out.appendEncoded(cardUID.c_str());
+    out.append("&id_santri=");
+    out.appendEncoded(santriID.c_str());
+    out.append("&id_device=").append(getDeviceID());
+}
+
+bool APIClient::parseValidationVerdict(const char *response, bool &isValid)
+{
+#if API_DEBUG_RESPONSES
+    Serial.print("Raw Response: ");
+    Serial.println(response);
+#endif
+
+    // "true:<message>" or "false:<message>"
+    const char *colon = strchr(response, ':');
+    if (colon == nullptr)
+    {
+        Serial.println("Invalid response format (missing colon)");
+        return false;
+    }
+
+    isValid = colon - response == 4 && strncmp(response, "true", 4) == 0;
+    Serial.print("Server Message: ");
+    Serial.println(colon + 1);
+    return true;
+}
+
+bool APIClient::logSantriActivity(const String &memberID, int institution, uint32_t tappedAt)
+{
+    APIRequestLock lock(requestMutex, portMAX_DELAY, tapWaitCounter());
+    resetLastResponse();
+    if (!isReady())
+    {
+        lastError = "WiFi not connected";
+        return false;
+    }
+
+    String path = LOG_ACTIVITY_ENDPOINT;
+
+    Serial.print("Logging activity for member: ");
+    Serial.println(memberID);
+    Serial.print("Institution: ");
+    Serial.println(institution);
+    Serial.print("Request path: ");
+    Serial.println(path);
+
+    // Sent as multipart/form-data or urlencoded, see API_BODY_FORMAT
+    bodyBuilder.reset();
+    buildActivityPayload(bodyBuilder, memberID, institution, tappedAt);
+    if (bodyBuilder.isOverflowed())
+    {
+        lastError = "Activity payload too large";
+        return false;
+    }
+    if (!performRequest(path, "POST", bodyBuilder.c_str(), bodyBuilder.length(),
+                        RequestBuilder::contentType(ACTIVITY_BODY_FORMAT)))
+    {
+        return false;
+    }
+
+    Serial.print("POST Response Code: ");
+    Serial.println(lastResponseCode);
+
+    if (lastResponseCode == 200 || lastResponseCode == 201)
+    {
+        bool success;
+        if (parseActivityResponse(responseBuffer, responseLength, lastResponseCode, success, jsonArena))
+        {
+            Serial.print("Activity log result: ");
+            Serial.println(success ? "Success" : "Failed");
+            return success;
+        }
+        else
+        {
+            lastError = "Failed to parse activity response";
+            return false;
+        }
+    }
+    else
+    {
+        lastError = "HTTP request failed with code: " + String(lastResponseCode);
+        return false;
+    }
+}
+
+void APIClient::buildActivityPayload(RequestBuilder &out, const String &memberID, int institution, uint32_t tappedAt)
+{
+    out.beginForm(ACTIVITY_BODY_FORMAT);
+    out.addField("memberID", memberID.c_str());
+    out.addField("counter", (uint32_t)1);
+    out.addField("institution", (uint32_t)institution);
+    if (tappedAt != 0)
+    {
+        out.addField("tapped_at", tappedAt);
+    }
+    out.endForm();
+}
+
+bool APIClient::isCombinedTapEnabled() const
+{
+#if API_COMBINED_MODE == 1
+    return combinedTapSupport != 0;
+#elif API_COMBINED_MODE == 2
+    return combinedTapSupport == 1;
+#else
+    return false;
+#endif
+}
+
+bool APIClient::isBatchLogEnabled() const
+{
+#if API_BATCH_MODE == 1
+    return batchLogSupport != 0;
+#elif API_BATCH_MODE == 2
+    return batchLogSupport == 1;
+#else
+    return false;
+#endif
+}
+
+bool APIClient::isPrefetchEnabled() const
+{
+#if API_PREFETCH_MODE == 1
+    return uidLookupSupport != 0;
+#elif API_PREFETCH_MODE == 2
+    return uidLookupSupport == 1;
+#else
+    return false;
+#endif
+}
+
+bool APIClient::needsCapabilities() const
+{
+    if (API_COMBINED_MODE != 2 && API_BATCH_MODE != 2 && API_PREFETCH_MODE != 2)
+    {
+        return false;
+    }
+    if (capabilitiesFailedAt != 0 && millis() - capabilitiesFailedAt < CAPABILITIES_RETRY_INTERVAL)
+    {
+        return false;
+    }
+    if ((API_COMBINED_MODE == 2 && combinedTapSupport < 0) || (API_BATCH_MODE == 2 && batchLogSupport < 0) ||
+        (API_PREFETCH_MODE == 2 && uidLookupSupport < 0))
+    {
+        return true;
+    }
+    // Re-checked now and then, a 304 keeps the flags as they are
+    return millis() - capabilitiesCheckedAt >= CAPABILITIES_REFRESH_INTERVAL;
+}
+
+bool APIClient::discoverCapabilities()
+{
+    APIRequestLock lock(requestMutex);
+    if (!isReady())
+    {
+        return false;
+    }
+
+    char body[CAPABILITIES_MAX_BODY];
+    BufferSink sink(body, sizeof(body));
+    bool known = combinedTapSupport >= 0 && batchLogSupport >= 0 && uidLookupSupport >= 0;
+    FetchResult result = fetchResource(CAPABILITIES_ENDPOINT, "", sink, known);
+
+    // Only a server without the endpoint supports none of it. No answer or
+    // any other error (5xx, ...) says nothing, the flags stay as they are
+    // and the check is repeated after CAPABILITIES_RETRY_INTERVAL.
+    bool missing = lastResponseCode == 404 || lastResponseCode == 405 || lastResponseCode == 501;
+    if (result == FETCH_FAILED && !missing)
+    {
+        capabilitiesFailedAt = millis();
+        return false;
+    }
+
+    capabilitiesFailedAt = 0;
+    capabilitiesCheckedAt = millis();
+    if (result == FETCH_NOT_MODIFIED)
+    {
+        return true;
+    }
+
+    combinedTapSupport = 0;
+    batchLogSupport = 0;
+    uidLookupSupport = 0;
+    if (result == FETCH_UPDATED)
+    {
+        JsonDocument doc(&jsonArena);
+        if (!deserializeJson(doc, sink.c_str(), sink.getLength(), DeserializationOption::Filter(responseFilter)))
+        {
+            combinedTapSupport = doc["combined_tap"].as<bool>() ? 1 : 0;
+            batchLogSupport = doc["batch_log"].as<bool>() ? 1 : 0;
+            uidLookupSupport = doc["uid_lookup"].as<bool>() ? 1 : 0;
+        }
+    }
+
+    Serial.printf("Server capabilities: combined tap %s, batch log %s, UID lookup %s\n",
+                  combinedTapSupport == 1 ? "supported" : "not supported",
+                  batchLogSupport == 1 ? "supported" : "not supported",
+                  uidLookupSupport == 1 ? "supported" : "not supported");
+    return true;
+}
+
+bool APIClient::logSantriActivityBatch(const JournalRecord *records, uint8_t count, uint8_t *results)
+{
+    APIRequestLock lock(requestMutex);
+    resetLastResponse();
+    memset(results, BATCH_RETRY, count);
+    if (!isReady())
+    {
+        lastError = "WiFi not connected";
+        return false;
+    }
+
+    uint32_t allocationsBefore = allocationCounter.getCount(ALLOC_TASK_SERVER_SYNC);
+    bodyBuilder.reset();
+    bodyBuilder.append(BATCH_LOG_ENDPOINT "?id_device=").append(getDeviceID());
+    batchBody.reset();
+    buildBatchPayload(batchBody, records, count);
+    lastBatchAllocations = allocationCounter.getCount(ALLOC_TASK_SERVER_SYNC) - allocationsBefore;
+    if (bodyBuilder.isOverflowed() || batchBody.isOverflowed())
+    {
+        lastError = "Batch payload too large";
+        return false;
+    }
+
+    Serial.printf("Uploading %u activity records in one request (%u bytes)\n", count, batchBody.length());
+    if (!performRequest(bodyBuilder.c_str(), "POST", batchBody.c_str(), batchBody.length(), "text/csv"))
+    {
+        return false;
+    }
+
+    Serial.print("Batch Response Code: ");
+    Serial.println(lastResponseCode);
+
+    if (lastResponseCode == 404 || lastResponseCode == 405 || lastResponseCode == 501)
+    {
+        batchLogSupport = 0;
+        Serial.println("Batch log endpoint not available, using single requests");
+        return false;
+    }
+
+    if (lastResponseCode != 200 && lastResponseCode != 201)
+    {
+        lastError = "HTTP request failed with code: " + String(lastResponseCode);
+        return false;
+    }
+
+    return parseBatchResponse(responseBuffer, responseLength, records, count, results);
+}
+
+void APIClient::buildBatchPayload(RequestBuilder &out, const JournalRecord *records, uint8_t count)
+{
+    // One line per record: seq,memberID,institution,tapped_at
+    for (uint8_t i = 0; i < count; i++)
+    {
+        out.appendNumber(records[i].seq).append(',');
+        // The induk comes off the card, it may hold anything
+        out.appendCsvField(records[i].memberID).append(',');
+        out.appendNumber(records[i].institution).append(',');
+        out.appendNumber(records[i].tappedAt).append('\n');
+    }
+}
+
+bool APIClient::parseBatchResponse(const char *response, size_t length, const JournalRecord *records, uint8_t count,
+                                   uint8_t *results)
+{
+    // {"results": [{"seq": 12, "status": "ok"}, {"seq": 13, "status": "rejected"}, ...]}
+    // Records left out or with any other status are retried.
+    JsonDocument doc(&jsonArena);
+    DeserializationError error = deserializeJson(doc, response, length, DeserializationOption::Filter(responseFilter));
+    if (error)
+    {
+        lastError = "JSON parsing failed: " + String(error.c_str());
+        return false;
+    }
+
+    bool anyDone = false;
+    for (JsonObject item : doc["results"].as<JsonArray>())
+    {
+        uint32_t seq = item["seq"].as<uint32_t>();
+        const char *status = item["status"].as<const char *>();
+        uint8_t result = BATCH_RETRY;
+        if (status == nullptr)
+        {
+            continue;
+        }
+        if (strcmp(status, "ok") == 0)
+        {
+            result = BATCH_ACCEPTED;
+        }
+        else if (strcmp(status, "rejected") == 0)
+        {
+            result = BATCH_REJECTED;
+        }
+
+        for (uint8_t i = 0; i < count; i++)
+        {
+            if (records[i].seq == seq)
+            {
+                results[i] = result;
+                anyDone = anyDone || result != BATCH_RETRY;
+                break;
+            }
+        }
+    }
+
+    if (!anyDone)
+    {
+        lastError = "Batch response confirmed no records";
+    }
+    return anyDone;
+}
+
+bool APIClient::downloadRoster()
+{
+    APIRequestLock lock(requestMutex);
+    resetLastResponse();
+    if (!isReady())
+    {
+        lastError = "WiFi not connected";
+        return false;
+    }
+
+    // Nothing touches flash until the first bytes of a new roster arrive,
+    // so the update can be opened before we know whether one is coming
+    if (!rosterStore.beginUpdate())
+    {
+        lastError = "No roster partition";
+        return false;
+    }
+
+    // Servers without ETags may still answer 304 from the version alone
+    String query = "?id_device=" + String(getDeviceID()) + "&version=" + String(rosterStore.getVersion());
+
+    // The transfer holds requestMutex, a tap that needs it cuts it short
+    unsigned long startTime = millis();
+    RosterUpdateSink rosterSink;
+    TapYieldingSink sink(rosterSink, tapRequestsWaiting);
+    FetchResult result = fetchResource(ROSTER_ENDPOINT, query, sink, rosterStore.isLoaded());
+    if (result == FETCH_NOT_MODIFIED)
+    {
+        rosterStore.abortUpdate();
+        Serial.printf("Roster v%lu is up to date\n", (unsigned long)rosterStore.getVersion());
+        return true;
+    }
+
+    if (result == FETCH_UPDATED && rosterStore.commitUpdate())
+    {
+        Serial.printf("Roster download: %lu entries in %lu ms\n", (unsigned long)rosterStore.getEntryCount(),
+                      millis() - startTime);
+        return true;
+    }
+
+    rosterStore.abortUpdate();
+    if (sink.gaveWay())
+    {
+        lastError = "Roster download gave way to a tap";
+    }
+    else if (result == FETCH_UPDATED)
+    {
+        // The body arrived but did not check out, do not claim we hold it
+        forgetCachedResource(ROSTER_ENDPOINT);
+        lastError = "Roster rejected by the roster store";
+    }
+    return false;
+}
+
+FetchResult APIClient::fetchResource(const char *endpoint, const String &query, Stream &sink, bool haveCopy)
+{
+    APIRequestLock lock(requestMutex);
+    resetLastResponse();
+    if (!isReady())
+    {
+        lastError = "WiFi not connected";
+        return FETCH_FAILED;
+    }
+
+    const HTTPValidators *validators = haveCopy ? httpCache.get(endpoint) : nullptr;
+    httpCache.countRequest(validators != nullptr);
+    if (!sendRequest(String(endpoint) + query, "GET", nullptr, 0, nullptr, true, validators))
+    {
+        return FETCH_FAILED;
+    }
+
+    FetchResult result = FETCH_FAILED;
+    if (lastResponseCode == 304 && haveCopy)
+    {
+        // Headers only, the body was never sent
+        httpCache.countNotModified();
+        result = FETCH_NOT_MODIFIED;
+    }
+    else if (lastResponseCode == 200)
+    {
+        // Read before writeToStream(), which ends the request
+        String etag = httpClient.header("ETag");
+        String lastModified = httpClient.header("Last-Modified");
+        int expected = httpClient.getSize();
+
+        // Straight from the socket into the sink, -1 size means chunked
+        int written = httpClient.writeToStream(&sink);
+        if (written >= 0 && (expected < 0 || written == expected))
+        {
+            httpCache.update(endpoint, etag, lastModified);
+            httpCache.countFullResponse(written);
+            result = FETCH_UPDATED;
+        }
+        else
+        {
+            lastError = "Body transfer failed (" + String(written) + ")";
+        }
+    }
+    else
+    {
+        lastError = "HTTP request failed with code: " + String(lastResponseCode);
+    }
+
+    httpClient.end();
+    if (result == FETCH_FAILED)
+    {
+        // Part of the body may still be unread
+        endpoints[requestEndpoint].connection().stop();
+    }
+    return result;
+}
+
+void APIClient::forgetCachedResource(const char *endpoint)
+{
+    APIRequestLock lock(requestMutex);
+    httpCache.forget(endpoint);
+}
+
+TapResult APIClient::validateAndLogSantri(const CardSession &session, const String &santriID, int institution)
+{
+    APIRequestLock lock(requestMutex, portMAX_DELAY, tapWaitCounter());
+    resetLastResponse();
+
+    // A known-bad card is turned away locally. A known-good one still needs
+    // this request for the log, which costs the same as logging alone.
+    if (isKnownInvalid(session, santriID))
+    {
+        answeredFromCache = true;
+        return TAP_INVALID;
+    }
+
+    if (!isReady())
+    {
+        lastError = "WiFi not connected";
+        return TAP_REQUEST_FAILED;
+    }
+
+    Serial.print("Validating and logging - UID: ");
+    Serial.print(session.uidHex);
+    Serial.print(", Santri ID: ");
+    Serial.print(santriID);
+    Serial.print(", Institution: ");
+    Serial.println(institution);
+
+    bodyBuilder.reset();
+    buildCombinedTapPayload(bodyBuilder, session, santriID, institution);
+    int responseCode = sendPOSTRequest(COMBINED_TAP_ENDPOINT, bodyBuilder);
+    TapResult result =
+        parseCombinedTapResponse(responseCode, responseBuffer, responseLength, session, santriID, jsonArena);
+    if (result == TAP_REQUEST_FAILED)
+    {
+        lastError = "Combined tap failed with code: " + String(responseCode);
+    }
+    return result;
+}
+
+bool APIClient::isKnownInvalid(const CardSession &session, const String &santriID)
+{
+    if (validationCache.lookup(session.uidHex, santriID) != ValidationCache::CACHE_INVALID)
+    {
+        return false;
+    }
+    Serial.printf("Validation cache hit - UID: %s, invalid\n", session.uidHex.c_str());
+    return true;
+}
+
+void APIClient::buildCombinedTapPayload(RequestBuilder &out, const CardSession &session, const String &santriID,
+                                        int institution)
+{
+    out.beginForm(BODY_URLENCODED);
+    out.addField("id_card", session.uidHex.c_str());
+    out.addField("id_santri", santriID.c_str());
+    out.addField("id_device", getDeviceID());
+    out.addField("institution", (uint32_t)institution);
+    out.addField("counter", (uint32_t)1);
+    out.endForm();
+}
+
+TapResult APIClient::parseCombinedTapResponse(int responseCode, const char *response, size_t length,
+                                              const CardSession &session, const String &santriID, JsonArena &arena)
+{
+    if (responseCode == 404 || responseCode == 405 || responseCode == 501)
+    {
+        combinedTapSupport = 0;
+        Serial.println("Combined tap endpoint not available, using separate requests");
+        return TAP_UNSUPPORTED;
+    }
+
+    if (responseCode != 200 && responseCode != 201)
+    {
+        return TAP_REQUEST_FAILED;
+    }
+
+    JsonDocument doc(&arena);
+    DeserializationError error = deserializeJson(doc, response, length, DeserializationOption::Filter(responseFilter));
+    if (error || !doc["valid"].is<bool>())
+    {
+        Serial.println(error ? "Combined tap: invalid JSON" : "Combined tap: response missing 'valid' field");
+        return TAP_REQUEST_FAILED;
+    }
+
+    if (doc["message"].is<const char*>())
+    {
+        Serial.print("Server Message: ");
+        Serial.println(doc["message"].as<const char*>());
+    }
+
+    validationCache.store(session.uidHex, santriID, doc["valid"].as<bool>());
+    if (!doc["valid"].as<bool>())
+    {
+        return TAP_INVALID;
+    }
+    return doc["logged"].as<bool>() ? TAP_LOGGED : TAP_LOG_FAILED;
+}
 
 // =============================================
-// CLASS IMPLEMENTATION
+// NON-BLOCKING REQUESTS
 // =============================================
 
-APIClient::APIClient() : baseURL("http://192.168.87.83:7894"), requestTimeout(5000)
-{ // 5 second timeout
-    lastResponseCode = 0;
-    lastResponseBody = "";
+// Only the state machine task uses these and the validation cache, so they
+// run without requestMutex and never wait for the sync task's requests.
+// For the same reason they leave lastError and lastResponseCode alone.
+
+bool APIClient::isAsyncAvailable()
+{
+    // AsyncTCP has no TLS, https stays on the blocking path. With every
+    // circuit open the blocking path fails fast instead.
+    return API_ASYNC_REQUESTS && asyncCapable && !isCircuitOpen() && isReady();
 }
 
-void APIClient::begin(const char* serverURL)
+bool APIClient::pollAsync(AsyncHTTPEvent &event)
 {
-    if (serverURL) {
-        baseURL = String(serverURL);
-        Serial.printf("API Client initialized with URL: %s\n", serverURL);
-    } else {
-        Serial.printf("API Client initialized with default URL: %s\n", baseURL.c_str());
+    // The primary of a hedged request is past its p95, race a copy
+    if (hedge.primaryId != 0 && hedge.hedgeId == 0 && hedge.delayMs != 0 &&
+        millis() - hedge.startedAt >= hedge.delayMs)
+    {
+        hedge.delayMs = 0;
+        sendHedge();
     }
-    
-    // Initialize HTTP client if needed
-    httpClient.setTimeout(requestTimeout);
+
+    while (asyncHttp.poll(event))
+    {
+        recordOutcome(endpoints[event.tag], event.status, event.elapsedMs, true);
+        if (resolveHedge(event))
+        {
+            return true;
+        }
+    }
+    return false;
 }
 
-void APIClient::setServerURL(const char* serverURL)
+ValidationCache::Lookup APIClient::lookupValidationCache(const String &cardUID, const String &santriID)
 {
-    if (serverURL) {
-        baseURL = String(serverURL);
-        Serial.printf("API Server URL updated to: %s\n", serverURL);
+    ValidationCache::Lookup cached = validationCache.lookup(cardUID, santriID);
+    if (cached != ValidationCache::CACHE_MISS)
+    {
+        Serial.printf("Validation cache hit - UID: %s, %s\n", cardUID.c_str(),
+                      cached == ValidationCache::CACHE_VALID ? "valid" : "invalid");
     }
+    return cached;
 }
 
-bool APIClient::isReady()
+void APIClient::beginAsyncRequest(const char *method, const char *endpoint)
 {
-    return WiFi.status() == WL_CONNECTED;
+    asyncEndpoint = selectEndpoint();
+    asyncRequest.reset();
+    asyncRequest.append(method).append(' ').append(endpoints[asyncEndpoint].path.c_str());
+    asyncTargetStart = asyncRequest.length();
+    asyncRequest.append(endpoint);
 }
 
-bool APIClient::validateSantriCard(const String &cardUID, const String &santriID)
+uint16_t APIClient::sendAsyncRequest(const char *contentType, const RequestBuilder *body, uint32_t allocationsBefore,
+                                     bool hedged)
 {
-    if (!isReady())
+    APIEndpoint &endpoint = endpoints[asyncEndpoint];
+    asyncTargetEnd = asyncRequest.length();
+    asyncRequest.append(" HTTP/1.1\r\nHost: ").append(endpoint.host.c_str());
+    asyncHeadersStart = asyncRequest.length();
+    asyncRequest.append("\r\nConnection: keep-alive\r\n");
+    if (contentType != nullptr)
     {
-        lastError = "WiFi not connected";
-        return false;
+        asyncRequest.append("Content-Type: ").append(contentType).append("\r\n");
+    }
+    if (body != nullptr)
+    {
+        asyncRequest.append("Content-Length: ").appendNumber(body->length()).append("\r\n\r\n");
+        asyncRequest.append(body->c_str(), body->length());
+    }
+    else
+    {
+        asyncRequest.append("\r\n");
     }
+    lastRequestAllocations = allocationCounter.getCount() - allocationsBefore;
 
-    // Get device MAC address
-    String deviceMAC = getDeviceMACAddress();
+    // A cut-off request would confuse the server, the caller falls back to
+    // the blocking path instead
+    if (asyncRequest.isOverflowed() || (body != nullptr && body->isOverflowed()))
+    {
+        Serial.println("Async request does not fit REQUEST_BUILDER_SIZE");
+        return 0;
+    }
+    IPAddress address;
+    bool cached = endpoint.dns.lookup(address);
+    uint16_t requestId = asyncHttp.send(endpoint.host.c_str(), cached ? &address : nullptr, endpoint.port,
+                                        asyncRequest.c_str(), asyncRequest.length(),
+                                        endpoint.health.getTimeout(requestTimeout), asyncEndpoint);
+    if (requestId == 0)
+    {
+        return 0;
+    }
+    endpoint.requests++;
+    if (!hedged)
+    {
+        return requestId;
+    }
 
-    // Build URL with query parameters
-    String url = buildURL(VALIDATE_UID_ENDPOINT);
-    url += "?id_card=" + cardUID;
-    url += "&id_santri=" + santriID;
-    url += "&id_device=" + deviceMAC;
+    // The copy for the next server is built now, asyncRequest is reused by
+    // the next request. It goes out once this one is slower than its p95,
+    // or right away when it fails.
+    hedge.primaryId = 0;
+    uint8_t standby = nextEndpoint(asyncEndpoint);
+    if (standby == asyncEndpoint)
+    {
+        return requestId;
+    }
+    buildHedgeRequest(endpoints[standby]);
+    if (hedgeRequest.isOverflowed())
+    {
+        return requestId;
+    }
+    hedge.primaryId = requestId;
+    hedge.hedgeId = 0;
+    hedge.endpoint = standby;
+    hedge.startedAt = millis();
+    hedge.delayMs = endpoint.health.getStats().samples >= API_HEDGE_MIN_SAMPLES ? endpoint.health.getP95() : 0;
+    hedge.oneFailed = false;
+    return requestId;
+}
 
-    Serial.print("Validating card - UID: ");
-    Serial.print(cardUID);
-    Serial.print(", Santri ID: ");
-    Serial.print(santriID);
-    Serial.print(", Device MAC: ");
-    Serial.println(deviceMAC);
-    Serial.print("Request URL: ");
-    Serial.println(url);
+void APIClient::buildHedgeRequest(const APIEndpoint &target)
+{
+    // Same request, only the path prefix and Host header belong to the server
+    hedgeRequest.reset();
+    hedgeRequest.append("GET ").append(target.path.c_str());
+    hedgeRequest.append(asyncRequest.c_str() + asyncTargetStart, asyncTargetEnd - asyncTargetStart);
+    hedgeRequest.append(" HTTP/1.1\r\nHost: ").append(target.host.c_str());
+    hedgeRequest.append(asyncRequest.c_str() + asyncHeadersStart, asyncRequest.length() - asyncHeadersStart);
+}
 
-    int responseCode = sendGETRequest(url);
+void APIClient::sendHedge()
+{
+    APIEndpoint &standby = endpoints[hedge.endpoint];
+    if (standby.health.getState() != BREAKER_CLOSED)
+    {
+        return;
+    }
+    IPAddress address;
+    bool cached = standby.dns.lookup(address);
+    hedge.hedgeId = asyncHttp.send(standby.host.c_str(), cached ? &address : nullptr, standby.port,
+                                   hedgeRequest.c_str(), hedgeRequest.length(),
+                                   standby.health.getTimeout(requestTimeout), hedge.endpoint);
+    if (hedge.hedgeId != 0)
+    {
+        standby.requests++;
+        failoverStats.hedges++;
+        Serial.printf("Request %u also sent to %s\n", hedge.primaryId, standby.host.c_str());
+    }
+}
 
-    if (responseCode == 200)
+bool APIClient::resolveHedge(AsyncHTTPEvent &event)
+{
+    if (hedge.primaryId == 0 || (event.requestId != hedge.primaryId && event.requestId != hedge.hedgeId))
     {
-        bool isValid;
-        bool result = false; // Default to false
+        return true;
+    }
 
+    bool fromHedge = event.requestId == hedge.hedgeId;
+    if (isRetryableStatus(event.status))
+    {
+        if (!fromHedge && hedge.hedgeId == 0)
         {
-            String response = lastResponseBody;
-            Serial.print("HTTP Code: ");
-            Serial.println(responseCode);
-            Serial.print("Raw Response: ");
-            Serial.println(response);
-
-            // Extract "true"/"false" and message
-            int colonIndex = response.indexOf(':');
-            if (colonIndex != -1)
-            {
-                String statusPart = response.substring(0, colonIndex);
-                String message = response.substring(colonIndex + 1);
-                result = (statusPart == "true"); // Check if status is "true"
-                Serial.print("Server Message: ");
-                Serial.println(message);
-                Serial.println(result);
-                return result;
-            }
-            else
-            {
-                Serial.println("Invalid response format (missing colon)");
-                return false;
-            }
+            // No need to wait for the p95, fail over now
+            sendHedge();
+        }
+        if (hedge.hedgeId != 0 && !hedge.oneFailed)
+        {
+            // The other one may still answer
+            hedge.oneFailed = true;
+            return false;
         }
     }
-    else
+    else if (fromHedge)
     {
-        lastError = "HTTP request failed with code: " + String(responseCode);
-        return false;
+        failoverStats.hedgeWins++;
     }
+
+    // Whatever arrives of the other one later matches nobody and is dropped
+    event.requestId = hedge.primaryId;
+    hedge.primaryId = 0;
+    return true;
 }
 
-bool APIClient::logSantriActivity(const String &memberID, int institution)
+uint16_t APIClient::startValidation(const CardSession &session, const String &santriID)
 {
-    if (!isReady())
+    Serial.printf("Validating card (async) - UID: %s, Santri ID: %s\n", session.uidHex.c_str(), santriID.c_str());
+    uint32_t allocationsBefore = allocationCounter.getCount();
+    beginAsyncRequest("GET", VALIDATE_UID_ENDPOINT);
+    buildValidationQuery(asyncRequest, session.uidHex, santriID);
+    return sendAsyncRequest(nullptr, nullptr, allocationsBefore, true);
+}
+
+bool APIClient::finishValidation(const AsyncHTTPEvent &event, const CardSession &session, const String &santriID,
+                                 bool &valid)
+{
+    Serial.printf("Async validation: HTTP %d in %lu ms (%s connection)\n", event.status, event.elapsedMs,
+                  event.reused ? "reused" : "new");
+    if (event.status != 200 || !parseValidationVerdict(event.body, valid))
     {
-        lastError = "WiFi not connected";
         return false;
     }
+    validationCache.store(session.uidHex, santriID, valid);
+    return true;
+}
 
-    String url = buildURL(LOG_ACTIVITY_ENDPOINT);
+uint16_t APIClient::startCombinedTap(const CardSession &session, const String &santriID, int institution)
+{
+    Serial.printf("Validating and logging (async) - UID: %s, Santri ID: %s, Institution: %d\n",
+                  session.uidHex.c_str(), santriID.c_str(), institution);
+    uint32_t allocationsBefore = allocationCounter.getCount();
+    asyncBody.reset();
+    buildCombinedTapPayload(asyncBody, session, santriID, institution);
+    beginAsyncRequest("POST", COMBINED_TAP_ENDPOINT);
+    return sendAsyncRequest(RequestBuilder::contentType(BODY_URLENCODED), &asyncBody, allocationsBefore);
+}
 
-    Serial.print("Logging activity for member: ");
-    Serial.println(memberID);
-    Serial.print("Institution: ");
-    Serial.println(institution);
-    Serial.print("Request URL: ");
-    Serial.println(url);
+TapResult APIClient::finishCombinedTap(const AsyncHTTPEvent &event, const CardSession &session, const String &santriID)
+{
+    Serial.printf("Async validate + log: HTTP %d in %lu ms\n", event.status, event.elapsedMs);
+    return parseCombinedTapResponse(event.status, event.body, event.bodyLength, session, santriID, asyncJsonArena);
+}
 
-    // Initialize HTTP client
-    httpClient.setTimeout(requestTimeout);
-    if (!httpClient.begin(url))
+uint16_t APIClient::startActivityLog(const String &memberID, int institution)
+{
+    Serial.printf("Logging activity (async) for member: %s, institution %d\n", memberID.c_str(), institution);
+    uint32_t allocationsBefore = allocationCounter.getCount();
+    asyncBody.reset();
+    buildActivityPayload(asyncBody, memberID, institution, 0);
+    beginAsyncRequest("POST", LOG_ACTIVITY_ENDPOINT);
+    return sendAsyncRequest(RequestBuilder::contentType(ACTIVITY_BODY_FORMAT), &asyncBody, allocationsBefore);
+}
+
+uint16_t APIClient::startPrefetch(const CardSession &session)
+{
+    uint32_t allocationsBefore = allocationCounter.getCount();
+    beginAsyncRequest("GET", UID_LOOKUP_ENDPOINT);
+    asyncRequest.append("?id_card=").appendEncoded(session.uidHex.c_str());
+    asyncRequest.append("&id_device=").append(getDeviceID());
+    uint16_t requestId = sendAsyncRequest(nullptr, nullptr, allocationsBefore, true);
+    if (requestId != 0)
+    {
+        prefetchStats.started++;
+        Serial.printf("Prefetching server record for UID %s\n", session.uidHex.c_str());
+    }
+    return requestId;
+}
+
+ValidationCache::Lookup APIClient::finishPrefetch(const AsyncHTTPEvent &event, const CardSession &session,
+                                                  const String &santriID)
+{
+    Serial.printf("UID prefetch: HTTP %d in %lu ms\n", event.status, event.elapsedMs);
+    if (event.status == 404 || event.status == 405 || event.status == 501)
+    {
+        uidLookupSupport = 0;
+        prefetchStats.failed++;
+        Serial.println("UID lookup endpoint not available, prefetch disabled");
+        return ValidationCache::CACHE_MISS;
+    }
+
+    JsonDocument doc(&asyncJsonArena);
+    if (event.status != 200 || event.truncated ||
+        deserializeJson(doc, event.body, event.bodyLength, DeserializationOption::Filter(responseFilter)) ||
+        !doc["found"].as<bool>() || !doc["valid"].is<bool>())
+    {
+        prefetchStats.failed++;
+        return ValidationCache::CACHE_MISS;
+    }
+
+    const char *serverID = doc["id_santri"].as<const char *>();
+    if (serverID == nullptr || santriID != serverID)
+    {
+        // The card and the server disagree, the regular validation decides
+        prefetchStats.mismatched++;
+        Serial.printf("UID prefetch: server has induk %s, card says %s\n", serverID ? serverID : "-",
+                      santriID.c_str());
+        return ValidationCache::CACHE_MISS;
+    }
+
+    bool valid = doc["valid"].as<bool>();
+    validationCache.store(session.uidHex, santriID, valid);
+    prefetchStats.used++;
+    return valid ? ValidationCache::CACHE_VALID : ValidationCache::CACHE_INVALID;
+}
+
+bool APIClient::finishActivityLog(const AsyncHTTPEvent &event)
+{
+    Serial.printf("Async activity log: HTTP %d in %lu ms\n", event.status, event.elapsedMs);
+    bool success = false;
+    if (event.status != 200 && event.status != 201)
     {
-        lastError = "Failed to initialize HTTP POST request";
         return false;
     }
+    return parseActivityResponse(event.body, event.bodyLength, event.status, success, asyncJsonArena) && success;
+}
 
-    // Set multipart/form-data header
-    httpClient.addHeader("Content-Type", "multipart/form-data; boundary=----WebKitFormBoundary7MA4YWxkTrZu0gW");
+bool APIClient::sendRequest(const String &path, const String &method, const char *payload, size_t length,
+                            const char *contentType, bool collectValidators, const HTTPValidators *validators)
+{
+    if (probeEndpoint >= 0)
+    {
+        return sendRequestTo(endpoints[probeEndpoint], path, method, payload, length, contentType, collectValidators,
+                             validators);
+    }
 
-    // Create multipart form data
-    String boundary = "----WebKitFormBoundary7MA4YWxkTrZu0gW";
-    String payload = "--" + boundary + "\r\n";
-    payload += "Content-Disposition: form-data; name=\"memberID\"\r\n\r\n";
-    payload += memberID + "\r\n";
-    payload += "--" + boundary + "\r\n";
-    payload += "Content-Disposition: form-data; name=\"counter\"\r\n\r\n";
-    payload += "1\r\n";
-    payload += "--" + boundary + "\r\n";
-    payload += "Content-Disposition: form-data; name=\"institution\"\r\n\r\n";
-    payload += String(institution) + "\r\n";
-    payload += "--" + boundary + "--\r\n";
+    uint8_t index = selectEndpoint();
+    bool sent = sendRequestTo(endpoints[index], path, method, payload, length, contentType, collectValidators,
+                              validators);
 
-    lastResponseCode = httpClient.POST(payload);
-    lastResponseBody = getResponseBody();
+    // The next server gets the request when this one never saw it, or when
+    // it is a GET that may safely run twice. A POST that may have arrived
+    // is left to the caller's retry, so nothing is logged twice.
+    // The sync task leaves the standby to a tap waiting for the lock.
+    uint8_t fallback = nextEndpoint(index);
+    if (fallback == index || (sent && (method != "GET" || !isRetryableStatus(lastResponseCode))) ||
+        (tapRequestsWaiting > 0 && xTaskGetCurrentTaskHandle() != tapTask))
+    {
+        return sent;
+    }
+    if (sent)
+    {
+        httpClient.end();
+        endpoints[index].connection().stop();
+    }
+    failoverStats.failovers++;
+    Serial.printf("No answer from %s, trying %s\n", endpoints[index].host.c_str(), endpoints[fallback].host.c_str());
+    return sendRequestTo(endpoints[fallback], path, method, payload, length, contentType, collectValidators,
+                         validators);
+}
 
-    httpClient.end();
+bool APIClient::sendRequestTo(APIEndpoint &endpoint, const String &path, const String &method, const char *payload,
+                              size_t length, const char *contentType, bool collectValidators,
+                              const HTTPValidators *validators)
+{
+    static const char *validatorHeaders[] = {"ETag", "Last-Modified"};
+    bool reused = false;
+    unsigned long sentAt = 0;
 
-    Serial.print("POST Response Code: ");
-    Serial.println(lastResponseCode);
-    Serial.print("Response Body: ");
-    Serial.println(lastResponseBody);
+    if (!endpoint.health.allowRequest())
+    {
+        lastError = "Server unavailable (circuit open)";
+        return false;
+    }
+    requestEndpoint = &endpoint - endpoints;
+    endpoint.requests++;
 
-    if (lastResponseCode == 200 || lastResponseCode == 201)
+    // Resources are produced and streamed at the server's pace, they keep
+    // the full timeout and stay out of the response time estimate
+    unsigned long timeoutMs = collectValidators ? requestTimeout : endpoint.health.getTimeout(requestTimeout);
+
+    for (uint8_t attempt = 0; attempt < 2; attempt++)
     {
-        bool success;
-        if (parseActivityResponse(lastResponseBody, success))
+        if (!beginRequest(endpoint, path, reused, timeoutMs))
         {
-            Serial.print("Activity log result: ");
-            Serial.println(success ? "Success" : "Failed");
-            return success;
+            recordOutcome(endpoint, HTTPC_ERROR_NOT_CONNECTED, 0, false);
+            lastError = "Failed to initialize HTTP " + method + " request";
+            return false;
         }
-        else
+        sentAt = millis();
+
+        if (contentType != nullptr)
         {
-            lastError = "Failed to parse activity response";
-            return false;
+            httpClient.addHeader("Content-Type", contentType);
+        }
+        if (collectValidators)
+        {
+            httpClient.collectHeaders(validatorHeaders, 2);
+        }
+        if (validators != nullptr)
+        {
+            if (validators->etag[0] != '\0')
+            {
+                httpClient.addHeader("If-None-Match", validators->etag);
+            }
+            if (validators->lastModified[0] != '\0')
+            {
+                httpClient.addHeader("If-Modified-Since", validators->lastModified);
+            }
+        }
+
+        lastResponseCode = (method == "POST") ? httpClient.POST((uint8_t *)payload, length) : httpClient.GET();
+
+        // The server closed the idle connection before we noticed, open a
+        // fresh one once and send again
+        if (reused && attempt == 0 && isStaleConnectionError(lastResponseCode, method == "GET"))
+        {
+            httpClient.end();
+            endpoint.connection().stop();
+            connStats.staleRetries++;
+            Serial.println("Kept-alive connection was closed by the server, reconnecting");
+            continue;
         }
+        break;
+    }
+
+    recordOutcome(endpoint, lastResponseCode, millis() - sentAt, !collectValidators);
+
+    if (reused)
+    {
+        Serial.println("Connection: reused");
     }
     else
     {
-        lastError = "HTTP request failed with code: " + String(lastResponseCode);
-        return false;
+        Serial.printf("Connection: new, connect %lu us\n", connStats.lastConnectUs);
     }
+    return true;
 }
 
-String APIClient::buildURL(const String &endpoint)
-{
-    return baseURL + endpoint;
-}
-
-bool APIClient::performRequest(const String &url, const String &method, const String &payload)
+bool APIClient::performRequest(const String &path, const String &method, const char *payload, size_t length,
+                               const char *contentType)
 {
-    httpClient.setTimeout(requestTimeout);
-
-    if (method == "GET")
+    if (!sendRequest(path, method, payload, length, contentType))
     {
-        return httpClient.begin(url);
+        return false;
     }
-    else if (method == "POST")
+
+    bool complete = readResponseBody();
+#if API_DEBUG_RESPONSES
+    lastResponseBody = responseBuffer;
+#endif
+
+    // Leaves the socket open when the server allows keep-alive
+    httpClient.end();
+    if (!complete)
     {
-        httpClient.begin(url);
-        httpClient.addHeader("Content-Type", "application/x-www-form-urlencoded");
-        return true;
+        // The skipped body may still be arriving on the socket
+        endpoints[requestEndpoint].connection().stop();
     }
-
-    return false;
+    return true;
 }
 
-int APIClient::sendGETRequest(const String &url)
+int APIClient::sendGETRequest(const String &path)
 {
-    if (!performRequest(url, "GET"))
+    if (!performRequest(path, "GET"))
     {
-        lastError = "Failed to initialize HTTP GET request";
         return -1;
     }
 
-    lastResponseCode = httpClient.GET();
-    lastResponseBody = getResponseBody();
-
-    httpClient.end();
-
     Serial.print("GET Response Code: ");
     Serial.println(lastResponseCode);
+#if API_DEBUG_RESPONSES
     Serial.print("Response Body: ");
     Serial.println(lastResponseBody);
+#endif
 
     return lastResponseCode;
 }
 
-int APIClient::sendPOSTRequest(const String &url, const String &payload)
+int APIClient::sendPOSTRequest(const String &path, const RequestBuilder &payload)
 {
-    if (!performRequest(url, "POST"))
+    if (payload.isOverflowed())
+    {
+        lastError = "Request payload too large";
+        return -1;
+    }
+    if (!performRequest(path, "POST", payload.c_str(), payload.length(), RequestBuilder::contentType(BODY_URLENCODED)))
     {
-        lastError = "Failed to initialize HTTP POST request";
         return -1;
     }
-
-    lastResponseCode = httpClient.POST(payload);
-    lastResponseBody = getResponseBody();
-
-    httpClient.end();
 
     Serial.print("POST Response Code: ");
     Serial.println(lastResponseCode);
+#if API_DEBUG_RESPONSES
     Serial.print("Response Body: ");
     Serial.println(lastResponseBody);
+#endif
 
     return lastResponseCode;
 }
 
-String APIClient::getResponseBody()
+bool APIClient::readResponseBody()
 {
-    if (httpClient.getSize() > 0)
+    // Straight from the socket into responseBuffer, chunked bodies included.
+    // Bodies this large belong in fetchResource() with a sink.
+    int size = httpClient.getSize();
+    responseLength = 0;
+    responseBuffer[0] = '\0';
+    if (size > (int)sizeof(responseBuffer) - 1)
+    {
+        lastError = "Response body too large (" + String(size) + " bytes)";
+        return false;
+    }
+    if (size == 0)
+    {
+        return true;
+    }
+
+    BufferSink sink(responseBuffer, sizeof(responseBuffer));
+    int written = httpClient.writeToStream(&sink);
+    responseLength = sink.getLength();
+    if (sink.isOverflowed())
     {
-        return httpClient.getString();
+        // Cut off, parsing it could only fail
+        lastError = "Response body too large";
+        responseLength = 0;
+        responseBuffer[0] = '\0';
+        return false;
     }
-    return "";
+    return written >= 0;
 }
 
-bool APIClient::parseValidationResponse(const String &response, bool &isValid)
+bool APIClient::parseValidationResponse(const char *response, size_t length, bool &isValid)
 {
-    JsonDocument doc;
+    JsonDocument doc(&jsonArena);
 
-    DeserializationError error = deserializeJson(doc, response);
+    DeserializationError error = deserializeJson(doc, response, length, DeserializationOption::Filter(responseFilter));
 
     if (error)
     {
@@ -272,15 +1686,17 @@ bool APIClient::parseValidationResponse(const String &response, bool &isValid)
     return false;
 }
 
-bool APIClient::parseActivityResponse(const String &response, bool &success)
+bool APIClient::parseActivityResponse(const char *response, size_t length, int responseCode, bool &success,
+                                      JsonArena &arena)
 {
-    JsonDocument doc;
+    JsonDocument doc(&arena);
 
-    DeserializationError error = deserializeJson(doc, response);
+    DeserializationError error = deserializeJson(doc, response, length, DeserializationOption::Filter(responseFilter));
 
     if (error)
     {
-        lastError = "JSON parsing failed: " + String(error.c_str());
+        Serial.print("Activity response JSON parsing failed: ");
+        Serial.println(error.c_str());
         return false;
     }
 
@@ -292,24 +1708,97 @@ bool APIClient::parseActivityResponse(const String &response, bool &success)
     }
 
     // If no success field, assume success if we get a 200 response
-    success = (lastResponseCode == 200 || lastResponseCode == 201);
+    success = (responseCode == 200 || responseCode == 201);
     return true;
 }
 
+void APIClient::resetLastResponse()
+{
+    lastResponseCode = 0;
+    answeredFromCache = false;
+}
+
+bool APIClient::isRetryableFailure() const
+{
+    if (answeredFromCache)
+    {
+        return false;
+    }
+    return isRetryableStatus(lastResponseCode);
+}
+
+bool APIClient::isRetryableStatus(int status)
+{
+    // No response at all, a server error or an explicit "try later"
+    return status <= 0 || status >= 500 || status == 408 || status == 429;
+}
+
 bool APIClient::testConnection()
 {
+    APIRequestLock lock(requestMutex);
     if (!isReady())
     {
         lastError = "WiFi not connected";
         return false;
     }
 
-    String url = buildURL("/");
-    int responseCode = sendGETRequest(url);
+    int responseCode = sendGETRequest("/");
 
     return (responseCode > 0); // Any response means server is reachable
 }
 
+bool APIClient::probeServers()
+{
+    APIRequestLock lock(requestMutex);
+    if (!isReady())
+    {
+        return false;
+    }
+
+    bool probed = false;
+    for (uint8_t i = 0; i < endpointCount; i++)
+    {
+        APIEndpoint &endpoint = endpoints[i];
+        bool breakerProbe = endpoint.health.isProbeDue();
+        // Standby servers get no traffic, an occasional GET / keeps their
+        // numbers current for selectEndpoint()
+        bool measure = endpointCount > 1 && i != activeEndpoint && endpoint.health.getState() == BREAKER_CLOSED &&
+                       (endpoint.measuredAt == 0 || millis() - endpoint.measuredAt >= API_ENDPOINT_MEASURE_INTERVAL);
+        if (!breakerProbe && !measure)
+        {
+            continue;
+        }
+
+        // Half-open lets exactly this request through; other blocking requests
+        // wait for the lock and async ones go to servers with a closed circuit
+        resetLastResponse();
+        if (breakerProbe)
+        {
+            endpoint.health.beginProbe();
+            Serial.printf("Circuit open, probing %s\n", endpoint.host.c_str());
+        }
+        probeEndpoint = i;
+        sendGETRequest("/");
+        probeEndpoint = -1;
+        probed = true;
+    }
+    return probed;
+}
+
+bool APIClient::refreshDNS()
+{
+    if (!isReady())
+    {
+        return false;
+    }
+    bool refreshed = false;
+    for (uint8_t i = 0; i < endpointCount; i++)
+    {
+        refreshed = endpoints[i].dns.refreshIfDue() || refreshed;
+    }
+    return refreshed;
+}
+
 String APIClient::getLastError()
 {
     return lastError;
@@ -333,10 +1822,27 @@ String APIClient::getLastResponseBody()
 
 String APIClient::getDeviceMACAddress()
 {
-    String macAddress = WiFi.macAddress();
-    // Remove colons from MAC address
-    macAddress.replace(":", "");
-    return macAddress;
+    return String(getDeviceID());
+}
+
+volatile uint8_t *APIClient::tapWaitCounter()
+{
+    // Only the tap's own requests jump the queue, the uploader's use of the
+    // same public calls does not
+    return xTaskGetCurrentTaskHandle() == tapTask ? &tapRequestsWaiting : nullptr;
+}
+
+const char *APIClient::getDeviceID()
+{
+    // The MAC never changes, so it is formatted once instead of per request
+    if (deviceID[0] == '\0')
+    {
+        uint8_t mac[6];
+        WiFi.macAddress(mac);
+        snprintf(deviceID, sizeof(deviceID), "%02X%02X%02X%02X%02X%02X", mac[0], mac[1], mac[2], mac[3], mac[4],
+                 mac[5]);
+    }
+    return deviceID;
 }
 
 // =============================================
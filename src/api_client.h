@@ -5,7 +5,96 @@
 #include <HTTPClient.h>
 #include <ArduinoJson.h>
 #include <WiFi.h>
+#include <WiFiClientSecure.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 #include "config.h"
+#include "nfc_handler.h"
+#include "activity_journal.h"
+#include "validation_cache.h"
+#include "roster_store.h"
+#include "http_cache.h"
+#include "async_http_client.h"
+#include "request_builder.h"
+#include "json_arena.h"
+#include "server_health.h"
+#include "dns_cache.h"
+
+// Reuse of the kept-alive server connection
+struct APIConnectionStats {
+    uint32_t requests;
+    uint32_t reusedRequests;        // Sent on an already open connection
+    uint32_t connects;              // TCP connects, warm-ups included
+    uint32_t warmUps;               // Connects made from IDLE, not by a request
+    uint32_t staleRetries;          // Reused connection turned out closed
+    unsigned long lastConnectUs;    // Connect time paid by the last request, 0 if reused
+    unsigned long totalConnectUs;   // Connect time paid by all requests
+    unsigned long maxConnectUs;
+    // https only: TCP connect + TLS handshake, warm-ups included
+    uint32_t tlsHandshakes;
+    uint32_t tlsRejected;           // Server certificate did not match the pin
+    unsigned long lastHandshakeUs;
+    unsigned long totalHandshakeUs;
+    unsigned long maxHandshakeUs;
+};
+
+// One server of the configured list with its own connection, address and
+// response time estimate
+struct APIEndpoint {
+    String baseURL;
+    String host;
+    uint16_t port;
+    String path;                    // Path prefix of baseURL, "" for none
+    bool persistent;                // http:// and https:// base URLs
+    bool secure;                    // https://, requests go over secureClient
+    WiFiClient wifiClient;          // Kept open between requests
+    WiFiClientSecure secureClient;  // Same for https:// base URLs
+    DNSCache dns;                   // Connections skip the DNS query
+    ServerHealth health;            // Drives request timeouts and the circuit breaker
+    unsigned long measuredAt;       // Last answer or failure, 0 for never
+    uint32_t requests;
+
+    WiFiClient& connection() { return secure ? static_cast<WiFiClient&>(secureClient) : wifiClient; }
+};
+
+// Choice between the servers of the list
+struct FailoverStats {
+    uint32_t switches;              // Another server became the active one
+    uint32_t failovers;             // Blocking request sent again to the next server
+    uint32_t hedges;                // Async request also sent to a standby server
+    uint32_t hedgeWins;             // ... which answered first
+};
+
+// Speculative UID lookups (state machine task only)
+struct PrefetchStats {
+    uint32_t started;
+    uint32_t used;                  // Verdict taken, no validation request needed
+    uint32_t mismatched;            // Server has another induk for the UID
+    uint32_t failed;                // No usable answer or card unknown
+};
+
+// Outcome of a combined validate-and-log request
+enum TapResult {
+    TAP_LOGGED,             // Card valid and activity logged
+    TAP_INVALID,            // Card rejected, nothing logged
+    TAP_LOG_FAILED,         // Card valid but the server could not log it
+    TAP_REQUEST_FAILED,     // No usable answer from the server
+    TAP_UNSUPPORTED         // Server has no combined endpoint, use two requests
+};
+
+// Per-record outcome of a batched activity upload
+enum BatchRecordResult : uint8_t {
+    BATCH_RETRY,            // Not confirmed, send again later
+    BATCH_ACCEPTED,
+    BATCH_REJECTED          // Refused by the server, do not send again
+};
+
+// Outcome of a conditional GET into a sink
+enum FetchResult {
+    FETCH_UPDATED,          // New body written to the sink
+    FETCH_NOT_MODIFIED,     // 304, the copy on the device is current
+    FETCH_FAILED            // Nothing usable, the sink may hold a partial body
+};
 
 // =============================================
 // API CLIENT CLASS
@@ -14,51 +103,259 @@
 class APIClient {
 private:
     HTTPClient httpClient;
-    String baseURL;
+    String baseURL;                 // Comma-separated list, in order of preference
     String apiVersion;
     unsigned long requestTimeout;
 
-    // Helper methods
-    String buildURL(const String& endpoint);
-    bool performRequest(const String& url, const String& method, const String& payload = "");
-    String getResponseBody();
+    // Servers of baseURL; the active one gets every request unless it fails
+    APIEndpoint endpoints[API_MAX_ENDPOINTS];
+    uint8_t endpointCount;
+    volatile uint8_t activeEndpoint;
+    int8_t probeEndpoint;           // Forced target of a probe, -1 for none (under requestMutex)
+    uint8_t requestEndpoint;        // Server of the last blocking request (under requestMutex)
+    uint8_t asyncEndpoint;          // Server of the async request being built
+    bool asyncCapable;              // Only http:// servers, AsyncTCP has no TLS
+    FailoverStats failoverStats;
+
+    bool wifiWasConnected;
+    unsigned long lastWarmUpCheck;
+    APIConnectionStats connStats;
+
+    // Optional server endpoints: -1 unknown, 0 no, 1 yes
+    int8_t combinedTapSupport;
+    int8_t batchLogSupport;
+    int8_t uidLookupSupport;
+    unsigned long capabilitiesCheckedAt;    // 0 until the first answer
+    unsigned long capabilitiesFailedAt;     // Last check without a usable answer, 0 if none
+
+    // Serialises requests from the state machine and the journal uploader
+    SemaphoreHandle_t requestMutex;
+    TaskHandle_t tapTask;                   // State machine task, see setAsyncNotifyTask()
+    volatile uint8_t tapRequestsWaiting;    // Tap requests blocked on requestMutex
+
+    ValidationCache validationCache;
+    bool answeredFromCache;         // Last call needed no request at all
+    PrefetchStats prefetchStats;
+
+    HTTPCache httpCache;
+    AsyncHTTPClient asyncHttp;
+
+    // Async GET that may also go to a standby server (state machine task).
+    // Whichever answers first is delivered under primaryId.
+    struct HedgedRequest {
+        uint16_t primaryId;         // 0 when nothing is hedged
+        uint16_t hedgeId;           // 0 until the copy went out
+        uint8_t endpoint;           // Standby the copy goes to
+        unsigned long startedAt;
+        unsigned long delayMs;      // p95 of the primary, 0 = only once the primary fails
+        bool oneFailed;
+    } hedge;
+    RequestBuffer<REQUEST_BUILDER_SIZE> hedgeRequest;
+    // Where the endpoint-independent parts of asyncRequest start and end
+    size_t asyncTargetStart;
+    size_t asyncTargetEnd;
+    size_t asyncHeadersStart;
+
+    // Reused for every request instead of String concatenation. bodyBuilder
+    // belongs to the blocking path (under requestMutex), the async ones to
+    // the state machine task.
+    RequestBuffer<REQUEST_BUILDER_SIZE> bodyBuilder;
+    RequestBuffer<REQUEST_BUILDER_SIZE> asyncRequest;
+    RequestBuffer<REQUEST_BUILDER_SIZE> asyncBody;
+    uint32_t lastRequestAllocations;    // Heap allocations of the last async request build
+    // CSV body of a batch upload (serverSyncTask, under requestMutex)
+    RequestBuffer<API_BATCH_BUILDER_SIZE> batchBody;
+    uint32_t lastBatchAllocations;      // Heap allocations of the last batch upload build
+    char deviceID[13];                  // MAC without colons, read once in begin()
+
+    // Body of the last blocking response, parsed in place (under requestMutex)
+    char responseBuffer[API_RESPONSE_BUFFER_SIZE];
+    size_t responseLength;
+    // Keeps only the fields the parsers read, built once
+    JsonDocument responseFilter;
+    JsonArena jsonArena;            // Blocking path
+    JsonArena asyncJsonArena;       // finish*() on the state machine task
+
+    // Helper methods; paths are relative to the base URL of the server used
+    bool performRequest(const String& path, const String& method, const char* payload = nullptr, size_t length = 0,
+                        const char* contentType = nullptr);
+    bool sendRequest(const String& path, const String& method, const char* payload, size_t length, const char* contentType,
+                     bool collectValidators = false, const HTTPValidators* validators = nullptr);
+    bool sendRequestTo(APIEndpoint& endpoint, const String& path, const String& method, const char* payload,
+                       size_t length, const char* contentType, bool collectValidators, const HTTPValidators* validators);
+    bool readResponseBody();
+    void parseServerURLs();
+    void parseServerURL(APIEndpoint& endpoint, const String& url);
+    bool beginRequest(APIEndpoint& endpoint, const String& path, bool& reused, unsigned long timeoutMs);
+    bool openConnection(APIEndpoint& endpoint, unsigned long& connectUs);
+    void closeConnection();
+    void configureTLS();
+    bool verifyServerCertificate(APIEndpoint& endpoint);
+    // Active server, switched first when another is clearly better
+    uint8_t selectEndpoint();
+    // Next server in list order whose circuit is not open, from itself if none
+    uint8_t nextEndpoint(uint8_t from);
+    // timed: rttMs is a response time worth feeding into the estimate
+    void recordOutcome(APIEndpoint& endpoint, int status, unsigned long rttMs, bool timed);
+    static bool isStaleConnectionError(int code, bool idempotent);
+    void resetLastResponse();
 
     // Request/Response handling
-    int sendGETRequest(const String& url);
-    int sendPOSTRequest(const String& url, const String& payload);
+    int sendGETRequest(const String& path);
+    int sendPOSTRequest(const String& path, const RequestBuilder& payload);
+
+    // Request building, shared by the blocking and non-blocking paths; each
+    // appends to the given builder
+    void buildValidationQuery(RequestBuilder& out, const String& cardUID, const String& santriID);
+    void buildActivityPayload(RequestBuilder& out, const String& memberID, int institution, uint32_t tappedAt);
+    void buildCombinedTapPayload(RequestBuilder& out, const CardSession& session, const String& santriID, int institution);
+    void buildBatchPayload(RequestBuilder& out, const JournalRecord* records, uint8_t count);
+    // Request line and path of an async request, then the headers and body
+    void beginAsyncRequest(const char* method, const char* endpoint);
+    // hedged: a GET that may also be sent to a standby server
+    uint16_t sendAsyncRequest(const char* contentType, const RequestBuilder* body, uint32_t allocationsBefore,
+                              bool hedged = false);
+    void buildHedgeRequest(const APIEndpoint& target);
+    void sendHedge();
+    // False when the event belongs to a hedged request and is not the answer
+    bool resolveHedge(AsyncHTTPEvent& event);
 
     // Response parsing
-    bool parseValidationResponse(const String& response, bool& isValid);
-    bool parseActivityResponse(const String& response, bool& success);
+    bool parseValidationResponse(const char* response, size_t length, bool& isValid);
+    bool parseValidationVerdict(const char* response, bool& isValid);
+    bool parseActivityResponse(const char* response, size_t length, int responseCode, bool& success, JsonArena& arena);
+    TapResult parseCombinedTapResponse(int responseCode, const char* response, size_t length, const CardSession& session,
+                                       const String& santriID, JsonArena& arena);
+    bool isKnownInvalid(const CardSession& session, const String& santriID);
+    bool parseBatchResponse(const char* response, size_t length, const JournalRecord* records, uint8_t count,
+                            uint8_t* results);
+    bool needsCapabilities() const;
 
 public:
     APIClient();
 
-    // Initialization
+    // Initialization; serverURL may list several servers separated by commas,
+    // in order of preference
     void begin(const char* serverURL = nullptr);
     bool isReady();
     void setServerURL(const char* serverURL);
 
     // Card validation with new endpoint format
     bool validateSantriCard(const String& cardUID, const String& santriID);
+    bool validateSantriCard(const CardSession& session, const String& santriID);
+
+    // Activity logging, tappedAt (Unix time) 0 lets the server use its own clock
+    bool logSantriActivity(const String& memberID, int institution, uint32_t tappedAt = 0);
+
+    // Many logs in one request; results gets a BatchRecordResult per record.
+    // False when nothing was confirmed (all results BATCH_RETRY).
+    bool isBatchLogEnabled() const;
+    bool logSantriActivityBatch(const JournalRecord* records, uint8_t count, uint8_t* results);
+
+    // Validation and logging in a single round trip
+    bool isCombinedTapEnabled() const;
+    TapResult validateAndLogSantri(const CardSession& session, const String& santriID, int institution);
+    bool discoverCapabilities();
+
+    // Non-blocking requests (plain http:// servers): start*() returns the
+    // request id, 0 when no slot was free; the AsyncHTTPEvent with that id
+    // comes from pollAsync() and goes to the matching finish*(). Meant for
+    // the state machine task only.
+    bool isAsyncAvailable();
+    // Also the task whose blocking requests go before the journal uploader's
+    void setAsyncNotifyTask(TaskHandle_t task)
+    {
+        tapTask = task;
+        asyncHttp.setNotifyTask(task);
+    }
+    bool pollAsync(AsyncHTTPEvent& event);
+    ValidationCache::Lookup lookupValidationCache(const String& cardUID, const String& santriID);
+    uint16_t startValidation(const CardSession& session, const String& santriID);
+    // False when the event holds no verdict
+    bool finishValidation(const AsyncHTTPEvent& event, const CardSession& session, const String& santriID, bool& valid);
+    uint16_t startCombinedTap(const CardSession& session, const String& santriID, int institution);
+    TapResult finishCombinedTap(const AsyncHTTPEvent& event, const CardSession& session, const String& santriID);
+    uint16_t startActivityLog(const String& memberID, int institution);
+    bool finishActivityLog(const AsyncHTTPEvent& event);
+
+    // Speculative lookup by UID (see API_PREFETCH_MODE). finishPrefetch()
+    // reconciles the answer with the induk read from the card: a matching
+    // record stores its verdict in the validation cache and returns it,
+    // anything else is CACHE_MISS and the tap is validated as usual.
+    bool isPrefetchEnabled() const;
+    uint16_t startPrefetch(const CardSession& session);
+    ValidationCache::Lookup finishPrefetch(const AsyncHTTPEvent& event, const CardSession& session,
+                                           const String& santriID);
+    const PrefetchStats& getPrefetchStats() const { return prefetchStats; }
+    const AsyncHTTPStats& getAsyncStats() const { return asyncHttp.getStats(); }
+    uint32_t getLastRequestAllocations() const { return lastRequestAllocations; }
+    uint32_t getLastBatchAllocations() const { return lastBatchAllocations; }
+    const JsonArenaStats& getJsonArenaStats() const { return jsonArena.getStats(); }
+    const JsonArenaStats& getAsyncJsonArenaStats() const { return asyncJsonArena.getStats(); }
+
+    // Streams the roster into the inactive roster half, true when the
+    // stored roster is current afterwards
+    bool downloadRoster();
+
+    // GET endpoint + query with the body streamed into sink. haveCopy sends
+    // the stored ETag/Last-Modified so an unchanged resource answers 304;
+    // pass false when the local copy is missing.
+    FetchResult fetchResource(const char* endpoint, const String& query, Stream& sink, bool haveCopy);
+    void forgetCachedResource(const char* endpoint);
+
+    // Connection keep-alive; maintainConnection blocks while connecting, so
+    // call it from serverSyncTask, the state machine only closes idle slots
+    void closeIdleAsyncConnections();
+    void maintainConnection();
+    bool warmUpConnection();
+    const APIConnectionStats& getConnectionStats() const { return connStats; }
+    const ValidationCache& getValidationCache() const { return validationCache; }
+    const HTTPCacheStats& getHTTPCacheStats() const { return httpCache.getStats(); }
+    uint8_t getReuseRatePercent() const;
+    bool isSecure() const { return endpoints[activeEndpoint].secure; }
+
+    // Circuit breakers: once every server's is open, requests fail at once
+    // as retryable. probeServers() sends the probes that are due and
+    // measures idle standby servers (sync task, while idle).
+    bool isCircuitOpen() const;
+    bool probeServers();
+    // Timeout the next request would get
+    unsigned long getRequestTimeout() { return endpoints[activeEndpoint].health.getTimeout(requestTimeout); }
+    // A tap is blocked on a request the uploader holds, the uploader should
+    // not start another one
+    bool isTapWaiting() const { return tapRequestsWaiting > 0; }
+
+    // Resolves the server hosts again when a cached address expired or
+    // failed. Blocking, called from the sync task so the tap path never
+    // waits on DNS.
+    bool refreshDNS();
+
+    uint8_t getEndpointCount() const { return endpointCount; }
+    uint8_t getActiveEndpoint() const { return activeEndpoint; }
+    const APIEndpoint& getEndpoint(uint8_t index) const { return endpoints[index]; }
+    const FailoverStats& getFailoverStats() const { return failoverStats; }
 
-    // Activity logging
-    bool logSantriActivity(const String& memberID, int institution);
+    // False when the server answered and refused, sending again will not help
+    bool isRetryableFailure() const;
+    static bool isRetryableStatus(int status);
 
     // Utility methods
     bool testConnection();
     String getLastError();
     void setTimeout(unsigned long timeoutMs);
 
-    // Response data access (for debugging)
+    // Response data access (for debugging), the body only with API_DEBUG_RESPONSES
     int getLastResponseCode();
     String getLastResponseBody();
 
     // Utility methods for device info
     String getDeviceMACAddress();
+    const char* getDeviceID();
 
 private:
     String lastError;
+    // &tapRequestsWaiting when called from the tap task, else nullptr
+    volatile uint8_t* tapWaitCounter();
     int lastResponseCode;
     String lastResponseBody;
 };
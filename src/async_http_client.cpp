@@ -0,0 +1,628 @@
+#include "async_http_client.h"
+#include <HTTPClient.h>
+
+// =============================================
+// CLASS IMPLEMENTATION
+// =============================================
+
+AsyncHTTPClient::AsyncHTTPClient() : notifyTask(NULL), nextRequestId(1)
+{
+    memset(&stats, 0, sizeof(stats));
+    for (uint8_t i = 0; i < ASYNC_HTTP_MAX_REQUESTS; i++)
+    {
+        Slot &slot = slots[i];
+        slot.client = nullptr;
+        slot.host[0] = '\0';
+        slot.port = 0;
+        slot.requestId = 0;
+        slot.connected = false;
+        slot.disconnected = false;
+        slot.dropConnection = false;
+        slot.reused = false;
+        slot.retryPending = false;
+        slot.idempotent = false;
+        slot.tag = 0;
+        slot.startedAt = 0;
+        slot.timeoutMs = 0;
+        slot.idleSince = 0;
+        slot.hasAddress = false;
+        slot.requestLength = 0;
+        resetParser(slot);
+    }
+
+    lock = xSemaphoreCreateMutex();
+    events = xQueueCreate(ASYNC_HTTP_QUEUE_LENGTH, sizeof(AsyncHTTPEvent));
+}
+
+void AsyncHTTPClient::resetParser(Slot &slot)
+{
+    slot.state = PARSE_STATUS_LINE;
+    slot.status = 0;
+    slot.contentLength = -1;
+    slot.chunkRemaining = 0;
+    slot.chunked = false;
+    slot.keepAlive = false;
+    slot.lineLength = 0;
+    slot.bodyLength = 0;
+    slot.body[0] = '\0';
+    slot.truncated = false;
+}
+
+void AsyncHTTPClient::attach(Slot &slot, AsyncClient *client)
+{
+    Slot *target = &slot;
+    client->onConnect([this, target](void *, AsyncClient *c) { onConnect(*target, c); });
+    client->onData([this, target](void *, AsyncClient *c, void *data, size_t length)
+                   { onData(*target, c, (const char *)data, length); });
+    client->onDisconnect([this, target](void *, AsyncClient *c) { onDisconnect(*target, c); });
+}
+
+AsyncHTTPClient::Slot *AsyncHTTPClient::findSlot(const char *host, uint16_t port, bool &reuse)
+{
+    // An open connection to the same server first, it saves the handshake
+    for (uint8_t i = 0; i < ASYNC_HTTP_MAX_REQUESTS; i++)
+    {
+        Slot &slot = slots[i];
+        if (slot.requestId == 0 && slot.client != nullptr && slot.connected && !slot.disconnected &&
+            !slot.dropConnection && slot.port == port && strcmp(slot.host, host) == 0)
+        {
+            reuse = true;
+            return &slot;
+        }
+    }
+
+    reuse = false;
+    for (uint8_t i = 0; i < ASYNC_HTTP_MAX_REQUESTS; i++)
+    {
+        if (slots[i].requestId == 0 && slots[i].client == nullptr)
+        {
+            return &slots[i];
+        }
+    }
+
+    // Idle connections to another server give way for the next request
+    for (uint8_t i = 0; i < ASYNC_HTTP_MAX_REQUESTS; i++)
+    {
+        if (slots[i].requestId == 0)
+        {
+            slots[i].dropConnection = true;
+        }
+    }
+    return nullptr;
+}
+
+uint16_t AsyncHTTPClient::send(const char *host, const IPAddress *address, uint16_t port, const char *request,
+                               size_t length, unsigned long timeoutMs, uint8_t tag)
+{
+    if (length > sizeof(slots[0].request) || strlen(host) >= ASYNC_HTTP_HOST_LENGTH)
+    {
+        stats.rejected++;
+        return 0;
+    }
+
+    // Frees slots whose connections are finished before picking one
+    reap();
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+
+    bool reuse = false;
+    Slot *slot = findSlot(host, port, reuse);
+    if (slot == nullptr)
+    {
+        stats.rejected++;
+        xSemaphoreGive(lock);
+        return 0;
+    }
+
+    uint16_t requestId = nextRequestId++;
+    if (nextRequestId == 0)
+    {
+        nextRequestId = 1;
+    }
+
+    slot->requestId = requestId;
+    slot->reused = reuse;
+    slot->retryPending = false;
+    slot->tag = tag;
+    slot->startedAt = millis();
+    slot->timeoutMs = timeoutMs;
+    slot->hasAddress = address != nullptr;
+    if (address != nullptr)
+    {
+        slot->address = *address;
+    }
+    memcpy(slot->request, request, length);
+    slot->requestLength = length;
+    slot->idempotent = length >= 4 && memcmp(request, "GET ", 4) == 0;
+    resetParser(*slot);
+
+    stats.started++;
+    uint8_t inFlight = 0;
+    for (uint8_t i = 0; i < ASYNC_HTTP_MAX_REQUESTS; i++)
+    {
+        inFlight += slots[i].requestId != 0 ? 1 : 0;
+    }
+    if (inFlight > stats.maxInFlight)
+    {
+        stats.maxInFlight = inFlight;
+    }
+
+    AsyncClient *client = nullptr;
+    if (reuse)
+    {
+        // Written under the lock so the slot cannot be reaped meanwhile
+        stats.reusedConnections++;
+        if (slot->client->write(request, length) != length && !scheduleRetry(*slot, true))
+        {
+            finish(*slot, HTTPC_ERROR_SEND_HEADER_FAILED);
+        }
+    }
+    else
+    {
+        client = new AsyncClient();
+        slot->client = client;
+        strcpy(slot->host, host);
+        slot->port = port;
+        slot->connected = false;
+        slot->disconnected = false;
+        slot->dropConnection = false;
+        attach(*slot, client);
+    }
+    xSemaphoreGive(lock);
+
+    if (client != nullptr)
+    {
+        connectSlot(*slot, client, requestId);
+    }
+    startRetries();
+    return requestId;
+}
+
+bool AsyncHTTPClient::connectSlot(Slot &slot, AsyncClient *client, uint16_t requestId)
+{
+    // DNS (without an address) and the handshake continue on the AsyncTCP task
+    bool connecting = slot.hasAddress ? client->connect(slot.address, slot.port) : client->connect(slot.host, slot.port);
+    if (!connecting)
+    {
+        xSemaphoreTake(lock, portMAX_DELAY);
+        if (slot.client == client && slot.requestId == requestId)
+        {
+            slot.disconnected = true;
+            finish(slot, HTTPC_ERROR_CONNECTION_REFUSED);
+        }
+        xSemaphoreGive(lock);
+    }
+    return connecting;
+}
+
+bool AsyncHTTPClient::scheduleRetry(Slot &slot, bool writeFailed)
+{
+    // Lock held by the caller. Only a reused connection that failed before
+    // the first response byte: the server closed it while it sat idle.
+    // Once per request, the retry is not reused.
+    if (!slot.reused || slot.state != PARSE_STATUS_LINE || slot.lineLength > 0 || slot.requestLength == 0)
+    {
+        return false;
+    }
+    // A disconnect after a successful write leaves open whether the server
+    // processed the request, sending a POST again could log a tap twice
+    if (!writeFailed && !slot.idempotent)
+    {
+        return false;
+    }
+
+    slot.retryPending = true;
+    slot.dropConnection = true;
+    stats.staleRetries++;
+    if (notifyTask != NULL)
+    {
+        xTaskNotifyGive(notifyTask);
+    }
+    return true;
+}
+
+void AsyncHTTPClient::startRetries()
+{
+    AsyncClient *stale[ASYNC_HTTP_MAX_REQUESTS];
+    Slot *retry[ASYNC_HTTP_MAX_REQUESTS];
+    AsyncClient *fresh[ASYNC_HTTP_MAX_REQUESTS];
+    uint16_t requestIds[ASYNC_HTTP_MAX_REQUESTS];
+    uint8_t count = 0;
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    for (uint8_t i = 0; i < ASYNC_HTTP_MAX_REQUESTS; i++)
+    {
+        Slot &slot = slots[i];
+        if (!slot.retryPending || slot.requestId == 0)
+        {
+            continue;
+        }
+
+        // Swap in a new client first, so the old one's callbacks no
+        // longer match the slot when it is closed below
+        stale[count] = slot.client;
+        fresh[count] = new AsyncClient();
+        retry[count] = &slot;
+        requestIds[count] = slot.requestId;
+        count++;
+
+        slot.client = fresh[count - 1];
+        slot.retryPending = false;
+        slot.reused = false;
+        slot.connected = false;
+        slot.disconnected = false;
+        slot.dropConnection = false;
+        resetParser(slot);
+        attach(slot, slot.client);
+    }
+    xSemaphoreGive(lock);
+
+    for (uint8_t i = 0; i < count; i++)
+    {
+        if (stale[i] != nullptr)
+        {
+            stale[i]->close(true);
+            delete stale[i];
+        }
+        connectSlot(*retry[i], fresh[i], requestIds[i]);
+    }
+}
+
+void AsyncHTTPClient::finish(Slot &slot, int status)
+{
+    // Lock held by the caller
+    AsyncHTTPEvent event;
+    event.requestId = slot.requestId;
+    event.status = (int16_t)status;
+    event.bodyLength = slot.bodyLength;
+    event.truncated = slot.truncated;
+    event.reused = slot.reused;
+    event.tag = slot.tag;
+    event.elapsedMs = millis() - slot.startedAt;
+    memcpy(event.body, slot.body, slot.bodyLength);
+    event.body[slot.bodyLength] = '\0';
+
+    if (status > 0)
+    {
+        stats.completed++;
+    }
+    else if (status == HTTPC_ERROR_READ_TIMEOUT)
+    {
+        stats.timeouts++;
+    }
+    else
+    {
+        stats.failed++;
+    }
+
+    // Only a cleanly finished response leaves the connection usable
+    if (status <= 0 || slot.state != PARSE_DONE || !slot.keepAlive)
+    {
+        slot.dropConnection = true;
+    }
+    slot.requestId = 0;
+    slot.retryPending = false;
+    slot.idleSince = millis();
+    slot.requestLength = 0;
+
+    if (xQueueSend(events, &event, 0) != pdTRUE)
+    {
+        Serial.println("Async HTTP event queue full - response dropped");
+    }
+    if (notifyTask != NULL)
+    {
+        xTaskNotifyGive(notifyTask);
+    }
+}
+
+void AsyncHTTPClient::reap()
+{
+    AsyncClient *finished[ASYNC_HTTP_MAX_REQUESTS];
+    uint8_t count = 0;
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    for (uint8_t i = 0; i < ASYNC_HTTP_MAX_REQUESTS; i++)
+    {
+        Slot &slot = slots[i];
+        if (slot.client != nullptr && slot.requestId == 0 && (slot.disconnected || slot.dropConnection))
+        {
+            finished[count++] = slot.client;
+            slot.client = nullptr;
+            slot.connected = false;
+            slot.disconnected = false;
+            slot.dropConnection = false;
+        }
+    }
+    xSemaphoreGive(lock);
+
+    // close() runs onDisconnect right here, which must be able to lock.
+    // A client that is already gone just has nothing left to close.
+    for (uint8_t i = 0; i < count; i++)
+    {
+        finished[i]->close(true);
+        delete finished[i];
+    }
+}
+
+bool AsyncHTTPClient::poll(AsyncHTTPEvent &event)
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+    unsigned long now = millis();
+    for (uint8_t i = 0; i < ASYNC_HTTP_MAX_REQUESTS; i++)
+    {
+        if (slots[i].requestId != 0 && now - slots[i].startedAt >= slots[i].timeoutMs)
+        {
+            finish(slots[i], HTTPC_ERROR_READ_TIMEOUT);
+        }
+    }
+    xSemaphoreGive(lock);
+
+    startRetries();
+    reap();
+    return xQueueReceive(events, &event, 0) == pdTRUE;
+}
+
+void AsyncHTTPClient::closeIdleConnections()
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+    for (uint8_t i = 0; i < ASYNC_HTTP_MAX_REQUESTS; i++)
+    {
+        Slot &slot = slots[i];
+        if (slot.client != nullptr && slot.requestId == 0 && millis() - slot.idleSince >= ASYNC_HTTP_IDLE_TIMEOUT)
+        {
+            slot.dropConnection = true;
+        }
+    }
+    xSemaphoreGive(lock);
+
+    reap();
+}
+
+uint8_t AsyncHTTPClient::getInFlight()
+{
+    uint8_t inFlight = 0;
+    xSemaphoreTake(lock, portMAX_DELAY);
+    for (uint8_t i = 0; i < ASYNC_HTTP_MAX_REQUESTS; i++)
+    {
+        inFlight += slots[i].requestId != 0 ? 1 : 0;
+    }
+    xSemaphoreGive(lock);
+    return inFlight;
+}
+
+// =============================================
+// ASYNCTCP CALLBACKS
+// =============================================
+
+void AsyncHTTPClient::onConnect(Slot &slot, AsyncClient *client)
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+    if (slot.client == client && slot.requestId != 0)
+    {
+        slot.connected = true;
+        client->setNoDelay(true);
+        if (client->write(slot.request, slot.requestLength) != slot.requestLength)
+        {
+            finish(slot, HTTPC_ERROR_SEND_HEADER_FAILED);
+        }
+    }
+    xSemaphoreGive(lock);
+}
+
+void AsyncHTTPClient::onData(Slot &slot, AsyncClient *client, const char *data, size_t length)
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+    if (slot.client == client)
+    {
+        if (slot.requestId == 0)
+        {
+            // Nothing was asked on this connection, do not trust it again
+            slot.dropConnection = true;
+        }
+        else if (consume(slot, data, length))
+        {
+            finish(slot, slot.status);
+        }
+    }
+    xSemaphoreGive(lock);
+}
+
+void AsyncHTTPClient::onDisconnect(Slot &slot, AsyncClient *client)
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+    if (slot.client == client)
+    {
+        bool wasConnected = slot.connected;
+        slot.connected = false;
+        slot.disconnected = true;
+
+        if (slot.requestId != 0)
+        {
+            if (slot.state == PARSE_BODY && slot.contentLength < 0)
+            {
+                // No length given, the body ends with the connection
+                slot.state = PARSE_DONE;
+                finish(slot, slot.status);
+            }
+            else if (!scheduleRetry(slot, false))
+            {
+                finish(slot, wasConnected ? HTTPC_ERROR_CONNECTION_LOST : HTTPC_ERROR_CONNECTION_REFUSED);
+            }
+        }
+    }
+    xSemaphoreGive(lock);
+}
+
+// =============================================
+// RESPONSE PARSER
+// =============================================
+
+bool AsyncHTTPClient::takeLine(Slot &slot, char c)
+{
+    if (c == '\n')
+    {
+        if (slot.lineLength > 0 && slot.line[slot.lineLength - 1] == '\r')
+        {
+            slot.lineLength--;
+        }
+        slot.line[slot.lineLength] = '\0';
+        return true;
+    }
+
+    if (slot.lineLength < ASYNC_HTTP_LINE_LENGTH - 1)
+    {
+        slot.line[slot.lineLength++] = c;
+    }
+    return false;
+}
+
+void AsyncHTTPClient::handleStatusLine(Slot &slot)
+{
+    // "HTTP/1.1 200 OK", HTTP/1.0 closes unless it says otherwise
+    if (strncmp(slot.line, "HTTP/1.", 7) != 0 || slot.lineLength < 12)
+    {
+        slot.status = HTTPC_ERROR_CONNECTION_LOST;
+        slot.state = PARSE_DONE;
+        return;
+    }
+    slot.keepAlive = slot.line[7] == '1';
+    slot.status = atoi(slot.line + 9);
+    slot.state = PARSE_HEADERS;
+}
+
+void AsyncHTTPClient::handleHeaderLine(Slot &slot)
+{
+    const char *colon = strchr(slot.line, ':');
+    if (colon == nullptr)
+    {
+        return;
+    }
+
+    const char *value = colon + 1;
+    while (*value == ' ')
+    {
+        value++;
+    }
+
+    size_t nameLength = colon - slot.line;
+    if (nameLength == 14 && strncasecmp(slot.line, "Content-Length", 14) == 0)
+    {
+        slot.contentLength = atol(value);
+    }
+    else if (nameLength == 17 && strncasecmp(slot.line, "Transfer-Encoding", 17) == 0)
+    {
+        slot.chunked = strstr(value, "chunked") != nullptr;
+    }
+    else if (nameLength == 10 && strncasecmp(slot.line, "Connection", 10) == 0)
+    {
+        if (strncasecmp(value, "close", 5) == 0)
+        {
+            slot.keepAlive = false;
+        }
+        else if (strncasecmp(value, "keep-alive", 10) == 0)
+        {
+            slot.keepAlive = true;
+        }
+    }
+}
+
+void AsyncHTTPClient::appendBody(Slot &slot, const char *data, size_t length)
+{
+    size_t room = ASYNC_HTTP_MAX_BODY - 1 - slot.bodyLength;
+    size_t taken = length < room ? length : room;
+    memcpy(slot.body + slot.bodyLength, data, taken);
+    slot.bodyLength += taken;
+    if (taken < length)
+    {
+        slot.truncated = true;
+    }
+}
+
+bool AsyncHTTPClient::consume(Slot &slot, const char *data, size_t length)
+{
+    size_t index = 0;
+    while (index < length && slot.state != PARSE_DONE)
+    {
+        if (slot.state == PARSE_BODY || slot.state == PARSE_CHUNK_DATA)
+        {
+            long remaining = slot.state == PARSE_BODY ? slot.contentLength : slot.chunkRemaining;
+            size_t available = length - index;
+            size_t taken = (remaining < 0 || (size_t)remaining > available) ? available : (size_t)remaining;
+            appendBody(slot, data + index, taken);
+            index += taken;
+
+            if (slot.state == PARSE_BODY && slot.contentLength >= 0)
+            {
+                slot.contentLength -= taken;
+                if (slot.contentLength == 0)
+                {
+                    slot.state = PARSE_DONE;
+                }
+            }
+            else if (slot.state == PARSE_CHUNK_DATA)
+            {
+                slot.chunkRemaining -= taken;
+                if (slot.chunkRemaining == 0)
+                {
+                    slot.state = PARSE_CHUNK_END;
+                }
+            }
+            continue;
+        }
+
+        if (!takeLine(slot, data[index++]))
+        {
+            continue;
+        }
+
+        switch (slot.state)
+        {
+        case PARSE_STATUS_LINE:
+            handleStatusLine(slot);
+            break;
+
+        case PARSE_HEADERS:
+            if (slot.lineLength > 0)
+            {
+                handleHeaderLine(slot);
+            }
+            else if (slot.status == 204 || slot.status == 304 || (!slot.chunked && slot.contentLength == 0))
+            {
+                slot.state = PARSE_DONE;
+            }
+            else
+            {
+                slot.state = slot.chunked ? PARSE_CHUNK_SIZE : PARSE_BODY;
+            }
+            break;
+
+        case PARSE_CHUNK_SIZE:
+            slot.chunkRemaining = strtol(slot.line, nullptr, 16);
+            slot.state = slot.chunkRemaining > 0 ? PARSE_CHUNK_DATA : PARSE_CHUNK_TRAILER;
+            break;
+
+        case PARSE_CHUNK_END:
+            slot.state = PARSE_CHUNK_SIZE;
+            break;
+
+        case PARSE_CHUNK_TRAILER:
+            // Trailer fields are ignored, an empty line ends the response
+            if (slot.lineLength == 0)
+            {
+                slot.state = PARSE_DONE;
+            }
+            break;
+
+        default:
+            break;
+        }
+        slot.lineLength = 0;
+    }
+
+    // Bytes past the end of the response: the connection is out of step
+    if (slot.state == PARSE_DONE && index < length)
+    {
+        slot.keepAlive = false;
+    }
+    return slot.state == PARSE_DONE;
+}
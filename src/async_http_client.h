@@ -0,0 +1,157 @@
+#ifndef ASYNC_HTTP_CLIENT_H
+#define ASYNC_HTTP_CLIENT_H
+
+#include <Arduino.h>
+#include <AsyncTCP.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include "config.h"
+
+#define ASYNC_HTTP_QUEUE_LENGTH (ASYNC_HTTP_MAX_REQUESTS * 2)
+#define ASYNC_HTTP_LINE_LENGTH  128     // Longer status/header lines are cut, only the start matters
+#define ASYNC_HTTP_HOST_LENGTH  64
+
+// Completion of one request, delivered through poll(). Bodies longer than
+// ASYNC_HTTP_MAX_BODY are cut and flagged, the status is still exact.
+struct AsyncHTTPEvent {
+    uint16_t requestId;
+    int16_t status;                     // HTTP status, or a negative HTTPC_ERROR_* code
+    uint16_t bodyLength;
+    bool truncated;
+    bool reused;                        // Sent on a kept-alive connection
+    uint8_t tag;                        // As passed to send()
+    unsigned long elapsedMs;
+    char body[ASYNC_HTTP_MAX_BODY];     // Always NUL-terminated
+};
+
+struct AsyncHTTPStats {
+    uint32_t started;
+    uint32_t completed;                 // Any HTTP status
+    uint32_t failed;                    // Connect or transfer errors
+    uint32_t timeouts;
+    uint32_t reusedConnections;
+    uint32_t staleRetries;              // Resent on a new connection, the kept-alive one was closed
+    uint32_t rejected;                  // No free slot
+    uint8_t maxInFlight;
+};
+
+// =============================================
+// ASYNC HTTP CLIENT CLASS
+// =============================================
+
+// Event-driven HTTP/1.1 client on AsyncTCP. Up to ASYNC_HTTP_MAX_REQUESTS
+// requests run at once, each on its own connection that is kept open for
+// the next request when the server allows it. send() returns immediately;
+// the response is parsed on the AsyncTCP task and handed back as an
+// AsyncHTTPEvent, and the notify task is woken so it can poll() at once.
+//
+// A kept-alive connection the server has already closed fails before any
+// response byte arrives; such a request is sent once more on a new
+// connection. Every started request produces exactly one event, timeouts
+// included.
+// Callbacks only flag a connection as finished or gone; closing and
+// deleting AsyncClients happens on the caller's task in send()/poll(),
+// without the slot lock held, because AsyncTCP runs the disconnect
+// callback inside close().
+class AsyncHTTPClient {
+public:
+    AsyncHTTPClient();
+
+    void setNotifyTask(TaskHandle_t task) { notifyTask = task; }
+
+    // Sends a complete HTTP/1.1 request (request line, headers and body,
+    // as formatted by a RequestBuilder). The text is copied, the caller's
+    // buffer can be reused right away. A new connection goes to address
+    // when given, else host is resolved by AsyncTCP. tag is the caller's,
+    // it comes back in the event. Request id (never 0), or 0 when every
+    // slot is busy or the request is too long.
+    uint16_t send(const char* host, const IPAddress* address, uint16_t port, const char* request, size_t length,
+                  unsigned long timeoutMs, uint8_t tag);
+    // Next finished request, false when none is waiting. Also expires
+    // requests past their timeout.
+    bool poll(AsyncHTTPEvent& event);
+    // Closes kept-alive connections idle for ASYNC_HTTP_IDLE_TIMEOUT
+    void closeIdleConnections();
+
+    uint8_t getInFlight();
+    const AsyncHTTPStats& getStats() const { return stats; }
+
+private:
+    enum ParseState : uint8_t {
+        PARSE_STATUS_LINE,
+        PARSE_HEADERS,
+        PARSE_BODY,
+        PARSE_CHUNK_SIZE,
+        PARSE_CHUNK_DATA,
+        PARSE_CHUNK_END,                // CRLF after the chunk data
+        PARSE_CHUNK_TRAILER,
+        PARSE_DONE
+    };
+
+    struct Slot {
+        AsyncClient* client;            // nullptr when there is no connection
+        char host[ASYNC_HTTP_HOST_LENGTH];
+        uint16_t port;
+        uint16_t requestId;             // 0 when no request is in flight
+        bool connected;
+        bool disconnected;              // Gone, waiting to be deleted
+        bool dropConnection;            // Not reusable, close it when reaping
+        bool reused;
+        bool retryPending;              // Reused connection failed early, reconnect from send()/poll()
+        bool idempotent;                // GET, may reach the server twice
+        uint8_t tag;
+        unsigned long startedAt;
+        unsigned long timeoutMs;
+        unsigned long idleSince;
+        IPAddress address;              // For a new connection, when hasAddress
+        bool hasAddress;
+        char request[REQUEST_BUILDER_SIZE]; // Kept until finished, a stale retry sends it again
+        uint16_t requestLength;
+
+        // Response parser
+        ParseState state;
+        int status;
+        long contentLength;             // Body bytes still expected, -1 for "until close"
+        long chunkRemaining;
+        bool chunked;
+        bool keepAlive;
+        char line[ASYNC_HTTP_LINE_LENGTH];
+        uint8_t lineLength;
+        char body[ASYNC_HTTP_MAX_BODY];
+        uint16_t bodyLength;
+        bool truncated;
+    };
+
+    Slot slots[ASYNC_HTTP_MAX_REQUESTS];
+    SemaphoreHandle_t lock;
+    QueueHandle_t events;
+    TaskHandle_t notifyTask;
+    uint16_t nextRequestId;
+    AsyncHTTPStats stats;
+
+    Slot* findSlot(const char* host, uint16_t port, bool& reuse);
+    void resetParser(Slot& slot);
+    void attach(Slot& slot, AsyncClient* client);
+    void finish(Slot& slot, int status);
+    // writeFailed: the request never left, else only a GET is resent
+    bool scheduleRetry(Slot& slot, bool writeFailed);
+    void startRetries();
+    bool connectSlot(Slot& slot, AsyncClient* client, uint16_t requestId);
+    void reap();
+
+    // Parser, true once the response is complete
+    bool consume(Slot& slot, const char* data, size_t length);
+    bool takeLine(Slot& slot, char c);
+    void handleStatusLine(Slot& slot);
+    void handleHeaderLine(Slot& slot);
+    void appendBody(Slot& slot, const char* data, size_t length);
+
+    // AsyncTCP callbacks, run on the AsyncTCP task
+    void onConnect(Slot& slot, AsyncClient* client);
+    void onData(Slot& slot, AsyncClient* client, const char* data, size_t length);
+    void onDisconnect(Slot& slot, AsyncClient* client);
+};
+
+#endif // ASYNC_HTTP_CLIENT_H
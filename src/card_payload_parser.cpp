@@ -0,0 +1,703 @@
+#include "card_payload_parser.h"
+#include "mybase64.h"
+
+// =============================================
+// CONSTANTS
+// =============================================
+
+#define TLV_NULL        0x00
+#define TLV_LOCK        0x01
+#define TLV_MEMORY      0x02
+#define TLV_NDEF        0x03
+#define TLV_PROPRIETARY 0xFD
+#define TLV_TERMINATOR  0xFE
+
+#define NDEF_FLAG_SR    0x10
+#define NDEF_FLAG_IL    0x08
+#define NDEF_TNF_MASK   0x07
+#define NDEF_TNF_WELL_KNOWN 0x01
+#define NDEF_RTD_TEXT   'T'
+
+static inline bool isJsonSpace(uint8_t c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static inline int hexValue(uint8_t c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// =============================================
+// CLASS IMPLEMENTATION
+// =============================================
+
+CardPayloadParser::CardPayloadParser()
+{
+    reset();
+}
+
+void CardPayloadParser::reset()
+{
+    result = PARSE_MORE;
+    error = "";
+    bytesConsumed = 0;
+    stage = STAGE_TLV;
+
+    tlvState = TLV_TYPE;
+    tlvType = 0;
+    tlvLength = 0;
+    tlvSkip = 0;
+    messageRemaining = 0;
+
+    recordState = REC_HEADER;
+    recordFlags = 0;
+    recordTypeLength = 0;
+    recordType = 0;
+    recordIdLength = 0;
+    fieldBytes = 0;
+    payloadRemaining = 0;
+    skipRemaining = 0;
+
+    quadLength = 0;
+    padding = 0;
+
+    jsonState = JSON_START;
+    key[0] = '\0';
+    keyLength = 0;
+    value = nullptr;
+    valueMax = 0;
+    valueLength = 0;
+    nestedDepth = 0;
+    unicodeValue = 0;
+    unicodeDigits = 0;
+
+    nama[0] = '\0';
+    induk[0] = '\0';
+    namaFound = false;
+    indukFound = false;
+}
+
+void CardPayloadParser::resetAtMessage(uint32_t messageLength)
+{
+    reset();
+    stage = STAGE_MESSAGE;
+    messageRemaining = messageLength;
+}
+
+CardPayloadParser::Result CardPayloadParser::feed(const uint8_t *data, size_t length)
+{
+    for (size_t i = 0; i < length && result == PARSE_MORE; i++)
+    {
+        bytesConsumed++;
+
+        if (stage == STAGE_TLV)
+        {
+            feedTlv(data[i]);
+            continue;
+        }
+
+        if (messageRemaining == 0)
+        {
+            fail("NDEF message ended early");
+            break;
+        }
+        messageRemaining--;
+        feedRecord(data[i]);
+
+        if (result == PARSE_MORE && messageRemaining == 0)
+        {
+            fail("NDEF message ended early");
+        }
+    }
+
+    return result;
+}
+
+void CardPayloadParser::fail(const char *message)
+{
+    if (result == PARSE_MORE)
+    {
+        result = PARSE_ERROR;
+        error = message;
+    }
+}
+
+// =============================================
+// TLV LAYER
+// =============================================
+
+void CardPayloadParser::feedTlv(uint8_t b)
+{
+    switch (tlvState)
+    {
+    case TLV_TYPE:
+        tlvType = b;
+        if (b == TLV_NULL)
+        {
+            return;
+        }
+        if (b == TLV_TERMINATOR)
+        {
+            fail("No NDEF TLV");
+            return;
+        }
+        if (b != TLV_NDEF && b != TLV_LOCK && b != TLV_MEMORY && b != TLV_PROPRIETARY)
+        {
+            fail("Unknown TLV");
+            return;
+        }
+        tlvState = TLV_LENGTH;
+        return;
+
+    case TLV_LENGTH:
+        if (b == 0xFF)
+        {
+            tlvState = TLV_LENGTH_HI;
+            return;
+        }
+        tlvLength = b;
+        break;
+
+    case TLV_LENGTH_HI:
+        tlvLength = (uint16_t)b << 8;
+        tlvState = TLV_LENGTH_LO;
+        return;
+
+    case TLV_LENGTH_LO:
+        tlvLength |= b;
+        break;
+
+    case TLV_SKIP:
+        if (--tlvSkip == 0)
+        {
+            tlvState = TLV_TYPE;
+        }
+        return;
+    }
+
+    // Length complete
+    if (tlvType == TLV_NDEF)
+    {
+        if (tlvLength == 0)
+        {
+            fail("Empty NDEF message");
+            return;
+        }
+        stage = STAGE_MESSAGE;
+        messageRemaining = tlvLength;
+    }
+    else if (tlvLength > 0)
+    {
+        tlvSkip = tlvLength;
+        tlvState = TLV_SKIP;
+    }
+    else
+    {
+        tlvState = TLV_TYPE;
+    }
+}
+
+// =============================================
+// NDEF RECORD LAYER
+// =============================================
+
+void CardPayloadParser::feedRecord(uint8_t b)
+{
+    switch (recordState)
+    {
+    case REC_HEADER:
+        recordFlags = b;
+        recordState = REC_TYPE_LENGTH;
+        return;
+
+    case REC_TYPE_LENGTH:
+        recordTypeLength = b;
+        payloadRemaining = 0;
+        fieldBytes = (recordFlags & NDEF_FLAG_SR) ? 1 : 4;
+        recordState = REC_PAYLOAD_LENGTH;
+        return;
+
+    case REC_PAYLOAD_LENGTH:
+        payloadRemaining = (payloadRemaining << 8) | b;
+        if (--fieldBytes > 0)
+        {
+            return;
+        }
+        if (recordFlags & NDEF_FLAG_IL)
+        {
+            recordState = REC_ID_LENGTH;
+            return;
+        }
+        recordIdLength = 0;
+        break;
+
+    case REC_ID_LENGTH:
+        recordIdLength = b;
+        break;
+
+    case REC_TYPE:
+        if (fieldBytes == 0)
+        {
+            recordType = b;
+        }
+        fieldBytes++;
+        if (fieldBytes < recordTypeLength)
+        {
+            return;
+        }
+        if (recordIdLength > 0)
+        {
+            fieldBytes = 0;
+            recordState = REC_ID;
+            return;
+        }
+        beginPayload();
+        return;
+
+    case REC_ID:
+        if (++fieldBytes < recordIdLength)
+        {
+            return;
+        }
+        beginPayload();
+        return;
+
+    case REC_TEXT_STATUS:
+        // Status byte: low 6 bits are the language code length
+        payloadRemaining--;
+        skipRemaining = b & 0x3F;
+        recordState = (skipRemaining > 0) ? REC_LANGUAGE : REC_PAYLOAD;
+        if (payloadRemaining == 0)
+        {
+            endPayload();
+        }
+        return;
+
+    case REC_LANGUAGE:
+        payloadRemaining--;
+        if (--skipRemaining == 0)
+        {
+            recordState = REC_PAYLOAD;
+        }
+        if (payloadRemaining == 0)
+        {
+            endPayload();
+        }
+        return;
+
+    case REC_PAYLOAD:
+        payloadRemaining--;
+        feedBase64(b);
+        if (result == PARSE_MORE && payloadRemaining == 0)
+        {
+            endPayload();
+        }
+        return;
+    }
+
+    // Header complete, type (if any) follows
+    if (recordTypeLength > 0)
+    {
+        fieldBytes = 0;
+        recordState = REC_TYPE;
+        return;
+    }
+    beginPayload();
+}
+
+void CardPayloadParser::beginPayload()
+{
+    if (payloadRemaining == 0)
+    {
+        fail("Empty NDEF record");
+        return;
+    }
+
+    bool isText = (recordFlags & NDEF_TNF_MASK) == NDEF_TNF_WELL_KNOWN &&
+                  recordTypeLength == 1 && recordType == NDEF_RTD_TEXT;
+    recordState = isText ? REC_TEXT_STATUS : REC_PAYLOAD;
+}
+
+void CardPayloadParser::endPayload()
+{
+    flushBase64();
+    if (result != PARSE_MORE)
+    {
+        return;
+    }
+
+    if (jsonState == JSON_END)
+    {
+        // Closing brace seen without both fields. A missing nama is shown
+        // blank, but without induk there is nothing to validate the card by
+        if (!indukFound)
+        {
+            fail("No induk in card payload");
+            return;
+        }
+        result = PARSE_DONE;
+        return;
+    }
+
+    fail("Incomplete JSON payload");
+}
+
+// =============================================
+// BASE64 LAYER
+// =============================================
+
+void CardPayloadParser::feedBase64(uint8_t c)
+{
+    if (c <= ' ')
+    {
+        return; // Line breaks and control bytes are not part of the data
+    }
+
+    if (c == '=')
+    {
+        padding++;
+        quad[quadLength++] = 0;
+    }
+    else
+    {
+        int v = b64_value(c);
+        if (v < 0 || padding > 0)
+        {
+            fail("Invalid base64 payload");
+            return;
+        }
+        quad[quadLength++] = (uint8_t)v;
+    }
+
+    if (quadLength < 4)
+    {
+        return;
+    }
+
+    uint32_t triple = ((uint32_t)quad[0] << 18) | ((uint32_t)quad[1] << 12) |
+                      ((uint32_t)quad[2] << 6) | quad[3];
+    uint8_t count = (padding >= 3) ? 0 : 3 - padding;
+    quadLength = 0;
+
+    for (uint8_t i = 0; i < count && result == PARSE_MORE; i++)
+    {
+        feedJson((uint8_t)(triple >> (16 - 8 * i)));
+    }
+}
+
+void CardPayloadParser::flushBase64()
+{
+    // Unpadded tail: 2 chars -> 1 byte, 3 chars -> 2 bytes
+    if (quadLength < 2 || padding > 0)
+    {
+        quadLength = 0;
+        return;
+    }
+
+    uint8_t count = quadLength - 1;
+    while (quadLength < 4)
+    {
+        quad[quadLength++] = 0;
+    }
+    uint32_t triple = ((uint32_t)quad[0] << 18) | ((uint32_t)quad[1] << 12) |
+                      ((uint32_t)quad[2] << 6) | quad[3];
+    quadLength = 0;
+
+    for (uint8_t i = 0; i < count && result == PARSE_MORE; i++)
+    {
+        feedJson((uint8_t)(triple >> (16 - 8 * i)));
+    }
+}
+
+// =============================================
+// JSON LAYER
+// =============================================
+
+void CardPayloadParser::feedJson(uint8_t c)
+{
+    switch (jsonState)
+    {
+    case JSON_START:
+        if (isJsonSpace(c)) return;
+        if (c != '{')
+        {
+            fail("JSON payload is not an object");
+            return;
+        }
+        jsonState = JSON_KEY_OR_END;
+        return;
+
+    case JSON_KEY_OR_END:
+        if (isJsonSpace(c)) return;
+        if (c == '"')
+        {
+            keyLength = 0;
+            jsonState = JSON_KEY;
+            return;
+        }
+        if (c == '}')
+        {
+            jsonState = JSON_END;
+            return;
+        }
+        fail("Expected JSON key");
+        return;
+
+    case JSON_KEY:
+        if (c == '\\')
+        {
+            jsonState = JSON_KEY_ESCAPE;
+            return;
+        }
+        if (c == '"')
+        {
+            key[keyLength <= CARD_JSON_KEY_MAX ? keyLength : CARD_JSON_KEY_MAX] = '\0';
+            jsonState = JSON_COLON;
+            return;
+        }
+        // fall through
+    case JSON_KEY_ESCAPE:
+        // Keys we care about never need escapes, keep the raw byte
+        if (keyLength < CARD_JSON_KEY_MAX)
+        {
+            key[keyLength] = (char)c;
+        }
+        if (keyLength <= CARD_JSON_KEY_MAX)
+        {
+            keyLength++; // CARD_JSON_KEY_MAX + 1 marks an overlong key
+        }
+        jsonState = JSON_KEY;
+        return;
+
+    case JSON_COLON:
+        if (isJsonSpace(c)) return;
+        if (c != ':')
+        {
+            fail("Expected ':' in JSON");
+            return;
+        }
+        selectValue();
+        jsonState = JSON_VALUE;
+        return;
+
+    case JSON_VALUE:
+        if (isJsonSpace(c)) return;
+        if (c == '"')
+        {
+            jsonState = JSON_STRING;
+            return;
+        }
+        if (c == '{' || c == '[')
+        {
+            nestedDepth = 1;
+            jsonState = JSON_NESTED;
+            return;
+        }
+        if (c == ',' || c == '}' || c == ']' || c == ':')
+        {
+            fail("Missing JSON value");
+            return;
+        }
+        appendValue(c);
+        jsonState = JSON_LITERAL;
+        return;
+
+    case JSON_STRING:
+        if (c == '\\')
+        {
+            jsonState = JSON_STRING_ESCAPE;
+            return;
+        }
+        if (c == '"')
+        {
+            finishValue();
+            jsonState = JSON_COMMA_OR_END;
+            return;
+        }
+        appendValue(c);
+        return;
+
+    case JSON_STRING_ESCAPE:
+        jsonState = JSON_STRING;
+        switch (c)
+        {
+        case 'n': appendValue('\n'); return;
+        case 't': appendValue('\t'); return;
+        case 'r': appendValue('\r'); return;
+        case 'b': appendValue('\b'); return;
+        case 'f': appendValue('\f'); return;
+        case 'u':
+            unicodeValue = 0;
+            unicodeDigits = 0;
+            jsonState = JSON_STRING_UNICODE;
+            return;
+        default:
+            appendValue(c); // \" \\ \/
+            return;
+        }
+
+    case JSON_STRING_UNICODE:
+    {
+        int h = hexValue(c);
+        if (h < 0)
+        {
+            fail("Invalid JSON unicode escape");
+            return;
+        }
+        unicodeValue = (unicodeValue << 4) | (uint16_t)h;
+        if (++unicodeDigits < 4)
+        {
+            return;
+        }
+        // Encode the BMP code point as UTF-8
+        if (unicodeValue < 0x80)
+        {
+            appendValue((uint8_t)unicodeValue);
+        }
+        else if (unicodeValue < 0x800)
+        {
+            appendValue(0xC0 | (unicodeValue >> 6));
+            appendValue(0x80 | (unicodeValue & 0x3F));
+        }
+        else
+        {
+            appendValue(0xE0 | (unicodeValue >> 12));
+            appendValue(0x80 | ((unicodeValue >> 6) & 0x3F));
+            appendValue(0x80 | (unicodeValue & 0x3F));
+        }
+        jsonState = JSON_STRING;
+        return;
+    }
+
+    case JSON_LITERAL:
+        if (c == ',' || c == '}' || isJsonSpace(c))
+        {
+            // null means "no value", anything else is kept as written
+            if (value != nullptr && valueLength == 4 && strncmp(value, "null", 4) == 0)
+            {
+                valueLength = 0;
+            }
+            finishValue();
+            jsonState = JSON_COMMA_OR_END;
+            if (result == PARSE_MORE)
+            {
+                feedJson(c);
+            }
+            return;
+        }
+        appendValue(c);
+        return;
+
+    case JSON_NESTED:
+        if (c == '"')
+        {
+            jsonState = JSON_NESTED_STRING;
+        }
+        else if (c == '{' || c == '[')
+        {
+            nestedDepth++;
+        }
+        else if (c == '}' || c == ']')
+        {
+            if (--nestedDepth == 0)
+            {
+                finishValue();
+                jsonState = JSON_COMMA_OR_END;
+            }
+        }
+        return;
+
+    case JSON_NESTED_STRING:
+        if (c == '\\')
+        {
+            jsonState = JSON_NESTED_ESCAPE;
+        }
+        else if (c == '"')
+        {
+            jsonState = JSON_NESTED;
+        }
+        return;
+
+    case JSON_NESTED_ESCAPE:
+        jsonState = JSON_NESTED_STRING;
+        return;
+
+    case JSON_COMMA_OR_END:
+        if (isJsonSpace(c)) return;
+        if (c == ',')
+        {
+            jsonState = JSON_KEY_OR_END;
+            return;
+        }
+        if (c == '}')
+        {
+            jsonState = JSON_END;
+            return;
+        }
+        fail("Expected ',' or '}' in JSON");
+        return;
+
+    case JSON_END:
+        return; // Trailing bytes after the object are ignored
+    }
+}
+
+void CardPayloadParser::selectValue()
+{
+    value = nullptr;
+    valueMax = 0;
+    valueLength = 0;
+
+    if (keyLength > CARD_JSON_KEY_MAX)
+    {
+        return;
+    }
+    if (strcmp(key, "nama") == 0)
+    {
+        value = nama;
+        valueMax = sizeof(nama);
+    }
+    else if (strcmp(key, "induk") == 0)
+    {
+        value = induk;
+        valueMax = sizeof(induk);
+    }
+}
+
+void CardPayloadParser::appendValue(uint8_t c)
+{
+    // Over-long values are truncated, the rest is still consumed
+    if (value != nullptr && valueLength + 1 < valueMax)
+    {
+        value[valueLength++] = (char)c;
+    }
+}
+
+void CardPayloadParser::finishValue()
+{
+    if (value == nullptr)
+    {
+        return;
+    }
+
+    value[valueLength] = '\0';
+    if (value == nama)
+    {
+        namaFound = true;
+    }
+    else if (value == induk)
+    {
+        // An empty or null induk identifies nobody, keep looking
+        indukFound = valueLength > 0;
+    }
+    value = nullptr;
+
+    if (namaFound && indukFound)
+    {
+        result = PARSE_DONE;
+    }
+}
@@ -0,0 +1,119 @@
+#ifndef CARD_PAYLOAD_PARSER_H
+#define CARD_PAYLOAD_PARSER_H
+
+#include <Arduino.h>
+
+#define CARD_NAMA_MAX_LENGTH    96
+#define CARD_INDUK_MAX_LENGTH   32
+#define CARD_JSON_KEY_MAX       16
+
+// =============================================
+// CARD PAYLOAD PARSER CLASS
+// =============================================
+
+// Single-pass TLV -> NDEF record -> base64 -> JSON parser for the santri
+// card payload. It accepts any chunk size, keeps all state in fixed member
+// buffers (no heap, no copy of the payload) and stops as soon as both
+// "induk" and "nama" have been extracted.
+class CardPayloadParser {
+public:
+    enum Result {
+        PARSE_MORE,     // Needs more bytes
+        PARSE_DONE,     // Fields extracted, remaining input can be skipped
+        PARSE_ERROR     // Malformed payload, see getError()
+    };
+
+    CardPayloadParser();
+
+    // Start at the raw TLV area (first NDEF block of the card)
+    void reset();
+    // Start directly at an NDEF message body of the given length
+    void resetAtMessage(uint32_t messageLength);
+
+    Result feed(const uint8_t* data, size_t length);
+    Result getResult() const { return result; }
+
+    const char* getNama() const { return nama; }
+    const char* getInduk() const { return induk; }
+    bool hasNama() const { return namaFound; }
+    bool hasInduk() const { return indukFound; }
+    const char* getError() const { return error; }
+    uint32_t getBytesConsumed() const { return bytesConsumed; }
+
+private:
+    enum Stage { STAGE_TLV, STAGE_MESSAGE };
+
+    enum TlvState {
+        TLV_TYPE, TLV_LENGTH, TLV_LENGTH_HI, TLV_LENGTH_LO, TLV_SKIP
+    };
+
+    enum RecordState {
+        REC_HEADER, REC_TYPE_LENGTH, REC_PAYLOAD_LENGTH, REC_ID_LENGTH,
+        REC_TYPE, REC_ID, REC_TEXT_STATUS, REC_LANGUAGE, REC_PAYLOAD
+    };
+
+    enum JsonState {
+        JSON_START, JSON_KEY_OR_END, JSON_KEY, JSON_KEY_ESCAPE, JSON_COLON,
+        JSON_VALUE, JSON_STRING, JSON_STRING_ESCAPE, JSON_STRING_UNICODE,
+        JSON_LITERAL, JSON_NESTED, JSON_NESTED_STRING, JSON_NESTED_ESCAPE,
+        JSON_COMMA_OR_END, JSON_END
+    };
+
+    Result result;
+    const char* error;
+    uint32_t bytesConsumed;
+    Stage stage;
+
+    // TLV layer
+    TlvState tlvState;
+    uint8_t tlvType;
+    uint16_t tlvLength;
+    uint16_t tlvSkip;
+    uint32_t messageRemaining;
+
+    // NDEF record layer
+    RecordState recordState;
+    uint8_t recordFlags;
+    uint8_t recordTypeLength;
+    uint8_t recordType;
+    uint8_t recordIdLength;
+    uint8_t fieldBytes;
+    uint32_t payloadRemaining;
+    uint32_t skipRemaining;
+
+    // Base64 layer
+    uint8_t quad[4];
+    uint8_t quadLength;
+    uint8_t padding;
+
+    // JSON layer
+    JsonState jsonState;
+    char key[CARD_JSON_KEY_MAX + 1];
+    uint8_t keyLength;
+    char* value;
+    uint8_t valueMax;
+    uint8_t valueLength;
+    uint8_t nestedDepth;
+    uint16_t unicodeValue;
+    uint8_t unicodeDigits;
+
+    // Extracted fields
+    char nama[CARD_NAMA_MAX_LENGTH];
+    char induk[CARD_INDUK_MAX_LENGTH];
+    bool namaFound;
+    bool indukFound;
+
+    void feedTlv(uint8_t b);
+    void feedRecord(uint8_t b);
+    void beginPayload();
+    void endPayload();
+    void feedBase64(uint8_t c);
+    void flushBase64();
+    void feedJson(uint8_t c);
+    void selectValue();
+    void appendValue(uint8_t c);
+    void finishValue();
+    void fail(const char* message);
+};
+
+#endif // CARD_PAYLOAD_PARSER_H
@@ -12,6 +12,18 @@
 // LCD I2C Address
 #define LCD_I2C_ADDR    0x27
 
+// PN532 control lines (IRQ is active low when a response is ready). Both
+// need extra wires the original board does not have, see
+// NFC_USE_IRQ_DETECTION.
+#define PN532_IRQ_PIN   15
+#define PN532_RESET_PIN 16
+
+// PN532 SPI Pins (only used with NFC_TRANSPORT_SPI, on its own bus)
+#define PN532_SPI_SS_PIN    10
+#define PN532_SPI_MOSI_PIN  11
+#define PN532_SPI_SCK_PIN   12
+#define PN532_SPI_MISO_PIN  13
+
 // Keypad 1x4 Pins (4 buttons for institutions)
 #define KEYPAD_BUTTON_3_PIN  19  // GPIO19 for Button 1 (Institution 1)
 #define KEYPAD_BUTTON_4_PIN  20  // GPIO20 for Button 2 (Institution 2)
@@ -44,6 +56,147 @@
 // Endpoints
 #define VALIDATE_UID_ENDPOINT   "/check"
 #define LOG_ACTIVITY_ENDPOINT   "/santri/visitor_santri/"
+#define COMBINED_TAP_ENDPOINT   "/santri/tap"       // Validate + log in one request
+#define CAPABILITIES_ENDPOINT   "/capabilities"
+#define BATCH_LOG_ENDPOINT      "/santri/visitor_santri/batch"
+#define ROSTER_ENDPOINT         "/santri/roster"
+#define UID_LOOKUP_ENDPOINT     "/santri/uid"       // Server record of a card by UID alone
+
+// Combined validate-and-log request:
+// 0 = off, always two requests
+// 1 = on, falls back to two requests if the server answers 404/405/501
+// 2 = on when GET CAPABILITIES_ENDPOINT returns {"combined_tap": true}
+#define API_COMBINED_MODE       2
+
+// Speculative lookup by UID, sent right after detection while the sectors
+// are still being read; its verdict is used once the card's induk matches.
+// GET UID_LOOKUP_ENDPOINT?id_card={uid}&id_device={mac_address}
+// -> {"found": true, "id_santri": "...", "valid": true}
+// 0 = off
+// 1 = on, switched off if the server answers 404/405/501
+// 2 = on when GET CAPABILITIES_ENDPOINT returns {"uid_lookup": true}
+#define API_PREFETCH_MODE       2
+
+// Batched activity upload: logs go through the journal and are sent as one
+// text/csv request once API_BATCH_MAX_RECORDS are pending or the oldest has
+// waited API_BATCH_WINDOW, whichever comes first.
+// 0 = off, one request per log
+// 1 = on, falls back to single requests if the server answers 404/405/501
+// 2 = on when GET CAPABILITIES_ENDPOINT returns {"batch_log": true}
+#define API_BATCH_MODE          2
+#define API_BATCH_MAX_RECORDS   32
+#define API_BATCH_WINDOW        3000    // ms
+// Longest CSV line: seq (10) + memberID (31 quotes, doubled and quoted: 64)
+// + institution (3) + tapped_at (10) + 3 commas + newline, plus one
+// terminator for the whole body
+#define API_BATCH_BUILDER_SIZE  (API_BATCH_MAX_RECORDS * 91 + 1)
+
+// Tap timestamps (UTC) for logs that are uploaded later
+#define NTP_SERVER              "pool.ntp.org"
+
+// All requests share one kept-alive HTTP/1.1 connection. It is opened
+// ahead of time from IDLE after WiFi comes back, and re-opened there when
+// the server has closed it (checked every API_WARMUP_INTERVAL).
+#define API_CONNECT_TIMEOUT     3000    // ms for the TCP connect
+#define API_WARMUP_INTERVAL     10000   // ms between idle connection checks
+
+// The server host is resolved by the sync task and connections go to the
+// cached address; requests never wait for DNS once it has been resolved.
+#define DNS_CACHE_TTL           300000  // ms before the address is looked up again
+#define DNS_RETRY_INTERVAL      10000   // ms between attempts while DNS fails
+
+// https:// base URLs use the same kept-alive connection over TLS, so the
+// handshake is paid once per connection, normally during the idle warm-up.
+// The server is checked against the CA in server_ca.h, or else against
+// the SHA-256 fingerprint of its certificate (hex, colons allowed). With
+// neither set the traffic is encrypted but the server is not verified.
+// TLS session resumption is not available: WiFiClientSecure runs the whole
+// handshake inside connect() and exposes no session to save or restore.
+#define API_TLS_FINGERPRINT         ""
+#define API_TLS_HANDSHAKE_TIMEOUT   5       // s
+
+// Request timeouts follow the measured server response time: smoothed RTT
+// + 4 * its variation, at least API_TIMEOUT_MIN and at most the configured
+// API timeout (5 s), doubled per consecutive failure. After
+// API_BREAKER_THRESHOLD failures in a row (no answer, 5xx, 408, 429) the
+// circuit opens: requests fail at once, taps take the offline path and the
+// sync task probes the server every API_BREAKER_PROBE_INTERVAL while idle.
+#define API_TIMEOUT_MIN             600     // ms
+#define API_BREAKER_THRESHOLD       3
+#define API_BREAKER_PROBE_INTERVAL  5000    // ms
+#define API_BREAKER_PROBE_TIMEOUT   2000    // ms
+
+// The API URL may list several servers separated by commas, in order of
+// preference (e.g. the primary, then a local backup). Each has its own
+// connection, DNS entry, response time estimate and circuit breaker.
+// Requests go to the active server; another takes over when the active
+// one's circuit opens or it is API_ENDPOINT_SWITCH_MARGIN percent slower
+// (expected time to an answer, failures counted at the full timeout).
+// Idle standbys get a GET / every API_ENDPOINT_MEASURE_INTERVAL. An async
+// validation or UID lookup still unanswered after the active server's p95
+// response time is sent to the next server as well and the first answer
+// wins; activity logs are never sent twice.
+#define API_MAX_ENDPOINTS               2
+#define API_ENDPOINT_SWITCH_MARGIN      25      // %
+#define API_ENDPOINT_MEASURE_INTERVAL   30000   // ms
+#define API_HEDGE_MIN_SAMPLES           8       // Response times before the p95 is trusted
+
+// Validation and single activity logs from the state machine go through an
+// AsyncTCP client instead of HTTPClient, so the state machine keeps running
+// while they are in flight and does not queue behind the sync task's
+// requests. Only for http:// servers, https stays on HTTPClient.
+#define API_ASYNC_REQUESTS          1
+#define ASYNC_HTTP_MAX_REQUESTS     4       // Requests (and connections) at once
+#define ASYNC_HTTP_MAX_BODY         256     // Response bytes kept per request
+#define ASYNC_HTTP_IDLE_TIMEOUT     4000    // ms, below the usual server keep-alive
+
+// URLs and request bodies are formatted into fixed RequestBuilder buffers
+// instead of String chains. Activity logs are sent as
+// 0 = multipart/form-data (original format)
+// 1 = application/x-www-form-urlencoded, about a third of the size
+#define REQUEST_BUILDER_SIZE        640     // Bytes, a whole request line + headers + body
+#define API_BODY_FORMAT             0
+
+// Server validation verdicts kept in RAM per (UID, santri ID). A card
+// revoked on the server keeps passing for up to VALIDATION_CACHE_VALID_TTL.
+#define VALIDATION_CACHE_SIZE           64
+#define VALIDATION_CACHE_VALID_TTL      600000  // ms, 10 minutes
+#define VALIDATION_CACHE_INVALID_TTL    120000  // ms, 2 minutes
+
+// Local roster (see partitions_roster_8MB.csv): cards found in it are
+// validated on the device, unknown cards still go to the server. Each half
+// of the partition holds (size / 2 - 32) / 32 entries, 8191 for 512 KB.
+#define ROSTER_PARTITION_LABEL      "roster"
+#define ROSTER_PARTITION_SUBTYPE    0x40
+#define ROSTER_REFRESH_INTERVAL     3600000 // ms between roster downloads
+#define ROSTER_RETRY_INTERVAL       60000   // ms after a failed download
+
+// Conditional GET for resources fetched periodically (roster, capabilities):
+// the ETag/Last-Modified of the copy on the device are sent back with
+// If-None-Match/If-Modified-Since, so an unchanged resource costs a 304
+// with headers only. Validators are kept in NVS across reboots.
+#define HTTP_CACHE_ENTRIES              4
+#define CAPABILITIES_REFRESH_INTERVAL   1800000 // ms between capability re-checks
+#define CAPABILITIES_RETRY_INTERVAL     60000   // ms after a failed check (5xx, no answer)
+#define CAPABILITIES_MAX_BODY           256     // Bytes, streamed into a stack buffer
+
+// Response bodies are read once into a fixed buffer and parsed in place:
+// "true:<message>" by a small scanner, JSON through a filter into a
+// JsonDocument backed by a fixed arena. Larger bodies are skipped.
+#define API_RESPONSE_BUFFER_SIZE        2048    // Bytes
+#define JSON_ARENA_SIZE                 3072    // Bytes per arena (blocking and async path)
+#define API_DEBUG_RESPONSES             0       // 1 = also copy and print every body (getLastResponseBody)
+
+// Activity journal: logs the server did not take are kept in a ring file on
+// LittleFS and uploaded in order by a background task once it answers again.
+// While records are pending, new taps are queued behind them instead of
+// waiting on the server.
+#define JOURNAL_FILE            "/journal.bin"
+#define JOURNAL_CAPACITY        512     // Records, 52 bytes each
+#define JOURNAL_UPLOAD_INTERVAL 250     // ms between checks while idle
+#define JOURNAL_RETRY_MIN       2000    // ms backoff after a failed upload
+#define JOURNAL_RETRY_MAX       60000
+#define JOURNAL_ADMIT_OFFLINE   1       // Admit on card data when validation cannot reach the server
 
 // OTA (Over-The-Air) Update Configuration:
 // OTA runs in background after WiFi connection (no LCD display)
@@ -60,10 +213,52 @@
 // =============================================
 
 #define CARD_READ_TIMEOUT       5000    // 5 seconds timeout for card reading
+#define NFC_POLL_INTERVAL       500     // Card poll interval when IRQ detection is off
 #define BUTTON_DEBOUNCE_DELAY   50      // Debounce delay for buttons
 #define LCD_MESSAGE_DELAY       1500    // 3 seconds for status messages
 #define WIFI_CONNECTION_TIMEOUT 10000   // 10 seconds for WiFi connection
 
+// =============================================
+// NFC DETECTION
+// =============================================
+
+// 1 = arm InListPassiveTarget on the PN532 and wake the state machine from
+//     the IRQ line (I2C bus stays idle while no card is present). Needs the
+//     PN532 IRQ pin wired to PN532_IRQ_PIN; when the line never goes low
+//     the reader falls back to polling.
+// 0 = poll readPassiveTargetID every NFC_POLL_INTERVAL (original wiring),
+//     each poll returns within NFC_DETECT_TIMEOUT on an empty reader
+#define NFC_USE_IRQ_DETECTION   0
+
+// Polled detection: the PN532 gives up on an empty field after this many
+// activation retries (0xFF would retry forever), and the host stops waiting
+// for its answer after NFC_DETECT_TIMEOUT
+#define NFC_PASSIVE_ACTIVATION_RETRIES  0x10
+#define NFC_DETECT_TIMEOUT              100     // ms
+
+// A processed card must leave the reader before it counts as a new tap.
+// While it stays, only a short InListPassiveTarget probe runs every
+// NFC_PRESENCE_INTERVAL; removal needs NFC_REMOVAL_CONFIRM_CHECKS misses
+// in a row so a wobbling card does not count as two taps.
+#define NFC_PRESENCE_INTERVAL       200     // ms between presence probes
+#define NFC_PRESENCE_TIMEOUT        30      // ms a present card has to answer
+#define NFC_REMOVAL_CONFIRM_CHECKS  2
+
+// PN532 interface (set the SEL0/SEL1 switches on the board to match)
+#define NFC_TRANSPORT_I2C       0       // Shares SDA/SCL with the LCD
+#define NFC_TRANSPORT_SPI       1       // Dedicated bus on the PN532_SPI_* pins
+#define NFC_TRANSPORT_EMULATOR  2       // Software PN532 with a built-in card, no reader needed
+#ifndef NFC_TRANSPORT                   // [env:native] builds with the emulator
+#define NFC_TRANSPORT           NFC_TRANSPORT_I2C
+#endif
+
+#define PN532_SPI_CLOCK         5000000 // Hz, the PN532 allows up to 5 MHz
+
+// NFC_TRANSPORT_EMULATOR only: delay of every emulated ACK/response frame
+// and which card image is presented (1 = Classic 1K, 0 = NTAG215)
+#define NFC_EMULATOR_FRAME_LATENCY_US   1500
+#define NFC_EMULATOR_CLASSIC_CARD       1
+
 // =============================================
 // AUDIO FEEDBACK FREQUENCIES
 // =============================================
@@ -106,6 +301,7 @@ enum SystemState {
 
 #define MSG_IDLE_1              "Tempelkan Kartu"
 #define MSG_IDLE_2              ""
+#define MSG_IDLE_OFFLINE_2      "(Mode Offline)"
 #define MSG_VALIDATING_1        "Memvalidasi..."
 #define MSG_VALIDATING_2        ""
 #define MSG_SELECT_ACTIVITY_1   "Pilih Aktivitas:"
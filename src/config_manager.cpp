@@ -215,7 +215,7 @@ bool ConfigManager::setApiBaseUrl(const char* url) {
         Serial.println("Invalid API URL: null pointer");
         return false;
     }
-    if (!isValidUrl(url)) {
+    if (!isValidUrlList(url)) {
         Serial.printf("Invalid API URL: %s\n", url);
         return false;
     }
@@ -273,6 +273,23 @@ bool ConfigManager::isValidUrl(const char* url) {
     return urlStr.startsWith("http://") || urlStr.startsWith("https://");
 }
 
+bool ConfigManager::isValidUrlList(const char* urls) {
+    if (!urls) return false;
+    if (strnlen(urls, sizeof(config.apiBaseUrl)) >= sizeof(config.apiBaseUrl)) return false;
+    
+    // Comma-separated, in order of preference; every entry must be a URL
+    String list = String(urls);
+    int start = 0;
+    while (true) {
+        int comma = list.indexOf(',', start);
+        String url = comma >= 0 ? list.substring(start, comma) : list.substring(start);
+        url.trim();
+        if (!isValidUrl(url.c_str())) return false;
+        if (comma < 0) return true;
+        start = comma + 1;
+    }
+}
+
 bool ConfigManager::isValidHostname(const char* hostname) {
     if (!hostname) return false;
     size_t len = strnlen(hostname, 64);
@@ -289,11 +306,11 @@ bool ConfigManager::isValidHostname(const char* hostname) {
 }
 
 bool ConfigManager::validateConfig() {
-    return isValidUrl(config.apiBaseUrl) && isValidHostname(config.mdnsHostname) && strlen(config.deviceName) > 0;
+    return isValidUrlList(config.apiBaseUrl) && isValidHostname(config.mdnsHostname) && strlen(config.deviceName) > 0;
 }
 
 bool ConfigManager::validateConfig(const DeviceConfig& testConfig) {
-    return isValidUrl(testConfig.apiBaseUrl) && isValidHostname(testConfig.mdnsHostname) && strlen(testConfig.deviceName) > 0;
+    return isValidUrlList(testConfig.apiBaseUrl) && isValidHostname(testConfig.mdnsHostname) && strlen(testConfig.deviceName) > 0;
 }
 
 String ConfigManager::toJson() {
@@ -10,7 +10,7 @@
 // =============================================
 
 struct DeviceConfig {
-    char apiBaseUrl[128];
+    char apiBaseUrl[128];   // One URL, or several separated by commas in order of preference
     char mdnsHostname[32];
     char deviceName[64];
     uint8_t configValid;  // Use uint8_t instead of bool for better EEPROM compatibility
@@ -65,6 +65,7 @@ public:
     
     // Validation
     bool isValidUrl(const char* url);
+    bool isValidUrlList(const char* urls);
     bool isValidHostname(const char* hostname);
     
     // JSON conversion
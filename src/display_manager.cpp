@@ -6,7 +6,7 @@
 
 DisplayManager::DisplayManager(uint8_t addr, uint8_t columns, uint8_t rows)
     : address(addr), cols(columns), rows(rows), isDisplayingMessage(false), messageStartTime(0), lcd(addr, columns, rows),
-      isScrolling(false), scrollingText(""), scrollPosition(0), lastScrollTime(0), scrollDelay(500) {}
+      offlineMode(false), isScrolling(false), scrollingText(""), scrollPosition(0), lastScrollTime(0), scrollDelay(500) {}
 
 void DisplayManager::begin() {
     initLCD();
@@ -79,10 +79,20 @@ void DisplayManager::centerText(String& text, uint8_t width) {
 }
 
 void DisplayManager::showIdleScreen() {
-    showTwoLines(MSG_IDLE_1, MSG_IDLE_2);
+    showTwoLines(MSG_IDLE_1, offlineMode ? MSG_IDLE_OFFLINE_2 : MSG_IDLE_2);
     isDisplayingMessage = false;
 }
 
+void DisplayManager::setOfflineMode(bool offline) {
+    if (offline == offlineMode) {
+        return;
+    }
+    offlineMode = offline;
+    if (!isDisplayingMessage && !isScrolling) {
+        showIdleScreen();
+    }
+}
+
 void DisplayManager::showValidating() {
     showTwoLines(MSG_VALIDATING_1, MSG_VALIDATING_2);
     isDisplayingMessage = false;
@@ -20,6 +20,7 @@ private:
     bool isDisplayingMessage;
     String currentLine1;
     String currentLine2;
+    bool offlineMode;               // Idle screen says taps are taken offline
     
     // Scrolling variables
     bool isScrolling;
@@ -51,6 +52,8 @@ public:
     void showInvalidCard();
     void showServerError();
     void showWiFiError();
+    // Redraws the idle screen when the mode changes and nothing else is shown
+    void setOfflineMode(bool offline);
 
     // Generic message display with auto-clear
     void showMessage(String line1, String line2, int delayMs = LCD_MESSAGE_DELAY);
@@ -0,0 +1,109 @@
+#include "dns_cache.h"
+#include <WiFi.h>
+
+// =============================================
+// CLASS IMPLEMENTATION
+// =============================================
+
+DNSCache::DNSCache() : generation(0), valid(false), literal(false), stale(false), resolvedAt(0), lastAttempt(0)
+{
+    host[0] = '\0';
+    memset(&stats, 0, sizeof(stats));
+    lock = xSemaphoreCreateMutex();
+}
+
+void DNSCache::setHost(const String &newHost)
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+    strncpy(host, newHost.c_str(), sizeof(host) - 1);
+    host[sizeof(host) - 1] = '\0';
+    generation++;
+    IPAddress parsed;
+    literal = parsed.fromString(host);
+    if (literal)
+    {
+        address = parsed;
+    }
+    valid = literal;
+    stale = false;
+    resolvedAt = 0;
+    lastAttempt = 0;
+    xSemaphoreGive(lock);
+}
+
+bool DNSCache::lookup(IPAddress &result)
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+    bool found = valid;
+    if (found)
+    {
+        result = address;
+        stats.hits++;
+    }
+    else
+    {
+        stats.misses++;
+    }
+    xSemaphoreGive(lock);
+    return found;
+}
+
+void DNSCache::markStale()
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+    stale = !literal;
+    xSemaphoreGive(lock);
+}
+
+bool DNSCache::refreshIfDue()
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+    unsigned long now = millis();
+    bool due = !literal && host[0] != '\0' && (lastAttempt == 0 || now - lastAttempt >= DNS_RETRY_INTERVAL) &&
+               (!valid || stale || now - resolvedAt >= DNS_CACHE_TTL);
+    char name[DNS_CACHE_HOST_LENGTH];
+    uint16_t requestedFor = generation;
+    if (due)
+    {
+        strcpy(name, host);
+        lastAttempt = now;
+    }
+    xSemaphoreGive(lock);
+    if (!due)
+    {
+        return false;
+    }
+
+    // Outside the lock: lookup() keeps answering from the old entry
+    IPAddress resolved;
+    unsigned long startUs = micros();
+    bool ok = WiFi.hostByName(name, resolved) == 1;
+    unsigned long elapsedUs = micros() - startUs;
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    stats.resolutions++;
+    stats.lastResolveUs = elapsedUs;
+    if (elapsedUs > stats.maxResolveUs)
+    {
+        stats.maxResolveUs = elapsedUs;
+    }
+    if (!ok)
+    {
+        stats.failures++;
+    }
+    else if (requestedFor == generation)
+    {
+        if (valid && resolved != address)
+        {
+            Serial.printf("DNS: %s moved to %s\n", name, resolved.toString().c_str());
+        }
+        address = resolved;
+        valid = true;
+        stale = false;
+        resolvedAt = millis();
+    }
+    xSemaphoreGive(lock);
+
+    Serial.printf("DNS: %s %s in %lu us\n", name, ok ? resolved.toString().c_str() : "not resolved", elapsedUs);
+    return ok;
+}
@@ -0,0 +1,56 @@
+#ifndef DNS_CACHE_H
+#define DNS_CACHE_H
+
+#include <Arduino.h>
+#include <IPAddress.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include "config.h"
+
+#define DNS_CACHE_HOST_LENGTH   64
+
+struct DNSCacheStats {
+    uint32_t hits;                  // Address served from the cache
+    uint32_t misses;                // Nothing cached yet, the caller resolved itself
+    uint32_t resolutions;           // Lookups done by refresh()
+    uint32_t failures;
+    unsigned long lastResolveUs;
+    unsigned long maxResolveUs;
+};
+
+// =============================================
+// DNS CACHE CLASS
+// =============================================
+
+// Address of the API server host. lookup() only ever reads the cache; the
+// DNS query itself runs in refreshIfDue() on the background task, every
+// DNS_CACHE_TTL or sooner after markStale(). Until a new answer arrives
+// the last known address keeps being used, so a slow or missing DNS
+// server never holds up a tap. IP literals are never resolved.
+class DNSCache {
+public:
+    DNSCache();
+
+    void setHost(const String& host);
+    bool lookup(IPAddress& address);
+    // The cached address did not work, resolve again on the next refresh
+    void markStale();
+    // Blocking, call from the background task only
+    bool refreshIfDue();
+
+    const DNSCacheStats& getStats() const { return stats; }
+
+private:
+    SemaphoreHandle_t lock;
+    char host[DNS_CACHE_HOST_LENGTH];
+    uint16_t generation;            // Bumped by setHost(), drops answers for an old host
+    IPAddress address;
+    bool valid;
+    bool literal;
+    bool stale;
+    unsigned long resolvedAt;
+    unsigned long lastAttempt;
+    DNSCacheStats stats;
+};
+
+#endif // DNS_CACHE_H
@@ -0,0 +1,191 @@
+#include "http_cache.h"
+
+#define HTTP_CACHE_NAMESPACE    "http_cache"
+#define HTTP_CACHE_KEY          "validators"
+
+// =============================================
+// CLASS IMPLEMENTATION
+// =============================================
+
+HTTPCache::HTTPCache() : loaded(false)
+{
+    memset(entries, 0, sizeof(entries));
+    memset(&stats, 0, sizeof(stats));
+}
+
+void HTTPCache::load()
+{
+    // NVS is not up yet when the global instance is constructed
+    loaded = true;
+
+    Preferences preferences;
+    if (!preferences.begin(HTTP_CACHE_NAMESPACE, true))
+    {
+        return;
+    }
+    if (preferences.getBytes(HTTP_CACHE_KEY, entries, sizeof(entries)) != sizeof(entries))
+    {
+        // Missing, or written with another HTTP_CACHE_ENTRIES
+        memset(entries, 0, sizeof(entries));
+    }
+    preferences.end();
+
+    // Never trust strings read back from flash to be terminated
+    for (uint8_t i = 0; i < HTTP_CACHE_ENTRIES; i++)
+    {
+        entries[i].etag[HTTP_CACHE_ETAG_LENGTH - 1] = '\0';
+        entries[i].lastModified[HTTP_CACHE_DATE_LENGTH - 1] = '\0';
+    }
+}
+
+void HTTPCache::save()
+{
+    Preferences preferences;
+    if (!preferences.begin(HTTP_CACHE_NAMESPACE, false))
+    {
+        Serial.println("HTTP cache: failed to open NVS");
+        return;
+    }
+    preferences.putBytes(HTTP_CACHE_KEY, entries, sizeof(entries));
+    preferences.end();
+}
+
+uint32_t HTTPCache::hashPath(const char *path)
+{
+    // FNV-1a, 0 is reserved for free entries
+    uint32_t hash = 2166136261UL;
+    while (*path)
+    {
+        hash = (hash ^ (uint8_t)*path++) * 16777619UL;
+    }
+    return hash != 0 ? hash : 1;
+}
+
+HTTPValidators *HTTPCache::find(uint32_t hash)
+{
+    for (uint8_t i = 0; i < HTTP_CACHE_ENTRIES; i++)
+    {
+        if (entries[i].pathHash == hash)
+        {
+            return &entries[i];
+        }
+    }
+    return nullptr;
+}
+
+const HTTPValidators *HTTPCache::get(const char *path)
+{
+    if (!loaded)
+    {
+        load();
+    }
+
+    const HTTPValidators *entry = find(hashPath(path));
+    if (entry == nullptr || (entry->etag[0] == '\0' && entry->lastModified[0] == '\0'))
+    {
+        return nullptr;
+    }
+    return entry;
+}
+
+void HTTPCache::update(const char *path, const String &etag, const String &lastModified)
+{
+    if (!loaded)
+    {
+        load();
+    }
+
+    HTTPValidators updated;
+    memset(&updated, 0, sizeof(updated));
+    updated.pathHash = hashPath(path);
+    if (etag.length() < HTTP_CACHE_ETAG_LENGTH)
+    {
+        strncpy(updated.etag, etag.c_str(), HTTP_CACHE_ETAG_LENGTH - 1);
+    }
+    if (lastModified.length() < HTTP_CACHE_DATE_LENGTH)
+    {
+        strncpy(updated.lastModified, lastModified.c_str(), HTTP_CACHE_DATE_LENGTH - 1);
+    }
+
+    HTTPValidators *entry = find(updated.pathHash);
+    if (entry == nullptr)
+    {
+        entry = find(0);
+    }
+    if (entry == nullptr)
+    {
+        // More resources than entries, the first one loses its validators
+        entry = &entries[0];
+    }
+
+    // Flash writes only when the server actually changed something
+    if (memcmp(entry, &updated, sizeof(updated)) != 0)
+    {
+        *entry = updated;
+        save();
+    }
+}
+
+void HTTPCache::forget(const char *path)
+{
+    if (!loaded)
+    {
+        load();
+    }
+
+    HTTPValidators *entry = find(hashPath(path));
+    if (entry != nullptr)
+    {
+        memset(entry, 0, sizeof(*entry));
+        save();
+    }
+}
+
+void HTTPCache::countRequest(bool conditional)
+{
+    if (conditional)
+    {
+        stats.conditionalRequests++;
+    }
+}
+
+void HTTPCache::countFullResponse(size_t bytes)
+{
+    stats.fullResponses++;
+    stats.bytesStreamed += bytes;
+}
+
+// =============================================
+// BUFFER SINK
+// =============================================
+
+BufferSink::BufferSink(char *buffer, size_t capacity) : buffer(buffer), capacity(capacity), length(0), overflowed(false)
+{
+    if (capacity > 0)
+    {
+        buffer[0] = '\0';
+    }
+}
+
+size_t BufferSink::write(uint8_t value)
+{
+    return write(&value, 1);
+}
+
+size_t BufferSink::write(const uint8_t *data, size_t size)
+{
+    // One byte is kept for the terminator
+    size_t room = capacity > length + 1 ? capacity - length - 1 : 0;
+    size_t taken = size < room ? size : room;
+    memcpy(buffer + length, data, taken);
+    length += taken;
+    if (capacity > 0)
+    {
+        buffer[length] = '\0';
+    }
+    if (taken < size)
+    {
+        overflowed = true;
+    }
+    return taken;
+}
@@ -0,0 +1,87 @@
+#ifndef HTTP_CACHE_H
+#define HTTP_CACHE_H
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include "config.h"
+
+#define HTTP_CACHE_ETAG_LENGTH  64      // Longer ETags are not cached
+#define HTTP_CACHE_DATE_LENGTH  32      // "Wed, 21 Oct 2015 07:28:00 GMT" + terminator
+
+// Validators the server sent with the copy of one resource on the device
+struct HTTPValidators {
+    uint32_t pathHash;                  // 0 marks a free entry
+    char etag[HTTP_CACHE_ETAG_LENGTH];
+    char lastModified[HTTP_CACHE_DATE_LENGTH];
+};
+
+struct HTTPCacheStats {
+    uint32_t conditionalRequests;       // Sent with If-None-Match/If-Modified-Since
+    uint32_t notModified;               // Answered 304, headers only
+    uint32_t fullResponses;
+    uint32_t bytesStreamed;             // Bodies written to caller sinks
+};
+
+// =============================================
+// HTTP CACHE CLASS
+// =============================================
+
+// ETag/Last-Modified per resource path, the bodies themselves stay with
+// whoever owns the resource (roster partition, capability flags). The
+// table is loaded from NVS on first use and written back when it changes.
+class HTTPCache {
+public:
+    HTTPCache();
+
+    // Validators for path, nullptr when nothing usable is stored
+    const HTTPValidators* get(const char* path);
+    // Remember the validators of a freshly received copy
+    void update(const char* path, const String& etag, const String& lastModified);
+    // The local copy is gone, the next fetch must be unconditional
+    void forget(const char* path);
+
+    void countRequest(bool conditional);
+    void countNotModified() { stats.notModified++; }
+    void countFullResponse(size_t bytes);
+    const HTTPCacheStats& getStats() const { return stats; }
+
+private:
+    HTTPValidators entries[HTTP_CACHE_ENTRIES];
+    HTTPCacheStats stats;
+    bool loaded;
+
+    void load();
+    void save();
+    HTTPValidators* find(uint32_t hash);
+    static uint32_t hashPath(const char* path);
+};
+
+// =============================================
+// BUFFER SINK
+// =============================================
+
+// Stream over a caller-provided buffer for small bodies, so they can be
+// streamed with HTTPClient::writeToStream() without a String on the heap.
+// The contents are always NUL-terminated; writes past the end are refused.
+class BufferSink : public Stream {
+private:
+    char* buffer;
+    size_t capacity;
+    size_t length;
+    bool overflowed;
+
+public:
+    BufferSink(char* buffer, size_t capacity);
+
+    size_t write(uint8_t value) override;
+    size_t write(const uint8_t* data, size_t size) override;
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+
+    const char* c_str() const { return buffer; }
+    size_t getLength() const { return length; }
+    bool isOverflowed() const { return overflowed; }
+};
+
+#endif // HTTP_CACHE_H
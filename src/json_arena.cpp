@@ -0,0 +1,101 @@
+#include "json_arena.h"
+
+// =============================================
+// CLASS IMPLEMENTATION
+// =============================================
+
+JsonArena::JsonArena() : used(0), liveBlocks(0)
+{
+    memset(&stats, 0, sizeof(stats));
+}
+
+bool JsonArena::owns(const void *pointer) const
+{
+    const uint8_t *p = (const uint8_t *)pointer;
+    return p >= buffer && p < buffer + sizeof(buffer);
+}
+
+void *JsonArena::allocate(size_t size)
+{
+    size_t needed = sizeof(Header) + roundUp(size);
+    if (needed > sizeof(buffer) - used)
+    {
+        stats.heapFallbacks++;
+        return malloc(size);
+    }
+
+    Header *header = (Header *)(buffer + used);
+    header->size = roundUp(size);
+    used += needed;
+    liveBlocks++;
+    if (used > stats.peakBytes)
+    {
+        stats.peakBytes = used;
+    }
+    return header + 1;
+}
+
+void JsonArena::deallocate(void *pointer)
+{
+    if (pointer == nullptr)
+    {
+        return;
+    }
+    if (!owns(pointer))
+    {
+        free(pointer);
+        return;
+    }
+
+    Header *header = (Header *)pointer - 1;
+    if ((uint8_t *)pointer + header->size == buffer + used)
+    {
+        // The newest block, its space can be handed out again right away
+        used = (uint8_t *)header - buffer;
+    }
+    if (--liveBlocks == 0)
+    {
+        used = 0;
+    }
+}
+
+void *JsonArena::reallocate(void *pointer, size_t newSize)
+{
+    if (pointer == nullptr)
+    {
+        return allocate(newSize);
+    }
+    if (!owns(pointer))
+    {
+        return realloc(pointer, newSize);
+    }
+
+    Header *header = (Header *)pointer - 1;
+    size_t offset = (uint8_t *)pointer - buffer;
+    bool newest = offset + header->size == used;
+
+    // ArduinoJson grows strings and shrinks its pools in place, which works
+    // as long as the block is the newest one
+    if (newest && offset + roundUp(newSize) <= sizeof(buffer))
+    {
+        header->size = roundUp(newSize);
+        used = offset + header->size;
+        if (used > stats.peakBytes)
+        {
+            stats.peakBytes = used;
+        }
+        return pointer;
+    }
+    if (newSize <= header->size)
+    {
+        return pointer;
+    }
+
+    void *moved = allocate(newSize);
+    if (moved != nullptr)
+    {
+        memcpy(moved, pointer, header->size);
+        deallocate(pointer);
+    }
+    return moved;
+}
@@ -0,0 +1,50 @@
+#ifndef JSON_ARENA_H
+#define JSON_ARENA_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "config.h"
+
+struct JsonArenaStats {
+    uint32_t peakBytes;             // Most of the arena ever in use at once
+    uint32_t heapFallbacks;         // Allocations that did not fit and went to the heap
+};
+
+// =============================================
+// JSON ARENA CLASS
+// =============================================
+
+// ArduinoJson allocator over a fixed buffer, for the short-lived documents
+// that parse server responses:
+//   JsonDocument doc(&arena);
+// Blocks are handed out bump-style; freeing the last block gives its space
+// back, and the whole arena is free again once every block is released,
+// i.e. when the document goes out of scope. Requests that do not fit fall
+// back to the heap. Not thread-safe, one arena per task.
+class JsonArena : public ArduinoJson::Allocator {
+public:
+    JsonArena();
+
+    void* allocate(size_t size) override;
+    void deallocate(void* pointer) override;
+    void* reallocate(void* pointer, size_t newSize) override;
+
+    const JsonArenaStats& getStats() const { return stats; }
+
+private:
+    // Each block starts with its size; 8 bytes keeps 64-bit values aligned
+    struct Header {
+        uint32_t size;
+        uint32_t reserved;
+    };
+
+    alignas(8) uint8_t buffer[JSON_ARENA_SIZE];
+    size_t used;
+    uint16_t liveBlocks;
+    JsonArenaStats stats;
+
+    bool owns(const void* pointer) const;
+    static size_t roundUp(size_t size) { return (size + 7) & ~(size_t)7; }
+};
+
+#endif // JSON_ARENA_H
@@ -16,16 +16,21 @@
 #include "buzzer_feedback.h"
 #include "ota_handler.h"
 #include "simple_led.h"
+#include "activity_journal.h"
+#include "roster_store.h"
+#include "alloc_counter.h"
 
 // =============================================
 // GLOBAL VARIABLES
 // =============================================
 
-// State machine variables
-SystemState currentState = IDLE;
+// State machine variables. currentState is also read by serverSyncTask on
+// the other core, so every access must go to memory.
+volatile SystemState currentState = IDLE;
 unsigned long stateStartTime = 0;
 
 // Card data variables
+CardSession cardSession;
 String currentCardUID = "";
 String santriNama = "";
 String santriInduk = "";
@@ -38,6 +43,7 @@ unsigned long lastActivity = 0;
 TaskHandle_t stateMachineTaskHandle = NULL;
 TaskHandle_t inputTaskHandle = NULL;
 TaskHandle_t displayTaskHandle = NULL;
+TaskHandle_t syncTaskHandle = NULL;
 
 // RTOS Queues and Semaphores
 QueueHandle_t inputQueue;
@@ -49,6 +55,15 @@ bool waitingInputStarted = false;
 bool waitingAutoSelectShown = false;
 unsigned long waitingLastStateTransition = 0;
 int institution = INSTITUTION_1; // Global institution variable
+bool validationDeferred = false;  // Admitted offline, the server checks the journaled log
+volatile bool journalUploadFailing = false;
+
+// Async request the state machine is waiting on, 0 for none
+enum PendingRequest { PENDING_VALIDATION, PENDING_COMBINED_TAP, PENDING_ACTIVITY_LOG, PENDING_PREFETCH };
+uint16_t pendingRequestId = 0;
+PendingRequest pendingRequest = PENDING_VALIDATION;
+uint16_t prefetchRequestId = 0;     // UID lookup sent before the card read, not awaited yet
+unsigned long prefetchWaitStart = 0;
 
 // Performance timing variables
 unsigned long cardDetectionTime = 0;
@@ -60,6 +75,7 @@ unsigned long userInputStartTime = 0;
 unsigned long userInputEndTime = 0;
 unsigned long apiLoggingStartTime = 0;
 unsigned long apiLoggingEndTime = 0;
+uint32_t tapAllocationsStart = 0;   // Heap allocations of the state machine task at card detection
 
 // Input event structure
 typedef struct
@@ -86,6 +102,8 @@ void loop();
 void stateMachineTask(void *parameter);
 void inputTask(void *parameter);
 void displayTask(void *parameter);
+void serverSyncTask(void *parameter);
+void syncRosterIfDue();
 
 // State Machine Functions
 void handleStateMachine();
@@ -98,6 +116,16 @@ void handleDisplayResultState();
 void handleOTAProgressState();
 void handleOTACompleteState();
 void handleErrorState();
+void startOnlineValidation();
+bool startCombinedTap();
+void completeCombinedTap(TapResult result, bool retryable);
+void startValidation();
+void completeValidation(bool valid, bool retryable);
+void handleValidationEvent();
+void completeSubmission(bool logged, bool queued);
+bool takePendingResult(AsyncHTTPEvent& event);
+bool admitOffline(const char* reason);
+bool isServerBacklogged();
 bool initializeSystem();
 void performSystemCheck();
 void resetCardData();
@@ -228,41 +256,77 @@ void handleStateMachine()
 void handleIdleState()
 {
     static unsigned long lastCardCheck = 0;
+    bool cardDetected = false;
 
     // LED off in idle state
     setLEDState(LED_OFF);
 
-    // Check for card periodically
-    if (millis() - lastCardCheck >= 500)
-    { // Check every 500ms
-        if (nfcHandler.isCardPresent())
+    // Only drops finished async slots, connecting is left to serverSyncTask
+    apiClient.closeIdleAsyncConnections();
+    display.setOfflineMode(apiClient.isCircuitOpen());
+
+    if (nfcHandler.isAwaitingRemoval())
+    {
+        // Last card may still be on the reader, it is not a new tap until
+        // it has been taken away
+        if (millis() - lastCardCheck >= NFC_PRESENCE_INTERVAL)
+        {
+            nfcHandler.updatePresence();
+            lastCardCheck = millis();
+        }
+    }
+    else if (nfcHandler.usesIrqDetection())
+    {
+        // PN532 searches on its own, the IRQ wakes this task when it answers
+        if (nfcHandler.isDetectionPending())
         {
-            buzzer.playClick();
-            currentCardUID = nfcHandler.getCardUID();
+            cardDetected = nfcHandler.readDetectedCard(cardSession);
+        }
 
-            if (currentCardUID.length() > 0)
-            {
-                cardDetectionTime = millis();
-                Serial.println("========================================");
-                Serial.println("PERFORMANCE ANALYSIS STARTED");
-                Serial.println("========================================");
-                Serial.print("Card detected: ");
-                Serial.println(currentCardUID);
-                Serial.print("Detection time: ");
-                Serial.print(cardDetectionTime);
-                Serial.println(" ms");
-                setLEDState(LED_CARD_READING);
-                transitionToState(VALIDATING);
-            }
+        if (!cardDetected && !nfcHandler.isDetectionArmed() && !nfcHandler.isDetectionPending())
+        {
+            nfcHandler.armCardDetection();
         }
+    }
+    else if (millis() - lastCardCheck >= NFC_POLL_INTERVAL)
+    {
+        // One InListPassiveTarget round trip gives UID, type and first block
+        cardDetected = nfcHandler.detectCard(cardSession);
         lastCardCheck = millis();
     }
+
+    if (cardDetected)
+    {
+        buzzer.playClick();
+        currentCardUID = cardSession.uidHex;
+        cardDetectionTime = millis();
+        tapAllocationsStart = allocationCounter.getCount();
+        Serial.println("========================================");
+        Serial.println("PERFORMANCE ANALYSIS STARTED");
+        Serial.println("========================================");
+        Serial.print("Card detected: ");
+        Serial.println(currentCardUID);
+        Serial.print("Detection time: ");
+        Serial.print(cardDetectionTime);
+        Serial.println(" ms");
+        setLEDState(LED_CARD_READING);
+        nfcHandler.rememberCard(cardSession);
+        transitionToState(VALIDATING);
+        nfcHandler.recordDetectionLatency();
+    }
 }
 
 void handleValidatingState()
 {
     static bool validationStarted = false;
 
+    // Request already out, the state machine only looks for its answer
+    if (pendingRequestId != 0)
+    {
+        handleValidationEvent();
+        return;
+    }
+
     // Reset validationStarted when entering this state
     if (millis() - stateStartTime < 100) {
         validationStarted = false;
@@ -274,11 +338,19 @@ void handleValidatingState()
         buzzer.playProcessingPulse();
         validationStarted = true;
         stateStartTime = millis();
+
+        // The UID is all the server needs to look the card up, so its
+        // answer can be on the way while the sectors are read
+        prefetchRequestId = 0;
+        if (apiClient.isPrefetchEnabled() && apiClient.isAsyncAvailable())
+        {
+            prefetchRequestId = apiClient.startPrefetch(cardSession);
+        }
     }
 
     // First, try to read santri data from card
     nfcReadStartTime = millis();
-    if (nfcHandler.readSantriData(santriNama, santriInduk))
+    if (nfcHandler.readSantriData(cardSession, santriNama, santriInduk))
     {
         nfcReadEndTime = millis();
         Serial.print("Santri data read - Nama: ");
@@ -289,36 +361,52 @@ void handleValidatingState()
         Serial.print(nfcReadEndTime - nfcReadStartTime);
         Serial.println(" ms");
 
-        // Now validate the card using santri ID from JSON data
-        apiValidationStartTime = millis();
-        if (apiClient.validateSantriCard(currentCardUID, santriInduk))
+        // Cards in the local roster need no validation round trip, the
+        // server then only receives the log
+        unsigned long rosterStartUs = micros();
+        RosterLookup rosterResult = rosterStore.lookup(cardSession.uid, cardSession.uidLength, santriInduk);
+        if (rosterResult != ROSTER_NOT_FOUND)
         {
-            apiValidationEndTime = millis();
-            Serial.print("API validation time: ");
-            Serial.print(apiValidationEndTime - apiValidationStartTime);
-            Serial.println(" ms");
-            
-            // Card is valid
-            Serial.println("Card validation successful - transitioning to WAITING_FOR_INPUT");
+            apiValidationStartTime = apiValidationEndTime = millis();
+            Serial.printf("Roster lookup: %s in %lu us\n", rosterResult == ROSTER_VALID ? "valid" : "invalid",
+                          micros() - rosterStartUs);
+            if (rosterResult == ROSTER_VALID)
+            {
+                display.showUserInfo(santriNama);
+                transitionToState(WAITING_FOR_INPUT);
+            }
+            else
+            {
+                Serial.println("Card validation failed");
+                setLEDState(LED_CARD_INVALID);
+                display.showInvalidCard();
+                buzzer.playError();
+                transitionToState(DISPLAY_RESULT);
+            }
+            return;
+        }
 
-            // Simplified transition without LED/buzzer to isolate the issue
-            display.showUserInfo(santriNama);
-            transitionToState(WAITING_FOR_INPUT);
+        // Earlier logs are stuck on the server, don't make this tap wait on
+        // it too. A card the cache already knows to be invalid stays out.
+        if (JOURNAL_ADMIT_OFFLINE && isServerBacklogged() &&
+            apiClient.lookupValidationCache(cardSession.uidHex, santriInduk) != ValidationCache::CACHE_INVALID &&
+            admitOffline("activity journal not drained"))
+        {
+            return;
         }
-        else
+
+        // The UID lookup has a head start, wait for it instead of sending
+        // another request
+        if (prefetchRequestId != 0)
         {
-            apiValidationEndTime = millis();
-            Serial.print("API validation time: ");
-            Serial.print(apiValidationEndTime - apiValidationStartTime);
-            Serial.println(" ms");
-            
-            // Card validation failed
-            Serial.println("Card validation failed");
-            setLEDState(LED_CARD_INVALID);
-            display.showInvalidCard();
-            buzzer.playError();
-            transitionToState(DISPLAY_RESULT);
+            pendingRequestId = prefetchRequestId;
+            pendingRequest = PENDING_PREFETCH;
+            prefetchRequestId = 0;
+            prefetchWaitStart = millis();
+            return;
         }
+
+        startOnlineValidation();
     }
     else
     {
@@ -330,6 +418,257 @@ void handleValidatingState()
     }
 }
 
+void startOnlineValidation()
+{
+    // One round trip for validate + log when the server offers it
+    if (apiClient.isCombinedTapEnabled() && startCombinedTap())
+    {
+        return;
+    }
+
+    startValidation();
+}
+
+// Validates and logs the tap in a single request using the current toggle
+// switch position. Returns false when the server turned out not to support
+// it or is known to be down, so the caller takes the separate path.
+bool startCombinedTap()
+{
+    if (apiClient.isCircuitOpen())
+    {
+        return false;
+    }
+
+    institution = inputHandler.getCurrentInstitution();
+    inputHandler.setActiveInstitution(institution);
+
+    apiValidationStartTime = millis();
+    if (apiClient.isAsyncAvailable())
+    {
+        if (apiClient.lookupValidationCache(cardSession.uidHex, santriInduk) == ValidationCache::CACHE_INVALID)
+        {
+            apiValidationEndTime = millis();
+            completeCombinedTap(TAP_INVALID, false);
+            return true;
+        }
+
+        pendingRequestId = apiClient.startCombinedTap(cardSession, santriInduk, institution);
+        if (pendingRequestId != 0)
+        {
+            pendingRequest = PENDING_COMBINED_TAP;
+            return true;
+        }
+    }
+
+    TapResult result = apiClient.validateAndLogSantri(cardSession, santriInduk, institution);
+    apiValidationEndTime = millis();
+    if (result == TAP_UNSUPPORTED)
+    {
+        return false;
+    }
+    completeCombinedTap(result, apiClient.isRetryableFailure());
+    return true;
+}
+
+void completeCombinedTap(TapResult result, bool retryable)
+{
+    // Valid but not logged, or no answer at all: keep the log for the uploader
+    bool queued = false;
+    if (result == TAP_LOG_FAILED ||
+        (result == TAP_REQUEST_FAILED && JOURNAL_ADMIT_OFFLINE && retryable))
+    {
+        queued = activityJournal.append(santriInduk, institution);
+    }
+
+    // No separate input or logging step, keep the report consistent
+    userInputStartTime = userInputEndTime = apiValidationEndTime;
+    apiLoggingStartTime = apiLoggingEndTime = apiValidationEndTime;
+
+    Serial.print("API validate + log time: ");
+    Serial.print(apiValidationEndTime - apiValidationStartTime);
+    Serial.println(" ms");
+
+    if (result == TAP_LOGGED || queued)
+    {
+        display.showUserInfo(santriNama);
+        printPerformanceReport();
+
+        setLEDState(LED_CARD_VALID);
+        display.showSuccess();
+        buzzer.playSuccess();
+        if (queued)
+        {
+            Serial.printf("Activity queued in journal (%lu pending)\n", (unsigned long)activityJournal.getDepth());
+        }
+        else
+        {
+            Serial.printf("Activity logged successfully for INSTITUTION_%d\n", institution);
+        }
+    }
+    else if (result == TAP_INVALID)
+    {
+        Serial.println("Card validation failed");
+        setLEDState(LED_CARD_INVALID);
+        display.showInvalidCard();
+        buzzer.playError();
+    }
+    else
+    {
+        Serial.println("Failed to validate and log activity");
+        setLEDState(LED_SERVER_ERROR);
+        display.showServerError();
+        buzzer.playError();
+    }
+
+    transitionToState(DISPLAY_RESULT);
+}
+
+// Validates the card online; through the async client when it can take
+// the request, so the state machine keeps running until the answer comes
+void startValidation()
+{
+    apiValidationStartTime = millis();
+    if (apiClient.isCircuitOpen())
+    {
+        // Server known to be down: only the cache can answer, otherwise
+        // straight to the offline path without waiting for a timeout
+        ValidationCache::Lookup cached = apiClient.lookupValidationCache(cardSession.uidHex, santriInduk);
+        completeValidation(cached == ValidationCache::CACHE_VALID, cached == ValidationCache::CACHE_MISS);
+        return;
+    }
+
+    if (apiClient.isAsyncAvailable())
+    {
+        ValidationCache::Lookup cached = apiClient.lookupValidationCache(cardSession.uidHex, santriInduk);
+        if (cached != ValidationCache::CACHE_MISS)
+        {
+            completeValidation(cached == ValidationCache::CACHE_VALID, false);
+            return;
+        }
+
+        pendingRequestId = apiClient.startValidation(cardSession, santriInduk);
+        if (pendingRequestId != 0)
+        {
+            pendingRequest = PENDING_VALIDATION;
+            return;
+        }
+        Serial.println("No free async request slot, validating with a blocking request");
+    }
+
+    bool valid = apiClient.validateSantriCard(cardSession, santriInduk);
+    completeValidation(valid, !valid && apiClient.isRetryableFailure());
+}
+
+void completeValidation(bool valid, bool retryable)
+{
+    apiValidationEndTime = millis();
+    Serial.print("API validation time: ");
+    Serial.print(apiValidationEndTime - apiValidationStartTime);
+    Serial.println(" ms");
+
+    if (valid)
+    {
+        // Card is valid
+        Serial.println("Card validation successful - transitioning to WAITING_FOR_INPUT");
+        display.showUserInfo(santriNama);
+        transitionToState(WAITING_FOR_INPUT);
+        return;
+    }
+
+    if (JOURNAL_ADMIT_OFFLINE && retryable && admitOffline("server unreachable"))
+    {
+        return;
+    }
+
+    // Card validation failed
+    Serial.println("Card validation failed");
+    setLEDState(LED_CARD_INVALID);
+    display.showInvalidCard();
+    buzzer.playError();
+    transitionToState(DISPLAY_RESULT);
+}
+
+// Answer to the async validation or combined tap request, if it is in
+void handleValidationEvent()
+{
+    AsyncHTTPEvent event;
+    if (!takePendingResult(event))
+    {
+        return;
+    }
+
+    if (pendingRequest == PENDING_PREFETCH)
+    {
+        // A usable answer is now in the validation cache, which the regular
+        // path consults before sending anything
+        ValidationCache::Lookup verdict = apiClient.finishPrefetch(event, cardSession, santriInduk);
+        Serial.printf("UID prefetch %s, waited %lu ms after the card read\n",
+                      verdict == ValidationCache::CACHE_MISS ? "not usable" : "used", millis() - prefetchWaitStart);
+        startOnlineValidation();
+        return;
+    }
+
+    if (pendingRequest == PENDING_COMBINED_TAP)
+    {
+        apiValidationEndTime = millis();
+        TapResult result = apiClient.finishCombinedTap(event, cardSession, santriInduk);
+        if (result != TAP_UNSUPPORTED)
+        {
+            completeCombinedTap(result, APIClient::isRetryableStatus(event.status));
+            return;
+        }
+        startValidation();
+        return;
+    }
+
+    bool valid = false;
+    bool answered = apiClient.finishValidation(event, cardSession, santriInduk, valid);
+    completeValidation(valid, !answered && APIClient::isRetryableStatus(event.status));
+}
+
+// Event for pendingRequestId; events of abandoned requests are dropped
+bool takePendingResult(AsyncHTTPEvent& event)
+{
+    while (apiClient.pollAsync(event))
+    {
+        if (event.requestId == pendingRequestId)
+        {
+            pendingRequestId = 0;
+            return true;
+        }
+        Serial.printf("Dropping async response %u, nobody waits for it\n", event.requestId);
+    }
+    return false;
+}
+
+// Pending logs alone are no sign of trouble: they pile up during a rush
+// because the uploader only runs while idle. Only a server that is down
+// or keeps failing the uploads counts.
+bool isServerBacklogged()
+{
+    if (activityJournal.getDepth() == 0)
+    {
+        return false;
+    }
+    return apiClient.isCircuitOpen() || journalUploadFailing;
+}
+
+// Lets the tap through on the card data alone; the log goes to the journal
+// in SUBMITTING and the server judges it when the uploader sends it.
+bool admitOffline(const char* reason)
+{
+    if (!activityJournal.isReady())
+    {
+        return false;
+    }
+
+    Serial.printf("Admitting without online validation (%s)\n", reason);
+    validationDeferred = true;
+    display.showUserInfo(santriNama);
+    transitionToState(WAITING_FOR_INPUT);
+    return true;
+}
+
 void handleWaitingForInputState()
 {
     if (!waitingInputStarted)
@@ -388,6 +727,23 @@ void handleSubmittingState()
 {
     static bool submissionStarted = false;
 
+    // Log request already out, wait for its answer
+    if (pendingRequestId != 0)
+    {
+        AsyncHTTPEvent event;
+        if (takePendingResult(event))
+        {
+            bool logged = apiClient.finishActivityLog(event);
+            bool queued = false;
+            if (!logged && APIClient::isRetryableStatus(event.status))
+            {
+                queued = activityJournal.append(santriInduk, institution);
+            }
+            completeSubmission(logged, queued);
+        }
+        return;
+    }
+
     // Reset submissionStarted when entering this state
     if (millis() - stateStartTime < 100) {
         submissionStarted = false;
@@ -401,31 +757,66 @@ void handleSubmittingState()
         stateStartTime = millis();
     }
 
-    // Submit activity using the institution selected by user
+    // Submit activity using the institution selected by user. Logs go
+    // straight to the journal while it still holds older ones, so the
+    // server receives them in tap order, always when they are uploaded in
+    // batches, and while the server is known to be down.
     apiLoggingStartTime = millis();
-    if (apiClient.logSantriActivity(santriInduk, institution))
+    bool logged = false;
+    bool queued = false;
+    if (validationDeferred || activityJournal.getDepth() > 0 || apiClient.isBatchLogEnabled() ||
+        apiClient.isCircuitOpen())
+    {
+        queued = activityJournal.append(santriInduk, institution);
+    }
+    if (!queued && !validationDeferred)
+    {
+        if (apiClient.isAsyncAvailable())
+        {
+            pendingRequestId = apiClient.startActivityLog(santriInduk, institution);
+            if (pendingRequestId != 0)
+            {
+                pendingRequest = PENDING_ACTIVITY_LOG;
+                return;
+            }
+        }
+
+        logged = apiClient.logSantriActivity(santriInduk, institution);
+        if (!logged && apiClient.isRetryableFailure())
+        {
+            queued = activityJournal.append(santriInduk, institution);
+        }
+    }
+    completeSubmission(logged, queued);
+}
+
+void completeSubmission(bool logged, bool queued)
+{
+    apiLoggingEndTime = millis();
+    Serial.print("API logging time: ");
+    Serial.print(apiLoggingEndTime - apiLoggingStartTime);
+    Serial.println(" ms");
+
+    if (logged || queued)
     {
-        apiLoggingEndTime = millis();
-        Serial.print("API logging time: ");
-        Serial.print(apiLoggingEndTime - apiLoggingStartTime);
-        Serial.println(" ms");
-        
         // Print complete performance report
         printPerformanceReport();
-        
+
         setLEDState(LED_CARD_VALID);
         display.showSuccess();
         buzzer.playSuccess();
-        Serial.println("Activity logged successfully");
+        if (queued)
+        {
+            Serial.printf("Activity queued in journal (%lu pending)\n", (unsigned long)activityJournal.getDepth());
+        }
+        else
+        {
+            Serial.println("Activity logged successfully");
+        }
         transitionToState(DISPLAY_RESULT);
     }
     else
     {
-        apiLoggingEndTime = millis();
-        Serial.print("API logging time: ");
-        Serial.print(apiLoggingEndTime - apiLoggingStartTime);
-        Serial.println(" ms");
-        
         setLEDState(LED_SERVER_ERROR);
         display.showServerError();
         buzzer.playError();
@@ -534,6 +925,10 @@ void transitionToState(SystemState newState)
     stateStartTime = millis();
     lastActivity = millis();
 
+    // A request still in flight belongs to the state being left
+    pendingRequestId = 0;
+    prefetchRequestId = 0;
+
     // Reset variables for specific states
     if (newState == WAITING_FOR_INPUT)
     {
@@ -594,9 +989,21 @@ bool initializeSystem()
         return false;
     }
 
+    // Activity journal (non-fatal, without it failed logs are not kept)
+    if (!activityJournal.begin())
+    {
+        Serial.println("Activity journal initialization failed!");
+    }
+
+    // Local roster (non-fatal, without it every card is validated online)
+    rosterStore.begin();
+
     // Initialize API client with dynamic URL
     apiClient.begin(configManager.getApiBaseUrl());
 
+    // Tap timestamps for journaled logs, SNTP syncs once WiFi is up
+    configTime(0, 0, NTP_SERVER);
+
     // Initialize WiFi
     if (!wifiHandler.begin())
     {
@@ -662,9 +1069,11 @@ void performSystemCheck()
 
 void resetCardData()
 {
+    cardSession.clear();
     currentCardUID = "";
     santriNama = "";
     santriInduk = "";
+    validationDeferred = false;
     resetPerformanceTimers();
 }
 
@@ -716,6 +1125,24 @@ void createTasks()
         0                   // Core (Core 0)
     );
 
+    // Lowest priority: only uploads logs and fetches the roster while
+    // nothing else needs the CPU
+    xTaskCreatePinnedToCore(
+        serverSyncTask,     // Task function
+        "ServerSync",       // Task name
+        6144,               // Stack size (HTTP request)
+        NULL,               // Parameters
+        0,                  // Priority
+        &syncTaskHandle,    // Task handle
+        0                   // Core (Core 0)
+    );
+
+    // Card IRQs and async HTTP responses wake the state machine task directly
+    nfcHandler.setDetectionTask(stateMachineTaskHandle);
+    apiClient.setAsyncNotifyTask(stateMachineTaskHandle);
+    allocationCounter.trackTask(stateMachineTaskHandle);
+    allocationCounter.trackTask(syncTaskHandle, ALLOC_TASK_SERVER_SYNC);
+
     Serial.println("RTOS tasks created successfully!");
 }
 
@@ -739,6 +1166,12 @@ void deleteTasks()
         displayTaskHandle = NULL;
     }
 
+    if (syncTaskHandle != NULL)
+    {
+        vTaskDelete(syncTaskHandle);
+        syncTaskHandle = NULL;
+    }
+
     if (inputQueue != NULL)
     {
         vQueueDelete(inputQueue);
@@ -767,8 +1200,8 @@ void stateMachineTask(void *parameter)
         // Handle state machine
         handleStateMachine();
 
-        // Small delay to prevent excessive CPU usage
-        vTaskDelay(pdMS_TO_TICKS(50));
+        // Sleep until the next tick or until a card IRQ notifies us
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(50));
     }
 }
 
@@ -824,6 +1257,166 @@ void displayTask(void *parameter)
     }
 }
 
+void serverSyncTask(void *parameter)
+{
+    Serial.println("Server Sync Task started");
+
+    static JournalRecord batch[API_BATCH_MAX_RECORDS];
+    static uint8_t results[API_BATCH_MAX_RECORDS];
+    unsigned long retryDelay = JOURNAL_RETRY_MIN;
+    unsigned long pendingSince = 0;
+
+    while (true)
+    {
+        // DNS is only ever waited on here, taps connect to the cached address
+        apiClient.refreshDNS();
+
+        // Probes servers with an open circuit and measures idle standbys,
+        // then keeps the API connection open so the next tap skips the
+        // TCP handshake
+        if (currentState == IDLE)
+        {
+            apiClient.probeServers();
+            apiClient.maintainConnection();
+        }
+
+        // While every circuit is open only the probes talk to the servers
+        if (apiClient.isCircuitOpen())
+        {
+            vTaskDelay(pdMS_TO_TICKS(JOURNAL_UPLOAD_INTERVAL));
+            continue;
+        }
+
+        syncRosterIfDue();
+
+        uint32_t depth = activityJournal.getDepth();
+        if (depth == 0)
+        {
+            pendingSince = 0;
+            journalUploadFailing = false;
+        }
+        else if (pendingSince == 0)
+        {
+            pendingSince = millis();
+        }
+
+        // Stay out of the way of a tap being processed. Checked before every
+        // request, so a tap waits for at most the one already in flight.
+        if (depth == 0 || currentState != IDLE || apiClient.isTapWaiting() || !apiClient.isReady())
+        {
+            vTaskDelay(pdMS_TO_TICKS(JOURNAL_UPLOAD_INTERVAL));
+            continue;
+        }
+
+        bool failed = false;
+        if (apiClient.isBatchLogEnabled())
+        {
+            // Like Nagle: hold small batches back until the window closes.
+            // pendingSince stays set while a backlog drains, so the rest
+            // goes out right away.
+            if (depth < API_BATCH_MAX_RECORDS && millis() - pendingSince < API_BATCH_WINDOW)
+            {
+                vTaskDelay(pdMS_TO_TICKS(JOURNAL_UPLOAD_INTERVAL));
+                continue;
+            }
+
+            uint8_t count = activityJournal.peekBatch(batch, API_BATCH_MAX_RECORDS);
+            bool confirmed = count > 0 && apiClient.logSantriActivityBatch(batch, count, results);
+            if (confirmed)
+            {
+                uint8_t accepted = 0;
+                uint8_t rejected = 0;
+                for (uint8_t i = 0; i < count; i++)
+                {
+                    if (results[i] == BATCH_ACCEPTED)
+                    {
+                        activityJournal.acknowledge(batch[i].seq);
+                        accepted++;
+                    }
+                    else if (results[i] == BATCH_REJECTED)
+                    {
+                        activityJournal.reject(batch[i].seq);
+                        rejected++;
+                    }
+                }
+                Serial.printf("Journal batch: %u accepted, %u rejected, %u to retry, %lu pending\n", accepted,
+                              rejected, count - accepted - rejected, (unsigned long)activityJournal.getDepth());
+                failed = accepted + rejected < count;
+            }
+            else
+            {
+                // Endpoint just turned out to be missing: retry at once, one by one
+                failed = apiClient.isBatchLogEnabled();
+            }
+        }
+        else
+        {
+            JournalRecord &record = batch[0];
+            if (!activityJournal.peek(record))
+            {
+                vTaskDelay(pdMS_TO_TICKS(JOURNAL_UPLOAD_INTERVAL));
+                continue;
+            }
+
+            if (apiClient.logSantriActivity(String(record.memberID), record.institution, record.tappedAt))
+            {
+                activityJournal.acknowledge(record.seq);
+                Serial.printf("Journal record %lu uploaded, %lu pending\n", (unsigned long)record.seq,
+                              (unsigned long)activityJournal.getDepth());
+            }
+            else if (!apiClient.isRetryableFailure())
+            {
+                // Refused by the server, it would block every record behind it
+                activityJournal.reject(record.seq);
+                Serial.printf("Journal record %lu rejected by server (HTTP %d), skipped\n",
+                              (unsigned long)record.seq, apiClient.getLastResponseCode());
+            }
+            else
+            {
+                failed = true;
+            }
+        }
+
+        journalUploadFailing = failed;
+        if (failed)
+        {
+            Serial.printf("Journal upload incomplete, retrying in %lu ms\n", retryDelay);
+            vTaskDelay(pdMS_TO_TICKS(retryDelay));
+            retryDelay = min(retryDelay * 2, (unsigned long)JOURNAL_RETRY_MAX);
+        }
+        else
+        {
+            retryDelay = JOURNAL_RETRY_MIN;
+        }
+    }
+}
+
+// Runs on the sync task: refreshes the roster every ROSTER_REFRESH_INTERVAL
+// while idle, sooner after a failed attempt
+void syncRosterIfDue()
+{
+    static unsigned long lastAttempt = 0;
+    static bool lastSucceeded = false;
+
+    if (!rosterStore.isAvailable() || currentState != IDLE || apiClient.isTapWaiting() || !apiClient.isReady())
+    {
+        return;
+    }
+
+    unsigned long interval = lastSucceeded ? ROSTER_REFRESH_INTERVAL : ROSTER_RETRY_INTERVAL;
+    if (lastAttempt != 0 && millis() - lastAttempt < interval)
+    {
+        return;
+    }
+
+    lastAttempt = millis();
+    lastSucceeded = apiClient.downloadRoster();
+    if (!lastSucceeded)
+    {
+        Serial.printf("Roster refresh failed: %s\n", apiClient.getLastError().c_str());
+    }
+}
+
 // =============================================
 // PERFORMANCE ANALYSIS FUNCTIONS
 // =============================================
@@ -842,7 +1435,107 @@ void printPerformanceReport()
     
     Serial.print("NFC read time: ");
     Serial.print(nfcReadEndTime - nfcReadStartTime);
-    Serial.println(" ms");
+    Serial.print(" ms over ");
+    Serial.println(nfcHandler.getTransportName());
+
+    const NFCReadStats& readStats = nfcHandler.getLastReadStats();
+    if (readStats.blocksRead > 0) {
+        Serial.printf("NFC blocks: %u read, %u sector auths, avg %lu us/block, max %lu us/block\n",
+                      readStats.blocksRead, readStats.sectorsAuthenticated,
+                      (readStats.totalUs - readStats.authUs) / readStats.blocksRead,
+                      readStats.maxBlockUs);
+    }
+
+    if (nfcHandler.getDetectionLatencyCount() > 0) {
+        Serial.printf("Detection latency (IRQ -> VALIDATING): last %lu us, avg %lu us, max %lu us (%lu taps)\n",
+                      nfcHandler.getLastDetectionLatencyUs(),
+                      nfcHandler.getAvgDetectionLatencyUs(),
+                      nfcHandler.getMaxDetectionLatencyUs(),
+                      (unsigned long)nfcHandler.getDetectionLatencyCount());
+    }
+
+    Serial.printf("Duplicate taps suppressed (card left on reader): %lu\n",
+                  (unsigned long)nfcHandler.getSuppressedDuplicates());
+
+    if (rosterStore.isLoaded()) {
+        Serial.printf("Roster: v%lu, %lu entries, %lu of %lu lookups answered locally\n",
+                      (unsigned long)rosterStore.getVersion(), (unsigned long)rosterStore.getEntryCount(),
+                      (unsigned long)rosterStore.getLocalAnswerCount(), (unsigned long)rosterStore.getLookupCount());
+    }
+
+    const ValidationCache& cache = apiClient.getValidationCache();
+    Serial.printf("Validation cache: %u%% hits (%lu hits, %lu misses), %u entries, %lu evictions\n",
+                  cache.getHitRatePercent(), (unsigned long)cache.getStats().hits,
+                  (unsigned long)cache.getStats().misses, cache.getEntryCount(),
+                  (unsigned long)cache.getStats().evictions);
+
+    const AsyncHTTPStats& asyncStats = apiClient.getAsyncStats();
+    Serial.printf("Async HTTP: %lu started, %lu completed, %lu failed, %lu timed out, %lu on reused connections "
+                  "(%lu resent after a stale close), max %u in flight\n",
+                  (unsigned long)asyncStats.started, (unsigned long)asyncStats.completed,
+                  (unsigned long)asyncStats.failed, (unsigned long)asyncStats.timeouts,
+                  (unsigned long)asyncStats.reusedConnections, (unsigned long)asyncStats.staleRetries,
+                  asyncStats.maxInFlight);
+
+    if (allocationCounter.isActive()) {
+        Serial.printf("Heap allocations: %lu this tap, %lu building the last async request, "
+                      "%lu building the last batch upload\n",
+                      (unsigned long)(allocationCounter.getCount() - tapAllocationsStart),
+                      (unsigned long)apiClient.getLastRequestAllocations(),
+                      (unsigned long)apiClient.getLastBatchAllocations());
+    } else {
+        Serial.println("Heap allocations: n/a (malloc wrappers not linked)");
+    }
+
+    const JsonArenaStats& jsonStats = apiClient.getJsonArenaStats();
+    const JsonArenaStats& asyncJsonStats = apiClient.getAsyncJsonArenaStats();
+    Serial.printf("JSON arenas: peak %lu/%lu bytes (blocking/async) of %u, %lu heap fallbacks\n",
+                  (unsigned long)jsonStats.peakBytes, (unsigned long)asyncJsonStats.peakBytes, JSON_ARENA_SIZE,
+                  (unsigned long)(jsonStats.heapFallbacks + asyncJsonStats.heapFallbacks));
+
+    for (uint8_t i = 0; i < apiClient.getEndpointCount(); i++) {
+        const APIEndpoint& endpoint = apiClient.getEndpoint(i);
+        const ServerHealth& health = endpoint.health;
+        Serial.printf("Server health %s%s: circuit %s, RTT %lu ms (+/- %lu, p95 %lu), %u%% errors, %lu requests, "
+                      "%lu trips, %lu requests failed fast, %lu probes\n",
+                      endpoint.host.c_str(), i == apiClient.getActiveEndpoint() ? " (active)" : "",
+                      health.isOpen() ? "open" : "closed", health.getSmoothedRTT(), health.getRTTVariance(),
+                      health.getP95(), health.getErrorRatePercent(), (unsigned long)endpoint.requests,
+                      (unsigned long)health.getStats().trips, (unsigned long)health.getStats().failedFast,
+                      (unsigned long)health.getStats().probes);
+
+        const DNSCacheStats& dnsStats = endpoint.dns.getStats();
+        Serial.printf("DNS %s: %lu hits, %lu misses, %lu resolutions (last %lu us, max %lu us), %lu failed\n",
+                      endpoint.host.c_str(), (unsigned long)dnsStats.hits, (unsigned long)dnsStats.misses,
+                      (unsigned long)dnsStats.resolutions, dnsStats.lastResolveUs, dnsStats.maxResolveUs,
+                      (unsigned long)dnsStats.failures);
+    }
+    Serial.printf("Next request timeout: %lu ms\n", apiClient.getRequestTimeout());
+
+    if (apiClient.getEndpointCount() > 1) {
+        const FailoverStats& failover = apiClient.getFailoverStats();
+        Serial.printf("Failover: %lu server switches, %lu requests resent, %lu hedged (%lu answered first)\n",
+                      (unsigned long)failover.switches, (unsigned long)failover.failovers,
+                      (unsigned long)failover.hedges, (unsigned long)failover.hedgeWins);
+    }
+
+    const PrefetchStats& prefetchStats = apiClient.getPrefetchStats();
+    if (prefetchStats.started > 0) {
+        Serial.printf("UID prefetch: %lu sent, %lu used, %lu induk mismatches, %lu without answer\n",
+                      (unsigned long)prefetchStats.started, (unsigned long)prefetchStats.used,
+                      (unsigned long)prefetchStats.mismatched, (unsigned long)prefetchStats.failed);
+    }
+
+    const HTTPCacheStats& httpStats = apiClient.getHTTPCacheStats();
+    Serial.printf("Conditional GET: %lu of %lu answered 304, %lu full bodies (%lu bytes streamed)\n",
+                  (unsigned long)httpStats.notModified, (unsigned long)httpStats.conditionalRequests,
+                  (unsigned long)httpStats.fullResponses, (unsigned long)httpStats.bytesStreamed);
+
+    const JournalStats& journalStats = activityJournal.getStats();
+    Serial.printf("Activity journal: %lu pending, %lu queued, %lu uploaded, %lu dropped, %lu rejected\n",
+                  (unsigned long)activityJournal.getDepth(), (unsigned long)journalStats.appended,
+                  (unsigned long)journalStats.uploaded, (unsigned long)journalStats.dropped,
+                  (unsigned long)journalStats.rejected);
     
     Serial.print("API validation time: ");
     Serial.print(apiValidationEndTime - apiValidationStartTime);
@@ -855,6 +1548,24 @@ void printPerformanceReport()
     Serial.print("API logging time: ");
     Serial.print(apiLoggingEndTime - apiLoggingStartTime);
     Serial.println(" ms");
+
+    const APIConnectionStats& connStats = apiClient.getConnectionStats();
+    Serial.printf("API connection: %u%% reused (%lu/%lu requests), %lu connects (%lu warm-up), %lu stale retries\n",
+                  apiClient.getReuseRatePercent(),
+                  (unsigned long)connStats.reusedRequests, (unsigned long)connStats.requests,
+                  (unsigned long)connStats.connects, (unsigned long)connStats.warmUps,
+                  (unsigned long)connStats.staleRetries);
+    if (connStats.requests > 0) {
+        Serial.printf("API connect time per request: last %lu us, avg %lu us, max connect %lu us\n",
+                      connStats.lastConnectUs, connStats.totalConnectUs / connStats.requests,
+                      connStats.maxConnectUs);
+    }
+    if (apiClient.isSecure() && connStats.tlsHandshakes > 0) {
+        Serial.printf("TLS handshakes: %lu, last %lu us, avg %lu us, max %lu us, %lu certificates rejected\n",
+                      (unsigned long)connStats.tlsHandshakes, connStats.lastHandshakeUs,
+                      connStats.totalHandshakeUs / connStats.tlsHandshakes, connStats.maxHandshakeUs,
+                      (unsigned long)connStats.tlsRejected);
+    }
     
     // Calculate percentages
     if (totalTime > 0) {
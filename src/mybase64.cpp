@@ -4,10 +4,28 @@ const char b64_alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
                             "abcdefghijklmnopqrstuvwxyz"
                             "0123456789+/";
 
+/* -1 = not base64, -2 = '=' padding */
+const int8_t b64_reverse[256] = {
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 62, -1, -1, -1, 63,
+  52, 53, 54, 55, 56, 57, 58, 59, 60, 61, -1, -1, -1, -2, -1, -1,
+  -1,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+  15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, -1,
+  -1, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+  41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
 /* 'Private' declarations */
 inline void a3_to_a4(unsigned char *a4, unsigned char *a3);
-inline void a4_to_a3(unsigned char *a3, unsigned char *a4);
-inline unsigned char b64_lookup(char c);
 
 int b64_encode(char *output, char *input, int inputLen) {
   int i = 0, j = 0;
@@ -48,51 +66,71 @@ int b64_encode(char *output, char *input, int inputLen) {
 
 
 int b64_decode(char *output, char *input, int inputLen) {
-  int i = 0, j = 0;
+  int decLen = b64_decode_into((uint8_t *)output, b64_dec_max_len(inputLen), input, inputLen);
+  output[decLen < 0 ? 0 : decLen] = '\0';
+  return decLen;
+}
+
+int b64_decode_into(uint8_t *output, int outputSize, const char *input, int inputLen) {
+  const unsigned char *in = (const unsigned char *)input;
   int decLen = 0;
-  unsigned char a3[3];
-  unsigned char a4[4];
+  int i = 0;
 
+  /* Padding ends the data, anything after it is ignored */
+  int dataLen = 0;
+  while (dataLen < inputLen && in[dataLen] != '=') {
+    dataLen++;
+  }
 
-  while (inputLen--) {
-    if (*input == '=') {
-      break;
+  /* Whole quads: four table lookups, one sign test for all of them */
+  for (; i + 4 <= dataLen; i += 4) {
+    int v0 = b64_reverse[in[i]];
+    int v1 = b64_reverse[in[i + 1]];
+    int v2 = b64_reverse[in[i + 2]];
+    int v3 = b64_reverse[in[i + 3]];
+    if ((v0 | v1 | v2 | v3) < 0) {
+      return -1;
     }
-
-    a4[i++] = *(input++);
-    if (i == 4) {
-      for (i = 0; i < 4; i++) {
-        a4[i] = b64_lookup(a4[i]);
-      }
-
-      a4_to_a3(a3, a4);
-
-      for (i = 0; i < 3; i++) {
-        output[decLen++] = a3[i];
-      }
-      i = 0;
+    if (decLen + 3 > outputSize) {
+      return -1;
     }
+
+    uint32_t triple = ((uint32_t)v0 << 18) | ((uint32_t)v1 << 12) | ((uint32_t)v2 << 6) | (uint32_t)v3;
+    output[decLen++] = (uint8_t)(triple >> 16);
+    output[decLen++] = (uint8_t)(triple >> 8);
+    output[decLen++] = (uint8_t)triple;
   }
 
-  if (i) {
-    for (j = i; j < 4; j++) {
-      a4[j] = '\0';
+  /* Tail: 2 digits -> 1 byte, 3 digits -> 2 bytes, 1 digit is invalid */
+  int rest = dataLen - i;
+  if (rest == 1) {
+    return -1;
+  }
+  if (rest > 1) {
+    uint32_t triple = 0;
+    for (int j = 0; j < rest; j++) {
+      int v = b64_reverse[in[i + j]];
+      if (v < 0) {
+        return -1;
+      }
+      triple |= (uint32_t)v << (18 - 6 * j);
     }
-
-    for (j = 0; j < 4; j++) {
-      a4[j] = b64_lookup(a4[j]);
+    if (decLen + rest - 1 > outputSize) {
+      return -1;
     }
-
-    a4_to_a3(a3, a4);
-
-    for (j = 0; j < i - 1; j++) {
-      output[decLen++] = a3[j];
+    output[decLen++] = (uint8_t)(triple >> 16);
+    if (rest == 3) {
+      output[decLen++] = (uint8_t)(triple >> 8);
     }
   }
-  output[decLen] = '\0';
+
   return decLen;
 }
 
+int b64_dec_max_len(int inputLen) {
+  return ((inputLen + 3) / 4) * 3;
+}
+
 int b64_enc_len(int plainLen) {
   int n = plainLen;
   return (n + 2 - ((n + 2) % 3)) / 3 * 4;
@@ -114,20 +152,3 @@ inline void a3_to_a4(unsigned char *a4, unsigned char *a3) {
   a4[2] = ((a3[1] & 0x0f) << 2) + ((a3[2] & 0xc0) >> 6);
   a4[3] = (a3[2] & 0x3f);
 }
-
-inline void a4_to_a3(unsigned char *a3, unsigned char *a4) {
-  a3[0] = (a4[0] << 2) + ((a4[1] & 0x30) >> 4);
-  a3[1] = ((a4[1] & 0xf) << 4) + ((a4[2] & 0x3c) >> 2);
-  a3[2] = ((a4[2] & 0x3) << 6) + a4[3];
-}
-
-inline unsigned char b64_lookup(char c) {
-  int i;
-  for (i = 0; i < 64; i++) {
-    if (b64_alphabet[i] == c) {
-      return i;
-    }
-  }
-
-  return -1;
-}
\ No newline at end of file
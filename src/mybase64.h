@@ -1,6 +1,8 @@
-#ifndef __BASE64_UTILS_H
+#ifndef _BASE64_UTILS_H
 #define _BASE64_UTILS_H
 
+#include <stdint.h>
+
 /* b64_alphabet:
  * 		Description: Base64 alphabet table, a mapping between integers
  * 					 and base64 digits
@@ -8,6 +10,22 @@
  */
 extern const char b64_alphabet[];
 
+/* b64_reverse:
+ * 		Description: Reverse lookup table indexed by input byte. Holds the
+ * 					 6-bit value of a base64 digit, B64_INVALID for bytes
+ * 					 outside the alphabet and B64_PAD for '='
+ */
+#define B64_INVALID (-1)
+#define B64_PAD     (-2)
+extern const int8_t b64_reverse[256];
+
+/* b64_value:
+ * 		Description: Value of a single base64 digit, negative if c is not one
+ */
+static inline int b64_value(unsigned char c) {
+  return b64_reverse[c];
+}
+
 /* b64_encode:
  * 		Description:
  * 			Encode a string of characters as base64
@@ -34,14 +52,38 @@ int b64_encode(char *output, char *input, int inputLen);
  * 				   stores the base64 string to be decoded
  * 			inputLen: the length of the input buffer, in bytes
  * 		Return value:
- * 			Returns the length of the decoded string
+ * 			Returns the length of the decoded string, or -1 if input
+ * 			contains a byte outside the base64 alphabet
  * 		Requirements:
- * 			1. output must not be null or empty
+ * 			1. output must hold b64_dec_max_len(inputLen) + 1 bytes
  * 			2. input must not be null
  * 			3. inputLen must be greater than or equal to 0
  */
 int b64_decode(char *output, char *input, int inputLen);
 
+/* b64_decode_into:
+ * 		Description:
+ * 			Decode base64 into a caller-provided buffer of known size
+ * 		Parameters:
+ * 			output: the output buffer, not NUL-terminated
+ * 			outputSize: capacity of output in bytes
+ * 			input: the base64 string to be decoded
+ * 			inputLen: the length of the input, in bytes
+ * 		Return value:
+ * 			Returns the number of decoded bytes, or -1 if input is not
+ * 			valid base64 or does not fit in outputSize
+ * 		Requirements:
+ * 			outputSize >= b64_dec_max_len(inputLen) always suffices
+ */
+int b64_decode_into(uint8_t *output, int outputSize, const char *input, int inputLen);
+
+/* b64_dec_max_len:
+ * 		Description:
+ * 			Upper bound of the decoded size of inputLen base64 characters,
+ * 			without looking at the input
+ */
+int b64_dec_max_len(int inputLen);
+
 /* b64_enc_len:
  * 		Description:
  * 			Returns the length of a base64 encoded string whose decoded
@@ -1,20 +1,77 @@
 #include "nfc_handler.h"
-#include "mybase64.h"
-#include <ArduinoJson.h>
 
 // =============================================
 // CLASS IMPLEMENTATION
 // =============================================
 
-#define BLOCK_SIZE 16
+#define BLOCK_SIZE NFC_BLOCK_SIZE
 #define LONG_TLV_SIZE 4
 #define SHORT_TLV_SIZE 2
+#define NDEF_FIRST_BLOCK 4
+#define NDEF_FIRST_PAGE 4           // Type 2 tags: CC in page 3, TLVs from page 4
+#define PAGES_PER_BLOCK (BLOCK_SIZE / NTAG_PAGE_SIZE)
 
-NFCHandler::NFCHandler(uint8_t ssPin, uint8_t clkPin, uint8_t misoPin, uint8_t mosiPin) : isInitialized(false), lastCardCheck(0), cardTimeout(0)
+// Key A of the sectors holding the santri NDEF message
+static uint8_t ndefSectorKey[6] = {0xD3, 0xF7, 0xD3, 0xF7, 0xD3, 0xF7};
+
+volatile bool NFCHandler::detectionArmed = false;
+volatile bool NFCHandler::detectionPending = false;
+volatile unsigned long NFCHandler::irqTimestampUs = 0;
+TaskHandle_t NFCHandler::notifyTask = NULL;
+
+NFCHandler::NFCHandler(uint8_t ssPin, uint8_t clkPin, uint8_t misoPin, uint8_t mosiPin)
+    : NFCHandler(createTransport(ssPin, clkPin, misoPin, mosiPin),
+                 NFC_USE_IRQ_DETECTION && NFC_TRANSPORT != NFC_TRANSPORT_EMULATOR, PN532_RESET_PIN)
 {
+}
 
-    // Initialize PN532 with I2C
-    nfc = new Adafruit_PN532(I2C_SDA_PIN, I2C_SCL_PIN);
+NFCHandler::NFCHandler(PN532Transport *transport, bool irqDetection, int8_t resetPin) : transport(transport), isInitialized(false), lastCardCheck(0), cardTimeout(0),
+    irqDetection(irqDetection), lastDetectionLatencyUs(0), maxDetectionLatencyUs(0), totalDetectionLatencyUs(0), detectionLatencyCount(0),
+    presenceUidLength(0), missedPresenceChecks(0), duplicateCounted(false), suppressedDuplicates(0)
+{
+    memset(&readStats, 0, sizeof(readStats));
+    memset(presenceUid, 0, sizeof(presenceUid));
+    nfc = new PN532Driver(transport, resetPin);
+}
+
+PN532Transport *NFCHandler::createTransport(uint8_t ssPin, uint8_t clkPin, uint8_t misoPin, uint8_t mosiPin)
+{
+#if NFC_USE_IRQ_DETECTION && NFC_TRANSPORT != NFC_TRANSPORT_EMULATOR
+    int8_t irqPin = PN532_IRQ_PIN;
+#else
+    int8_t irqPin = -1;
+#endif
+
+#if NFC_TRANSPORT == NFC_TRANSPORT_SPI
+    // PN532 on its own SPI host, away from the LCD on I2C
+    return new PN532SPITransport(new SPIClass(HSPI), ssPin, clkPin, misoPin, mosiPin, PN532_SPI_CLOCK, irqPin);
+#elif NFC_TRANSPORT == NFC_TRANSPORT_EMULATOR
+    // Software PN532 holding a sample santri card, for timing the read
+    // path without a reader
+    PN532EmulatorTransport *emulator = new PN532EmulatorTransport();
+    emulator->setFrameLatencyUs(NFC_EMULATOR_FRAME_LATENCY_US);
+#if NFC_EMULATOR_CLASSIC_CARD
+    static const uint8_t emulatorUid[] = {0xDE, 0xAD, 0xBE, 0xEF};
+#else
+    static const uint8_t emulatorUid[] = {0x04, 0x5A, 0x1C, 0x72, 0x9B, 0x61, 0x80};
+#endif
+    emulator->createSantriCard(NFC_EMULATOR_CLASSIC_CARD, emulatorUid, sizeof(emulatorUid),
+                               "eyJpbmR1ayI6IjE5NjYwMCIsIm5hbWEiOiJJbmdncml0IERlc3RpYW5hIE51Z3JhZW5pIn0=");
+    emulator->insertCard();
+    (void)irqPin;
+    (void)ssPin;
+    (void)clkPin;
+    (void)misoPin;
+    (void)mosiPin;
+    return emulator;
+#else
+    // Initialize PN532 with I2C, the SPI pins are not wired
+    (void)ssPin;
+    (void)clkPin;
+    (void)misoPin;
+    (void)mosiPin;
+    return new PN532I2CTransport(&Wire, irqPin);
+#endif
 }
 
 bool NFCHandler::begin()
@@ -50,10 +107,32 @@ void NFCHandler::initPN532()
             Serial.print((versiondata >> 16) & 0xFF, DEC);
             Serial.print('.');
             Serial.println((versiondata >> 8) & 0xFF, DEC);
+            Serial.print("Transport: ");
+            Serial.println(transport->getName());
 
             // Configure board to read RFID tags
             nfc->SAMConfig();
 
+            // GetFirmwareVersion and SAMConfiguration both answered, a wired
+            // IRQ line has signalled by now
+            if (irqDetection && !transport->hasWorkingIrq())
+            {
+                irqDetection = false;
+                Serial.printf("PN532 IRQ on GPIO%d never went low, polling for cards instead\n", PN532_IRQ_PIN);
+            }
+            if (irqDetection)
+            {
+                pinMode(PN532_IRQ_PIN, INPUT_PULLUP);
+                attachInterrupt(digitalPinToInterrupt(PN532_IRQ_PIN), onPN532Irq, FALLING);
+                Serial.printf("PN532 IRQ detection on GPIO%d\n", PN532_IRQ_PIN);
+            }
+            else
+            {
+                // Polls must come back on an empty reader, an armed IRQ
+                // detection instead waits for the card on the chip
+                nfc->setPassiveActivationRetries(NFC_PASSIVE_ACTIVATION_RETRIES);
+            }
+
             isInitialized = true;
             lastError = "";
         }
@@ -72,108 +151,572 @@ void NFCHandler::initPN532()
 
 bool NFCHandler::isCardPresent()
 {
-    uint8_t success;
-    uint8_t uid[] = {0, 0, 0, 0, 0, 0, 0}; // Buffer to store the returned UID
-    uint8_t uidLength;                     // Length of the UID (4 or 7 bytes depending on ISO14443A card type)
+    PN532Target target;
+    return nfc->readPassiveTarget(target, NFC_DETECT_TIMEOUT);
+}
 
-    success = nfc->readPassiveTargetID(PN532_MIFARE_ISO14443A, uid, &uidLength);
+String NFCHandler::getCardUID()
+{
+    PN532Target target;
 
-    if (success)
+    if (nfc->readPassiveTarget(target, NFC_DETECT_TIMEOUT))
     {
-        return true;
+        return bytesToHexString(target.uid, target.uidLength);
     }
 
-    return false;
+    return ""; // No card present
 }
 
-String NFCHandler::getCardUID()
+bool NFCHandler::detectCard(CardSession &session)
 {
-    uint8_t success;
-    uint8_t uid[] = {0, 0, 0, 0, 0, 0, 0};
-    uint8_t uidLength;
+    PN532Target target;
+    session.clear();
 
-    success = nfc->readPassiveTargetID(PN532_MIFARE_ISO14443A, uid, &uidLength);
+    if (!nfc->readPassiveTarget(target, NFC_DETECT_TIMEOUT))
+    {
+        return false;
+    }
+
+    return completeDetection(session, target);
+}
 
-    if (success)
+bool NFCHandler::completeDetection(CardSession &session, const PN532Target &target)
+{
+    if (target.uidLength > sizeof(session.uid))
     {
-        return bytesToHexString(uid, uidLength);
+        lastError = "Unsupported UID length";
+        return false;
     }
 
-    return ""; // No card present
+    memcpy(session.uid, target.uid, target.uidLength);
+    session.uidLength = target.uidLength;
+    session.sensRes = target.sensRes;
+    session.sak = target.sak;
+    session.uidHex = bytesToHexString(session.uid, session.uidLength);
+    session.cardType = cardTypeFromSak(target.sak);
+
+    // Keep the first NDEF block so the reader can decode the TLV header
+    // without another round trip
+    readFirstBlock(session);
+
+    return true;
+}
+
+bool NFCHandler::readFirstBlock(CardSession &session)
+{
+    switch (session.cardType)
+    {
+    case NFC_CARD_CLASSIC_1K:
+    case NFC_CARD_CLASSIC_4K:
+        // Authenticate the NDEF sector once, the rest of the sector follows
+        if (nfc->mifareClassicAuthenticateBlock(session.uid, session.uidLength, NDEF_FIRST_BLOCK, 0, ndefSectorKey))
+        {
+            session.authenticatedSector = classicSectorOf(NDEF_FIRST_BLOCK);
+            session.firstBlockValid = nfc->mifareClassicReadBlock(NDEF_FIRST_BLOCK, session.firstBlock);
+        }
+        break;
+
+    case NFC_CARD_ULTRALIGHT:
+        // One READ returns pages 4-7, the same 16 bytes as Classic block 4
+        session.firstBlockValid = nfc->ntagRead(NDEF_FIRST_PAGE, session.firstBlock);
+        break;
+
+    default:
+        break;
+    }
+
+    return session.firstBlockValid;
+}
+
+bool NFCHandler::reselectCard(CardSession &session)
+{
+    // A NAK or failed authentication sends the card back to IDLE, select
+    // it again before reading on
+    PN532Target target;
+    session.authenticatedSector = -1;
+    if (!nfc->readPassiveTarget(target, PN532_DEFAULT_TIMEOUT))
+    {
+        return false;
+    }
+    return target.uidLength == session.uidLength && memcmp(target.uid, session.uid, session.uidLength) == 0;
+}
+
+uint8_t NFCHandler::cardTypeFromSak(uint8_t sak)
+{
+    switch (sak)
+    {
+    case 0x00:
+        return NFC_CARD_ULTRALIGHT;
+    case 0x08:
+    case 0x09:  // Mini, same layout as the first sectors of a 1K
+    case 0x28:
+    case 0x88:
+        return NFC_CARD_CLASSIC_1K;
+    case 0x18:
+    case 0x38:
+        return NFC_CARD_CLASSIC_4K;
+    case 0x20:
+        return NFC_CARD_DESFIRE;
+    default:
+        return NFC_CARD_UNKNOWN;
+    }
+}
+
+int NFCHandler::maxMessageBlocks(uint8_t cardType)
+{
+    // SAK does not tell Type 2 tags apart, so those get the largest NTAG
+    switch (cardType)
+    {
+    case NFC_CARD_CLASSIC_1K:
+        return NFC_CLASSIC_1K_DATA_BLOCKS;
+    case NFC_CARD_CLASSIC_4K:
+        return NFC_CLASSIC_4K_DATA_BLOCKS;
+    case NFC_CARD_ULTRALIGHT:
+        return NFC_TYPE2_DATA_BLOCKS;
+    default:
+        return 0;
+    }
+}
+
+void IRAM_ATTR NFCHandler::onPN532Irq()
+{
+    // IRQ also pulses for every ACK/response during reads, only the
+    // response to the armed InListPassiveTarget counts as a detection
+    if (!detectionArmed)
+    {
+        return;
+    }
+
+    detectionArmed = false;
+    detectionPending = true;
+    irqTimestampUs = micros();
+
+    if (notifyTask != NULL)
+    {
+        BaseType_t higherPriorityTaskWoken = pdFALSE;
+        vTaskNotifyGiveFromISR(notifyTask, &higherPriorityTaskWoken);
+        portYIELD_FROM_ISR(higherPriorityTaskWoken);
+    }
+}
+
+void NFCHandler::setDetectionTask(TaskHandle_t task)
+{
+    notifyTask = task;
+}
+
+bool NFCHandler::armCardDetection()
+{
+    if (!isInitialized)
+    {
+        return false;
+    }
+
+    detectionPending = false;
+    if (!nfc->startPassiveTargetDetection())
+    {
+        lastError = "Failed to arm card detection";
+        return false;
+    }
+    detectionArmed = true;
+
+    // A card already in the field may have answered before we armed
+    if (detectionArmed && digitalRead(PN532_IRQ_PIN) == LOW)
+    {
+        detectionArmed = false;
+        detectionPending = true;
+        irqTimestampUs = micros();
+    }
+
+    return true;
+}
+
+bool NFCHandler::readDetectedCard(CardSession &session)
+{
+    PN532Target target;
+    detectionPending = false;
+    session.clear();
+
+    if (!nfc->readDetectedPassiveTarget(target))
+    {
+        return false;
+    }
+
+    return completeDetection(session, target);
+}
+
+void NFCHandler::recordDetectionLatency()
+{
+    if (irqTimestampUs == 0)
+    {
+        return;
+    }
+
+    lastDetectionLatencyUs = micros() - irqTimestampUs;
+    irqTimestampUs = 0;
+
+    totalDetectionLatencyUs += lastDetectionLatencyUs;
+    detectionLatencyCount++;
+    if (lastDetectionLatencyUs > maxDetectionLatencyUs)
+    {
+        maxDetectionLatencyUs = lastDetectionLatencyUs;
+    }
+}
+
+unsigned long NFCHandler::getAvgDetectionLatencyUs() const
+{
+    if (detectionLatencyCount == 0)
+    {
+        return 0;
+    }
+    return totalDetectionLatencyUs / detectionLatencyCount;
+}
+
+void NFCHandler::rememberCard(const CardSession &session)
+{
+    memcpy(presenceUid, session.uid, session.uidLength);
+    presenceUidLength = session.uidLength;
+    missedPresenceChecks = 0;
+    duplicateCounted = false;
+}
+
+bool NFCHandler::updatePresence()
+{
+    if (presenceUidLength == 0)
+    {
+        return true;
+    }
+
+    // Only InListPassiveTarget with a short timeout, no authentication and
+    // no block reads while the card just sits on the reader
+    PN532Target target;
+    bool present = nfc->readPassiveTarget(target, NFC_PRESENCE_TIMEOUT) &&
+                   target.uidLength == presenceUidLength &&
+                   memcmp(target.uid, presenceUid, presenceUidLength) == 0;
+
+    if (present)
+    {
+        missedPresenceChecks = 0;
+        if (!duplicateCounted)
+        {
+            // Once per stay, this is the tap the old flow would have repeated
+            duplicateCounted = true;
+            suppressedDuplicates++;
+            Serial.println("Card still on reader, waiting for removal");
+        }
+        return false;
+    }
+
+    if (++missedPresenceChecks < NFC_REMOVAL_CONFIRM_CHECKS)
+    {
+        return false;
+    }
+
+    Serial.println("Card removed: " + bytesToHexString(presenceUid, presenceUidLength));
+    presenceUidLength = 0;
+    missedPresenceChecks = 0;
+    return true;
 }
 
 bool NFCHandler::readSantriData(String &nama, String &induk)
+{
+    CardSession session;
+    if (!detectCard(session))
+    {
+        lastError = "No card present";
+        return false;
+    }
+    return readSantriData(session, nama, induk);
+}
+
+bool NFCHandler::readSantriData(CardSession &session, String &nama, String &induk)
 {
     int messageNfcStartIndex = 0;
     int messageNfcLength = 0;
-    uint8_t key[6] = {0xD3, 0xF7, 0xD3, 0xF7, 0xD3, 0xF7};
-    uint8_t uid[] = {0, 0, 0, 0, 0, 0, 0};
-    uint8_t uidLength;
-    uint8_t data[BLOCK_SIZE];
-    uint8_t currentBlock = 4;
-    uint8_t success = nfc->readPassiveTargetID(PN532_MIFARE_ISO14443A, uid, &uidLength);
-    Serial.println("success: readPassiveTargetID" + String(success));
+    bool success;
 
-    if (!success)
+    if (!session.isValid())
     {
         lastError = "No card present";
         return false;
     }
 
-    if (uidLength == 4)
+    // Backend is picked from SAK at detection
+    bool classic = session.cardType == NFC_CARD_CLASSIC_1K || session.cardType == NFC_CARD_CLASSIC_4K;
+    if (!classic && session.cardType != NFC_CARD_ULTRALIGHT)
     {
-        Serial.println("Card UID: " + bytesToHexString(uid, uidLength));
+        lastError = "Unsupported card type";
+        return false;
+    }
 
-        success = nfc->mifareclassic_AuthenticateBlock(uid, uidLength, currentBlock, 0, key);
-        Serial.println("success: mifareclassic_AuthenticateBlock" + String(success));
-        success = nfc->mifareclassic_ReadDataBlock(currentBlock, data);
-        Serial.println("success: mifareclassic_AuthenticateBlock" + String(success));
+    Serial.println("Card UID: " + session.uidHex + " (" + getCardTypeString(session.cardType) + ")");
 
-        Serial.println("data: " + bytesToHexString(data, BLOCK_SIZE));
-        Serial.println("uidLength: " + String(uidLength));
-        Serial.println("messageNfcLength: " + String(messageNfcLength));
-        Serial.println("currentBlock: " + String(currentBlock));
-        Serial.println("messageNfcStartIndex: " + String(messageNfcStartIndex));
-        if (!decodeTlv(data, messageNfcLength, messageNfcStartIndex))
+    // Detection could not read the first block, retry it once here. The
+    // failed authentication or NAK halted the card, select it again first
+    if (!session.firstBlockValid)
+    {
+        if (!reselectCard(session))
         {
-            Serial.println("error");
+            lastError = "Card lost before NDEF block";
             return false;
         }
-        int indexMessage = 0;
-        int bufferSize = getBufferSize(messageNfcLength);
-        byte buffer[bufferSize];
-        while (indexMessage < bufferSize)
+        if (!readFirstBlock(session))
         {
-            if (nfc->mifareclassic_IsFirstBlock(currentBlock))
+            lastError = "Failed to read NDEF block";
+            return false;
+        }
+    }
+
+    if (!decodeTlv(session.firstBlock, messageNfcLength, messageNfcStartIndex))
+    {
+        Serial.println("error");
+        return false;
+    }
+    Serial.println("messageNfcLength: " + String(messageNfcLength));
+    Serial.println("messageNfcStartIndex: " + String(messageNfcStartIndex));
+
+    // Only read as far as the TLV says the message goes
+    int bufferSize = getBufferSize(messageNfcLength);
+    int bytesNeeded = messageNfcStartIndex + messageNfcLength;
+    if (bufferSize < bytesNeeded)
+    {
+        bufferSize = ((bytesNeeded + BLOCK_SIZE - 1) / BLOCK_SIZE) * BLOCK_SIZE;
+    }
+    if (bufferSize > maxMessageBlocks(session.cardType) * BLOCK_SIZE)
+    {
+        lastError = "NDEF message too large";
+        Serial.println("NDEF message too large: " + String(messageNfcLength));
+        return false;
+    }
+
+    if (classic)
+    {
+        success = readClassicSectors(session, bufferSize / BLOCK_SIZE);
+    }
+    else
+    {
+        success = readUltralightPages(session, bufferSize / BLOCK_SIZE);
+    }
+    printReadStats();
+    if (!success)
+    {
+        return false;
+    }
+
+    nama = payloadParser.getNama();
+    induk = payloadParser.getInduk();
+    return true;
+}
+
+bool NFCHandler::feedPayloadBlock(const uint8_t *block)
+{
+    CardPayloadParser::Result result = payloadParser.feed(block, BLOCK_SIZE);
+    if (result == CardPayloadParser::PARSE_ERROR)
+    {
+        lastError = payloadParser.getError();
+        Serial.print(F("Card payload parse failed: "));
+        Serial.println(lastError);
+    }
+    return result != CardPayloadParser::PARSE_MORE;
+}
+
+bool NFCHandler::readClassicSectors(CardSession &session, int blockCount)
+{
+    uint8_t block[BLOCK_SIZE];
+    uint8_t currentBlock = NDEF_FIRST_BLOCK + 1;
+    int blocksDone = 1;
+
+    memset(&readStats, 0, sizeof(readStats));
+    unsigned long readStart = micros();
+
+    // Each block goes straight into the parser, which ends the read as
+    // soon as "induk" and "nama" are complete
+    payloadParser.reset();
+    bool parseFinished = feedPayloadBlock(session.firstBlock);
+
+    while (!parseFinished && blocksDone < blockCount)
+    {
+        uint8_t sector = classicSectorOf(currentBlock);
+        uint8_t trailerBlock = classicTrailerOf(sector);
+
+        // A 4K card keeps its second directory in sector 16, the message
+        // continues in sector 17
+        if (session.cardType == NFC_CARD_CLASSIC_4K && sector == NFC_CLASSIC_MAD2_SECTOR)
+        {
+            currentBlock = trailerBlock + 1;
+            continue;
+        }
+
+        // One authentication per sector
+        if (session.authenticatedSector != sector)
+        {
+            unsigned long authStart = micros();
+            if (!nfc->mifareClassicAuthenticateBlock(session.uid, session.uidLength, currentBlock, 0, ndefSectorKey))
             {
-                success = nfc->mifareclassic_AuthenticateBlock(uid, uidLength, currentBlock, 0, key);
-                if (!success)
-                {
-                    Serial.print(F("Error. Block Authentication failed for "));
-                    Serial.println(currentBlock);
-                    // TODO error handling
-                    return false;
-                }
+                Serial.print(F("Error. Block Authentication failed for "));
+                Serial.println(currentBlock);
+                lastError = "Block authentication failed";
+                return false;
             }
-            // read the data
-            success = nfc->mifareclassic_ReadDataBlock(currentBlock, &buffer[indexMessage]);
-            if (!success)
+            readStats.authUs += micros() - authStart;
+            readStats.sectorsAuthenticated++;
+            session.authenticatedSector = sector;
+        }
+
+        // Then the data blocks of the sector back to back, no logging
+        // between exchanges so the PN532 is never kept waiting on us
+        for (; currentBlock < trailerBlock && blocksDone < blockCount && !parseFinished; currentBlock++)
+        {
+            unsigned long blockStart = micros();
+            if (!nfc->mifareClassicReadBlock(currentBlock, block))
             {
+                lastError = "Failed to read data block";
                 return false;
             }
+            recordExchange(micros() - blockStart, 1);
+            blocksDone++;
+
+            parseFinished = feedPayloadBlock(block);
+        }
 
-            indexMessage += BLOCK_SIZE;
+        // Skip the trailer block
+        if (currentBlock == trailerBlock)
+        {
             currentBlock++;
-            // skip the trailer block
-            if (nfc->mifareclassic_IsTrailerBlock(currentBlock))
+        }
+    }
+
+    readStats.totalUs = micros() - readStart;
+    readStats.blocksSkipped = blockCount - blocksDone;
+
+    if (payloadParser.getResult() != CardPayloadParser::PARSE_DONE)
+    {
+        if (payloadParser.getResult() == CardPayloadParser::PARSE_MORE)
+        {
+            lastError = "Incomplete card payload";
+        }
+        return false;
+    }
+    return true;
+}
+
+bool NFCHandler::readUltralightPages(CardSession &session, int blockCount)
+{
+    uint8_t pages[NFC_FAST_READ_PAGES * NTAG_PAGE_SIZE];
+    uint8_t currentPage = NDEF_FIRST_PAGE + PAGES_PER_BLOCK;
+    int blocksDone = 1;
+
+    memset(&readStats, 0, sizeof(readStats));
+    unsigned long readStart = micros();
+
+    // No authentication on Type 2 tags, the pages come in as few exchanges
+    // as FAST_READ allows and are parsed 16 bytes at a time like Classic
+    payloadParser.reset();
+    bool parseFinished = feedPayloadBlock(session.firstBlock);
+
+    while (!parseFinished && blocksDone < blockCount)
+    {
+        int chunkBlocks = 1;
+        if (session.fastReadSupported)
+        {
+            chunkBlocks = blockCount - blocksDone;
+            if (chunkBlocks > NFC_FAST_READ_PAGES / PAGES_PER_BLOCK)
             {
-                currentBlock++;
+                chunkBlocks = NFC_FAST_READ_PAGES / PAGES_PER_BLOCK;
             }
         }
-        return CPrintHexChar(&buffer[messageNfcStartIndex], messageNfcLength, nama, induk);
+
+        unsigned long exchangeStart = micros();
+        if (session.fastReadSupported)
+        {
+            uint8_t lastPage = currentPage + chunkBlocks * PAGES_PER_BLOCK - 1;
+            if (!nfc->ntagFastRead(currentPage, lastPage, pages))
+            {
+                // Original Ultralight has no FAST_READ, fall back to READ
+                session.fastReadSupported = false;
+                if (!reselectCard(session))
+                {
+                    lastError = "Card lost after FAST_READ";
+                    return false;
+                }
+                continue;
+            }
+        }
+        else if (!nfc->ntagRead(currentPage, pages))
+        {
+            lastError = "Failed to read data pages";
+            return false;
+        }
+        recordExchange(micros() - exchangeStart, chunkBlocks);
+        blocksDone += chunkBlocks;
+        currentPage += chunkBlocks * PAGES_PER_BLOCK;
+
+        for (int i = 0; i < chunkBlocks && !parseFinished; i++)
+        {
+            parseFinished = feedPayloadBlock(pages + i * BLOCK_SIZE);
+        }
+    }
+
+    readStats.totalUs = micros() - readStart;
+    readStats.blocksSkipped = blockCount - blocksDone;
+
+    if (payloadParser.getResult() != CardPayloadParser::PARSE_DONE)
+    {
+        if (payloadParser.getResult() == CardPayloadParser::PARSE_MORE)
+        {
+            lastError = "Incomplete card payload";
+        }
+        return false;
     }
+    return true;
+}
 
-    return false;
+void NFCHandler::recordExchange(unsigned long elapsedUs, uint8_t blocks)
+{
+    if (readStats.exchanges < NFC_MAX_TIMED_BLOCKS)
+    {
+        readStats.blockUs[readStats.exchanges] = elapsedUs;
+    }
+    readStats.exchanges++;
+    readStats.blocksRead += blocks;
+    if (elapsedUs > readStats.maxBlockUs)
+    {
+        readStats.maxBlockUs = elapsedUs;
+    }
+}
+
+void NFCHandler::printReadStats()
+{
+    Serial.printf("NFC read: %u blocks (%u skipped) in %u exchanges, %u sector auths (%lu us), total %lu us, max exchange %lu us\n",
+                  readStats.blocksRead, readStats.blocksSkipped, readStats.exchanges, readStats.sectorsAuthenticated,
+                  readStats.authUs, readStats.totalUs, readStats.maxBlockUs);
+
+    Serial.print("Per-exchange us:");
+    uint8_t timedBlocks = readStats.exchanges < NFC_MAX_TIMED_BLOCKS ? readStats.exchanges : NFC_MAX_TIMED_BLOCKS;
+    for (uint8_t i = 0; i < timedBlocks; i++)
+    {
+        Serial.print(' ');
+        Serial.print(readStats.blockUs[i]);
+    }
+    Serial.println();
+}
+
+uint8_t NFCHandler::classicSectorOf(uint8_t block)
+{
+    // Mifare Classic 4K: sectors 32-39 have 16 blocks each
+    if (block < 128)
+    {
+        return block / 4;
+    }
+    return 32 + (block - 128) / 16;
+}
+
+uint8_t NFCHandler::classicTrailerOf(uint8_t sector)
+{
+    if (sector < 32)
+    {
+        return sector * 4 + 3;
+    }
+    return 128 + (sector - 32) * 16 + 15;
 }
 
 String NFCHandler::bytesToHexString(uint8_t *data, uint8_t length)
@@ -257,39 +800,19 @@ bool isCardStillPresent()
 
 bool CPrintHexChar(const byte *data, const long numBytes, String &nama, String &induk)
 {
-    int32_t szPos;
-    String ll;
-    char decoded[512];
-    JsonDocument doc;
+    // data points at the NDEF message itself (TLV value)
+    CardPayloadParser parser;
+    parser.resetAtMessage(numBytes);
 
-    for (szPos = 10; szPos < numBytes; szPos++)
-    {
-        if (data[szPos] <= 0x1F)
-            Serial.print("");
-        else
-        {
-            ll += (char)data[szPos];
-        }
-    }
-    b64_decode(decoded, (char *)ll.c_str(), ll.length());
-    DeserializationError error = deserializeJson(doc, decoded);
-    if (error)
+    if (parser.feed(data, numBytes) != CardPayloadParser::PARSE_DONE)
     {
-        Serial.print(F("deserializeJson() failed: "));
-        Serial.println(error.f_str());
-        return "error";
+        Serial.print(F("Card payload parse failed: "));
+        Serial.println(parser.getError());
         return false;
     }
-    // const char *id = doc["id"];                       // "5744"
-    induk = doc["induk"].as<String>(); // "196600"
-    // const char *nik = doc["nik"];                     // "3201266712060003"
-    nama = doc["nama"].as<String>(); // "Inggrit Destiana Nugraeni"
-    // const char *alamat = doc["alamat"];               // "Jln Megamendung Rt.04/04 Blok C No 20 CIPAYUNG (CIPAYUNG DATAR) ...
-    // const char *kabupaten = doc["kabupaten"];         // "BOGOR"
-    // const char *tempat_lahir = doc["tempat_lahir"];   // "BOGOR"
-    // const char *tanggal_lahir = doc["tanggal_lahir"]; // "2006-12-27"
-    // const char *nisn = doc["nisn"];                   // "0063760230"
-    // const char *foto = doc["foto"];                   // "5c78eca25cf0836cc15623b4c18d9336.JPG"
+
+    induk = parser.getInduk(); // "196600"
+    nama = parser.getNama();   // "Inggrit Destiana Nugraeni"
     return true;
 }
 
@@ -359,13 +882,13 @@ String getCardTypeString(uint8_t cardType)
 {
     switch (cardType)
     {
-    case 0x00:
-        return "Mifare Ultralight";
-    case 0x01:
+    case NFC_CARD_ULTRALIGHT:
+        return "Mifare Ultralight/NTAG";
+    case NFC_CARD_CLASSIC_1K:
         return "Mifare Classic 1K";
-    case 0x02:
+    case NFC_CARD_CLASSIC_4K:
         return "Mifare Classic 4K";
-    case 0x03:
+    case NFC_CARD_DESFIRE:
         return "Mifare DESFire";
     default:
         return "Unknown";
@@ -2,8 +2,76 @@
 #define NFC_HANDLER_H
 
 #include <Arduino.h>
-#include <Adafruit_PN532.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 #include "config.h"
+#include "card_payload_parser.h"
+#include "pn532_driver.h"
+#include "pn532_emulator.h"
+
+#define NFC_BLOCK_SIZE 16
+// NDEF area from block 4 / page 4 to the end of the card, in 16-byte blocks
+#define NFC_CLASSIC_1K_DATA_BLOCKS  45  // Sectors 1-15
+#define NFC_CLASSIC_4K_DATA_BLOCKS  210 // Sectors 1-15 and 17-39, sector 16 holds MAD2
+#define NFC_TYPE2_DATA_BLOCKS       56  // NTAG216 pages 4-225, smaller tags NAK past their end
+#define NFC_CLASSIC_MAD2_SECTOR     16
+#define NFC_MAX_TIMED_BLOCKS 48     // Enough for every data block of a 1K card
+#define NFC_FAST_READ_PAGES 24      // Type 2 pages per FAST_READ (fits the I2C frame)
+
+// Card type codes used by CardSession and getCardTypeString()
+#define NFC_CARD_ULTRALIGHT  0x00   // Type 2: Ultralight / NTAG21x
+#define NFC_CARD_CLASSIC_1K  0x01
+#define NFC_CARD_CLASSIC_4K  0x02
+#define NFC_CARD_DESFIRE     0x03
+#define NFC_CARD_UNKNOWN     0xFF
+
+// =============================================
+// CARD SESSION
+// =============================================
+
+// Everything learned about a card in one detection round trip, so later
+// stages never have to issue InListPassiveTarget again for the same tap.
+struct CardSession {
+    uint8_t uid[7];
+    uint8_t uidLength;
+    uint16_t sensRes;                       // ATQA from InListPassiveTarget
+    uint8_t sak;                            // SEL_RES, picks the read backend
+    uint8_t cardType;                       // NFC_CARD_* code
+    String uidHex;                          // UID as hex string (API card ID)
+    uint8_t firstBlock[NFC_BLOCK_SIZE];     // Classic block 4 or Type 2 pages 4-7
+    bool firstBlockValid;
+    int authenticatedSector;                // Sector left authenticated, -1 if none
+    bool fastReadSupported;                 // Cleared when a Type 2 tag NAKs FAST_READ
+
+    CardSession() { clear(); }
+
+    void clear() {
+        memset(uid, 0, sizeof(uid));
+        uidLength = 0;
+        sensRes = 0;
+        sak = 0;
+        cardType = NFC_CARD_UNKNOWN;
+        uidHex = "";
+        memset(firstBlock, 0, sizeof(firstBlock));
+        firstBlockValid = false;
+        authenticatedSector = -1;
+        fastReadSupported = true;
+    }
+
+    bool isValid() const { return uidLength > 0; }
+};
+
+// Timing of the last multi-block read
+struct NFCReadStats {
+    uint8_t blocksRead;             // 16-byte blocks, also for Type 2 pages
+    uint8_t exchanges;              // InDataExchange round trips for the data
+    uint8_t blocksSkipped;          // Not read because parsing finished early
+    uint8_t sectorsAuthenticated;
+    unsigned long authUs;
+    unsigned long totalUs;
+    unsigned long maxBlockUs;       // Slowest single exchange
+    unsigned long blockUs[NFC_MAX_TIMED_BLOCKS];    // Per exchange
+};
 
 // =============================================
 // NFC HANDLER CLASS
@@ -11,17 +79,61 @@
 
 class NFCHandler {
 private:
-    Adafruit_PN532* nfc;
+    PN532Transport* transport;
+    PN532Driver* nfc;
     bool isInitialized;
     unsigned long lastCardCheck;
     uint8_t cardTimeout;
 
+    // IRQ-driven detection
+    bool irqDetection;
+    static volatile bool detectionArmed;
+    static volatile bool detectionPending;
+    static volatile unsigned long irqTimestampUs;
+    static TaskHandle_t notifyTask;
+    static void IRAM_ATTR onPN532Irq();
+
+    // Detection latency statistics (IRQ edge to state transition)
+    unsigned long lastDetectionLatencyUs;
+    unsigned long maxDetectionLatencyUs;
+    unsigned long totalDetectionLatencyUs;
+    uint32_t detectionLatencyCount;
+
+    NFCReadStats readStats;
+
+    // Presence tracking of the last processed card
+    uint8_t presenceUid[7];
+    uint8_t presenceUidLength;      // 0 when no card is being tracked
+    uint8_t missedPresenceChecks;
+    bool duplicateCounted;
+    uint32_t suppressedDuplicates;
+
+    // Blocks are parsed as they arrive, nothing sized by the card is buffered
+    CardPayloadParser payloadParser;
+
     // Helper methods
     bool waitForCard(uint32_t timeoutMs);
+    bool completeDetection(CardSession& session, const PN532Target& target);
+    bool readFirstBlock(CardSession& session);
+    bool reselectCard(CardSession& session);
+    bool readClassicSectors(CardSession& session, int blockCount);
+    bool readUltralightPages(CardSession& session, int blockCount);
+    void recordExchange(unsigned long elapsedUs, uint8_t blocks);
+    bool feedPayloadBlock(const uint8_t* block);
+    void printReadStats();
+    static uint8_t classicSectorOf(uint8_t block);
+    static uint8_t classicTrailerOf(uint8_t sector);
+    static uint8_t cardTypeFromSak(uint8_t sak);
+    static int maxMessageBlocks(uint8_t cardType);
     String bytesToHexString(uint8_t* data, uint8_t length);
+    static PN532Transport* createTransport(uint8_t ssPin, uint8_t clkPin, uint8_t misoPin, uint8_t mosiPin);
 
 public:
-    NFCHandler(uint8_t ssPin = SS, uint8_t clkPin = -1, uint8_t misoPin = -1, uint8_t mosiPin = -1);
+    // SPI pins are only used when NFC_TRANSPORT is NFC_TRANSPORT_SPI
+    NFCHandler(uint8_t ssPin = PN532_SPI_SS_PIN, uint8_t clkPin = PN532_SPI_SCK_PIN,
+               uint8_t misoPin = PN532_SPI_MISO_PIN, uint8_t mosiPin = PN532_SPI_MOSI_PIN);
+    // Runs on a caller-supplied transport, e.g. a PN532EmulatorTransport
+    explicit NFCHandler(PN532Transport* transport, bool irqDetection = false, int8_t resetPin = -1);
 
     // Initialization
     bool begin();
@@ -31,8 +143,36 @@ public:
     bool isCardPresent();
     String getCardUID();  // Returns UID as hex string
 
+    // Single-poll detection: UID, card type and first data block in one go
+    bool detectCard(CardSession& session);
+
+    // IRQ-driven detection: arm once, then collect the card after the IRQ
+    void setDetectionTask(TaskHandle_t task);
+    bool usesIrqDetection() const { return irqDetection; }
+    bool armCardDetection();
+    bool isDetectionArmed() const { return detectionArmed; }
+    bool isDetectionPending() const { return detectionPending; }
+    bool readDetectedCard(CardSession& session);
+
+    // Detection latency (IRQ edge to state transition)
+    void recordDetectionLatency();
+    unsigned long getLastDetectionLatencyUs() const { return lastDetectionLatencyUs; }
+    unsigned long getMaxDetectionLatencyUs() const { return maxDetectionLatencyUs; }
+    unsigned long getAvgDetectionLatencyUs() const;
+    uint32_t getDetectionLatencyCount() const { return detectionLatencyCount; }
+
+    // Presence tracking: a remembered card is ignored until it has left
+    void rememberCard(const CardSession& session);
+    bool isAwaitingRemoval() const { return presenceUidLength > 0; }
+    bool updatePresence();  // Cheap probe, true once removal is confirmed
+    uint32_t getSuppressedDuplicates() const { return suppressedDuplicates; }
+
+    // Timing of the last readSantriData()
+    const NFCReadStats& getLastReadStats() const { return readStats; }
+
     // NDEF reading for santri data
-    bool readSantriData(String& nama, String& induk);
+    bool readSantriData(CardSession& session, String& nama, String& induk);
+    bool readSantriData(String& nama, String& induk);  // Detects the card itself
 
     // Utility methods
     void printCardInfo(uint8_t* uid, uint8_t uidLength);
@@ -43,6 +183,7 @@ public:
 
     // Status
     bool isReady() const { return isInitialized; }
+    const char* getTransportName() const { return transport->getName(); }
     String getLastError() const;
 
 private:
@@ -3,6 +3,10 @@
 #include <ESPmDNS.h>
 #include "config_manager.h"
 #include <Preferences.h>
+#include <new>
+#include "mybase64.h"
+#include "activity_journal.h"
+#include "api_client.h"
 
 // =============================================
 // CLASS IMPLEMENTATION
@@ -204,7 +208,7 @@ void OTAHandler::setupWebServer() {
         html += "<h2>Configuration</h2>";
         html += "<form method='POST' action='/config'>";
         html += "<div class='form-group'><label for='deviceName'>Device Name</label><input type='text' id='deviceName' name='deviceName' value='"+String(configManager.getDeviceName())+"' required></div>";
-        html += "<div class='form-group'><label for='apiUrl'>API Base URL</label><input type='url' id='apiUrl' name='apiUrl' value='"+String(configManager.getApiBaseUrl())+"' required></div>";
+        html += "<div class='form-group'><label for='apiUrl'>API Base URL (backup servers after a comma)</label><input type='text' id='apiUrl' name='apiUrl' value='"+String(configManager.getApiBaseUrl())+"' required></div>";
         html += "<div class='form-group'><label for='hostname'>mDNS Hostname</label><input type='text' id='hostname' name='hostname' value='"+String(configManager.getMdnsHostname())+"' required></div>";
         html += "<button type='submit' class='btn btn-success'>Save Configuration</button>";
         html += "</form>";
@@ -478,31 +482,22 @@ bool OTAHandler::authenticateRequest(AsyncWebServerRequest *request) {
 }
 
 String OTAHandler::base64Decode(String input) {
-    String output = "";
-    int inputLen = input.length();
-    
-    for (int i = 0; i < inputLen; i += 4) {
-        uint32_t value = 0;
-        
-        for (int j = 0; j < 4; j++) {
-            char c = input.charAt(i + j);
-            if (c >= 'A' && c <= 'Z') value |= (c - 'A') << (18 - j * 6);
-            else if (c >= 'a' && c <= 'z') value |= (c - 'a' + 26) << (18 - j * 6);
-            else if (c >= '0' && c <= '9') value |= (c - '0' + 52) << (18 - j * 6);
-            else if (c == '+') value |= 62 << (18 - j * 6);
-            else if (c == '/') value |= 63 << (18 - j * 6);
-            else if (c == '=') break;
-        }
-        
-        output += char((value >> 16) & 0xFF);
-        if (i + 2 < inputLen && input.charAt(i + 2) != '=') {
-            output += char((value >> 8) & 0xFF);
-        }
-        if (i + 3 < inputLen && input.charAt(i + 3) != '=') {
-            output += char(value & 0xFF);
-        }
+    // Sized from the input, so long credentials decode instead of failing
+    int maxLen = b64_dec_max_len(input.length());
+    uint8_t* decoded = new (std::nothrow) uint8_t[maxLen > 0 ? maxLen : 1];
+    if (decoded == nullptr) {
+        Serial.printf("Base64 decode: no memory for %d bytes\n", maxLen);
+        return "";
     }
-    
+
+    String output;
+    int decodedLen = b64_decode_into(decoded, maxLen, input.c_str(), input.length());
+    if (decodedLen < 0) {
+        Serial.println("Base64 decode: invalid input");
+    } else {
+        output.concat((const char*)decoded, decodedLen);
+    }
+    delete[] decoded;
     return output;
 }
 
@@ -515,7 +510,15 @@ String OTAHandler::getDeviceInfo() {
     info += "\"uptime\":" + String(millis() / 1000) + ",";
     info += "\"free_heap\":" + String(ESP.getFreeHeap()) + ",";
     info += "\"wifi_ssid\":\"" + WiFi.SSID() + "\",";
-    info += "\"wifi_rssi\":" + String(WiFi.RSSI());
+    info += "\"wifi_rssi\":" + String(WiFi.RSSI()) + ",";
+    info += "\"journal_depth\":" + String(activityJournal.getDepth()) + ",";
+    info += "\"journal_capacity\":" + String(activityJournal.getCapacity()) + ",";
+    info += "\"journal_dropped\":" + String(activityJournal.getStats().dropped) + ",";
+    info += "\"validation_cache_hits\":" + String(apiClient.getValidationCache().getStats().hits) + ",";
+    info += "\"validation_cache_misses\":" + String(apiClient.getValidationCache().getStats().misses) + ",";
+    info += "\"validation_cache_entries\":" + String(apiClient.getValidationCache().getEntryCount()) + ",";
+    info += "\"roster_version\":" + String(rosterStore.getVersion()) + ",";
+    info += "\"roster_entries\":" + String(rosterStore.getEntryCount());
     info += "}";
     return info;
 }
@@ -0,0 +1,366 @@
+#include "pn532_driver.h"
+
+// =============================================
+// FRAMING
+// =============================================
+
+static const uint8_t pn532Ack[] = {0x00, 0x00, 0xFF, 0x00, 0xFF, 0x00};
+
+PN532Driver::PN532Driver(PN532Transport *transport, int8_t resetPin) : transport(transport), resetPin(resetPin), lastStatus(0)
+{
+    memset(packetBuffer, 0, sizeof(packetBuffer));
+}
+
+bool PN532Driver::begin()
+{
+    if (resetPin >= 0)
+    {
+        pinMode(resetPin, OUTPUT);
+        digitalWrite(resetPin, HIGH);
+        digitalWrite(resetPin, LOW);
+        delay(400);
+        digitalWrite(resetPin, HIGH);
+        delay(10);
+    }
+
+    if (!transport->begin())
+    {
+        return false;
+    }
+    transport->wakeup();
+    return true;
+}
+
+bool PN532Driver::waitReady(uint16_t timeoutMs)
+{
+    unsigned long start = millis();
+    unsigned long spinStart = micros();
+    while (!transport->isReady())
+    {
+        if (timeoutMs != 0 && millis() - start >= timeoutMs)
+        {
+            return false;
+        }
+
+        // Most frames are ready within a couple of ms, sleeping a whole
+        // tick on each poll would add up to 1 ms per frame
+        if (micros() - spinStart < PN532_SPIN_WAIT_US)
+        {
+            yield();
+        }
+        else
+        {
+            delay(1);
+        }
+    }
+    return true;
+}
+
+bool PN532Driver::writeCommand(const uint8_t *command, uint8_t length)
+{
+    if (length + PN532_FRAME_OVERHEAD > (int)sizeof(packetBuffer))
+    {
+        return false;
+    }
+
+    uint8_t frameLength = length + 1;   // TFI + command
+    uint8_t checksum = PN532_HOST_TO_PN532;
+    uint8_t index = 0;
+
+    packetBuffer[index++] = 0x00;
+    packetBuffer[index++] = 0x00;
+    packetBuffer[index++] = 0xFF;
+    packetBuffer[index++] = frameLength;
+    packetBuffer[index++] = (uint8_t)(~frameLength + 1);
+    packetBuffer[index++] = PN532_HOST_TO_PN532;
+    for (uint8_t i = 0; i < length; i++)
+    {
+        packetBuffer[index++] = command[i];
+        checksum += command[i];
+    }
+    packetBuffer[index++] = (uint8_t)(~checksum + 1);
+    packetBuffer[index++] = 0x00;
+
+    return transport->writeFrame(packetBuffer, index);
+}
+
+bool PN532Driver::readAck()
+{
+    uint8_t ack[sizeof(pn532Ack)];
+    if (!transport->readFrame(ack, sizeof(ack)))
+    {
+        return false;
+    }
+    return memcmp(ack, pn532Ack, sizeof(pn532Ack)) == 0;
+}
+
+void PN532Driver::abortCommand()
+{
+    // An ACK from the host cancels whatever the PN532 is still working on
+    transport->writeFrame(pn532Ack, sizeof(pn532Ack));
+}
+
+bool PN532Driver::sendCommandCheckAck(const uint8_t *command, uint8_t length, uint16_t timeoutMs)
+{
+    if (!writeCommand(command, length))
+    {
+        return false;
+    }
+    if (!waitReady(timeoutMs))
+    {
+        return false;
+    }
+    return readAck();
+}
+
+int PN532Driver::readResponse(uint8_t command, uint8_t *data, uint8_t maxLength, uint16_t timeoutMs)
+{
+    if (!waitReady(timeoutMs))
+    {
+        abortCommand();
+        return -1;
+    }
+
+    // Only read as much as this response can be, I2C reads are per byte
+    int frameLength = maxLength + PN532_FRAME_OVERHEAD;
+    if (frameLength > (int)sizeof(packetBuffer))
+    {
+        frameLength = sizeof(packetBuffer);
+    }
+    if (!transport->readFrame(packetBuffer, frameLength))
+    {
+        return -1;
+    }
+
+    // Skip any leading zeros up to the 00 FF start code
+    int index = 0;
+    while (index < frameLength - 1 && !(packetBuffer[index] == 0x00 && packetBuffer[index + 1] == 0xFF))
+    {
+        index++;
+    }
+    index += 2;
+    if (index + 2 > frameLength)
+    {
+        return -1;
+    }
+
+    uint8_t length = packetBuffer[index];
+    if ((uint8_t)(length + packetBuffer[index + 1]) != 0 || length < 2)
+    {
+        return -1;
+    }
+    index += 2;
+    if (index + length + 1 > frameLength)
+    {
+        return -1;  // Response longer than the caller allowed for
+    }
+
+    if (packetBuffer[index] != PN532_PN532_TO_HOST || packetBuffer[index + 1] != command + 1)
+    {
+        return -1;
+    }
+
+    uint8_t checksum = 0;
+    for (int i = 0; i <= length; i++)
+    {
+        checksum += packetBuffer[index + i];
+    }
+    if (checksum != 0)
+    {
+        return -1;
+    }
+
+    int dataLength = length - 2;
+    if (dataLength > maxLength)
+    {
+        return -1;
+    }
+    memcpy(data, packetBuffer + index + 2, dataLength);
+    return dataLength;
+}
+
+int PN532Driver::transceive(const uint8_t *command, uint8_t length, uint8_t *response, uint8_t maxLength, uint16_t timeoutMs)
+{
+    if (!sendCommandCheckAck(command, length))
+    {
+        return -1;
+    }
+    return readResponse(command[0], response, maxLength, timeoutMs);
+}
+
+// =============================================
+// CHIP CONFIGURATION
+// =============================================
+
+uint32_t PN532Driver::getFirmwareVersion()
+{
+    uint8_t command[] = {PN532_COMMAND_GETFIRMWAREVERSION};
+    uint8_t response[4];
+
+    if (transceive(command, sizeof(command), response, sizeof(response)) != 4)
+    {
+        return 0;
+    }
+
+    // IC, Ver, Rev, Support - same packing as Adafruit_PN532
+    return ((uint32_t)response[0] << 24) | ((uint32_t)response[1] << 16) |
+           ((uint32_t)response[2] << 8) | response[3];
+}
+
+bool PN532Driver::SAMConfig()
+{
+    // Normal mode, 50 ms virtual card timeout, use IRQ
+    uint8_t command[] = {PN532_COMMAND_SAMCONFIGURATION, 0x01, 0x14, 0x01};
+    uint8_t response[1];
+
+    return transceive(command, sizeof(command), response, sizeof(response)) == 0;
+}
+
+bool PN532Driver::setPassiveActivationRetries(uint8_t maxRetries)
+{
+    // CfgItem 5: MxRtyATR, MxRtyPSL, MxRtyPassiveActivation
+    uint8_t command[] = {PN532_COMMAND_RFCONFIGURATION, 0x05, 0xFF, 0x01, maxRetries};
+    uint8_t response[1];
+
+    return transceive(command, sizeof(command), response, sizeof(response)) == 0;
+}
+
+// =============================================
+// TARGET DETECTION
+// =============================================
+
+bool PN532Driver::parseTarget(const uint8_t *data, int length, PN532Target &target)
+{
+    // NbTg, Tg, SENS_RES (2), SEL_RES, NFCIDLength, NFCID1 [, ATS]
+    if (length < 6 || data[0] != 1)
+    {
+        return false;
+    }
+
+    uint8_t uidLength = data[5];
+    if (uidLength > sizeof(target.uid) || 6 + uidLength > length)
+    {
+        return false;
+    }
+
+    target.sensRes = ((uint16_t)data[2] << 8) | data[3];
+    target.sak = data[4];
+    target.uidLength = uidLength;
+    memcpy(target.uid, data + 6, uidLength);
+    return true;
+}
+
+bool PN532Driver::readPassiveTarget(PN532Target &target, uint16_t timeoutMs)
+{
+    if (!startPassiveTargetDetection())
+    {
+        return false;
+    }
+
+    uint8_t response[32];
+    int length = readResponse(PN532_COMMAND_INLISTPASSIVETARGET, response, sizeof(response), timeoutMs);
+    return parseTarget(response, length, target);
+}
+
+bool PN532Driver::startPassiveTargetDetection()
+{
+    uint8_t command[] = {PN532_COMMAND_INLISTPASSIVETARGET, 0x01, PN532_BAUD_ISO14443A};
+    return sendCommandCheckAck(command, sizeof(command));
+}
+
+bool PN532Driver::readDetectedPassiveTarget(PN532Target &target)
+{
+    uint8_t response[32];
+    int length = readResponse(PN532_COMMAND_INLISTPASSIVETARGET, response, sizeof(response), PN532_DEFAULT_TIMEOUT);
+    return parseTarget(response, length, target);
+}
+
+// =============================================
+// DATA EXCHANGE
+// =============================================
+
+bool PN532Driver::inDataExchange(const uint8_t *send, uint8_t sendLength, uint8_t *response, uint8_t *responseLength)
+{
+    uint8_t command[PN532_MAX_RESPONSE_DATA];
+    if (sendLength + 2 > (int)sizeof(command))
+    {
+        return false;
+    }
+
+    command[0] = PN532_COMMAND_INDATAEXCHANGE;
+    command[1] = 1;     // Target number
+    memcpy(command + 2, send, sendLength);
+
+    // Room for the status byte in front of the card's answer
+    uint8_t maxLength = *responseLength + 1;
+    if (maxLength > PN532_MAX_RESPONSE_DATA)
+    {
+        maxLength = PN532_MAX_RESPONSE_DATA;
+    }
+
+    uint8_t reply[PN532_MAX_RESPONSE_DATA];
+    int length = transceive(command, sendLength + 2, reply, maxLength);
+    if (length < 1)
+    {
+        return false;
+    }
+
+    lastStatus = reply[0];
+    if ((lastStatus & 0x3F) != 0)
+    {
+        return false;
+    }
+
+    *responseLength = length - 1;
+    memcpy(response, reply + 1, length - 1);
+    return true;
+}
+
+bool PN532Driver::mifareClassicAuthenticateBlock(const uint8_t *uid, uint8_t uidLength, uint8_t block,
+                                                 uint8_t keyNumber, const uint8_t *key)
+{
+    uint8_t send[2 + 6 + 10];
+    uint8_t length = 0;
+
+    send[length++] = keyNumber ? MIFARE_CMD_AUTH_B : MIFARE_CMD_AUTH_A;
+    send[length++] = block;
+    memcpy(send + length, key, 6);
+    length += 6;
+    memcpy(send + length, uid, uidLength);
+    length += uidLength;
+
+    uint8_t response[1];
+    uint8_t responseLength = 0;
+    return inDataExchange(send, length, response, &responseLength);
+}
+
+bool PN532Driver::mifareClassicReadBlock(uint8_t block, uint8_t *data)
+{
+    uint8_t send[] = {MIFARE_CMD_READ, block};
+    uint8_t responseLength = 16;
+
+    return inDataExchange(send, sizeof(send), data, &responseLength) && responseLength == 16;
+}
+
+bool PN532Driver::ntagRead(uint8_t page, uint8_t *data)
+{
+    // READ answers with four pages, the Adafruit library dropped three
+    uint8_t send[] = {MIFARE_CMD_READ, page};
+    uint8_t responseLength = 4 * NTAG_PAGE_SIZE;
+
+    return inDataExchange(send, sizeof(send), data, &responseLength) && responseLength == 4 * NTAG_PAGE_SIZE;
+}
+
+bool PN532Driver::ntagFastRead(uint8_t startPage, uint8_t endPage, uint8_t *data)
+{
+    if (endPage < startPage)
+    {
+        return false;
+    }
+
+    uint8_t send[] = {NTAG_CMD_FAST_READ, startPage, endPage};
+    uint8_t expected = (endPage - startPage + 1) * NTAG_PAGE_SIZE;
+    uint8_t responseLength = expected;
+
+    return inDataExchange(send, sizeof(send), data, &responseLength) && responseLength == expected;
+}
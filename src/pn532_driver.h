@@ -0,0 +1,106 @@
+#ifndef PN532_DRIVER_H
+#define PN532_DRIVER_H
+
+#include <Arduino.h>
+#include "pn532_transport.h"
+
+// Frame overhead around the data of a response:
+// 00 00 FF LEN LCS D5 CMD <data> DCS 00
+#define PN532_FRAME_OVERHEAD    9
+#define PN532_PACKET_BUFFER_SIZE 128
+#define PN532_MAX_RESPONSE_DATA (PN532_PACKET_BUFFER_SIZE - PN532_FRAME_OVERHEAD)
+#define PN532_DEFAULT_TIMEOUT   100     // ms for ACK and ordinary responses
+#define PN532_SPIN_WAIT_US      3000    // Poll without sleeping for this long first
+
+// Commands
+#define PN532_COMMAND_GETFIRMWAREVERSION    0x02
+#define PN532_COMMAND_SAMCONFIGURATION      0x14
+#define PN532_COMMAND_RFCONFIGURATION       0x32
+#define PN532_COMMAND_INDATAEXCHANGE        0x40
+#define PN532_COMMAND_INLISTPASSIVETARGET   0x4A
+
+#define PN532_HOST_TO_PN532 0xD4
+#define PN532_PN532_TO_HOST 0xD5
+
+#define PN532_BAUD_ISO14443A 0x00
+
+// Card commands sent through InDataExchange
+#define MIFARE_CMD_AUTH_A   0x60
+#define MIFARE_CMD_AUTH_B   0x61
+#define MIFARE_CMD_READ     0x30    // Classic: one block, Type 2: four pages
+#define NTAG_CMD_FAST_READ  0x3A    // Type 2: a page range in one exchange
+
+#define NTAG_PAGE_SIZE 4
+
+// =============================================
+// PASSIVE TARGET
+// =============================================
+
+// ISO14443A target as returned by InListPassiveTarget
+struct PN532Target {
+    uint16_t sensRes;   // ATQA
+    uint8_t sak;        // SEL_RES
+    uint8_t uid[10];
+    uint8_t uidLength;
+};
+
+// =============================================
+// PN532 DRIVER CLASS
+// =============================================
+
+// Minimal PN532 command layer on top of a PN532Transport. Unlike the
+// Adafruit library it hands back SENS_RES/SAK and the full 16-byte READ
+// response, and it can issue FAST_READ for Type 2 tags.
+class PN532Driver {
+private:
+    PN532Transport* transport;
+    int8_t resetPin;
+    uint8_t packetBuffer[PN532_PACKET_BUFFER_SIZE];
+    uint8_t lastStatus;     // Status byte of the last InDataExchange
+
+    bool waitReady(uint16_t timeoutMs);
+    bool writeCommand(const uint8_t* command, uint8_t length);
+    bool readAck();
+    void abortCommand();
+    int readResponse(uint8_t command, uint8_t* data, uint8_t maxLength, uint16_t timeoutMs);
+    bool parseTarget(const uint8_t* data, int length, PN532Target& target);
+
+public:
+    PN532Driver(PN532Transport* transport, int8_t resetPin = -1);
+
+    bool begin();
+    PN532Transport* getTransport() const { return transport; }
+
+    // Sends a command and waits for its ACK, the response is read separately
+    bool sendCommandCheckAck(const uint8_t* command, uint8_t length, uint16_t timeoutMs = PN532_DEFAULT_TIMEOUT);
+    // Sends a command and returns the response data length, -1 on failure
+    int transceive(const uint8_t* command, uint8_t length, uint8_t* response, uint8_t maxLength,
+                   uint16_t timeoutMs = PN532_DEFAULT_TIMEOUT);
+
+    uint32_t getFirmwareVersion();
+    bool SAMConfig();
+    bool setPassiveActivationRetries(uint8_t maxRetries);
+
+    // Blocking detection, aborted with an ACK when no answer came within
+    // timeoutMs (0 would wait until a card shows up)
+    bool readPassiveTarget(PN532Target& target, uint16_t timeoutMs);
+    // Non-blocking detection: arm, then collect once isReady()
+    bool startPassiveTargetDetection();
+    bool readDetectedPassiveTarget(PN532Target& target);
+    bool isReady() { return transport->isReady(); }
+
+    // Raw exchange with the selected target (target number 1)
+    bool inDataExchange(const uint8_t* send, uint8_t sendLength, uint8_t* response, uint8_t* responseLength);
+    uint8_t getLastStatus() const { return lastStatus; }
+
+    // Mifare Classic
+    bool mifareClassicAuthenticateBlock(const uint8_t* uid, uint8_t uidLength, uint8_t block,
+                                        uint8_t keyNumber, const uint8_t* key);
+    bool mifareClassicReadBlock(uint8_t block, uint8_t* data);
+
+    // Type 2 tags (Ultralight / NTAG21x)
+    bool ntagRead(uint8_t page, uint8_t* data);     // 16 bytes: pages page..page+3
+    bool ntagFastRead(uint8_t startPage, uint8_t endPage, uint8_t* data);
+};
+
+#endif // PN532_DRIVER_H
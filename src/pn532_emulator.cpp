@@ -0,0 +1,558 @@
+#include "pn532_emulator.h"
+#include "pn532_driver.h"
+
+// =============================================
+// CONSTANTS
+// =============================================
+
+#define EMU_STATUS_OK       0x00
+#define EMU_STATUS_TIMEOUT  0x01    // Card did not answer (NAK or absent)
+#define EMU_STATUS_AUTH     0x14    // Mifare authentication error
+
+#define CLASSIC_1K_SIZE     1024
+#define NTAG215_SIZE        540     // 135 pages
+#define NTAG215_USER_END    520     // Pages 4-129 hold user data
+
+static const uint8_t emuAck[] = {0x00, 0x00, 0xFF, 0x00, 0xFF, 0x00};
+static const uint8_t madKey[6] = {0xA0, 0xA1, 0xA2, 0xA3, 0xA4, 0xA5};
+static const uint8_t ndefKey[6] = {0xD3, 0xF7, 0xD3, 0xF7, 0xD3, 0xF7};
+
+PN532EmulatorTransport::PN532EmulatorTransport()
+    : cardPresent(false), cardSelected(false), authenticatedSector(-1), maxRetries(0xFF),
+      ackPending(false), responsePending(false), listingDeferred(false), readyAtUs(0), frameLatencyUs(0),
+      responseLength(0), exchangeErrorEvery(0), corruptFrameEvery(0)
+{
+    memset(&card, 0, sizeof(card));
+    resetCounters();
+}
+
+void PN532EmulatorTransport::resetCounters()
+{
+    exchangeCount = 0;
+    frameCount = 0;
+    commandCount = 0;
+    errorsInjected = 0;
+}
+
+// =============================================
+// TRANSPORT
+// =============================================
+
+bool PN532EmulatorTransport::begin()
+{
+    ackPending = false;
+    responsePending = false;
+    listingDeferred = false;
+    return true;
+}
+
+void PN532EmulatorTransport::wakeup()
+{
+}
+
+bool PN532EmulatorTransport::isReady()
+{
+    if (listingDeferred && !ackPending && cardPresent)
+    {
+        listingDeferred = false;
+        listTarget();
+        readyAtUs = micros() + frameLatencyUs;
+    }
+
+    if (!ackPending && !responsePending)
+    {
+        return false;
+    }
+    return (long)(micros() - readyAtUs) >= 0;
+}
+
+bool PN532EmulatorTransport::writeFrame(const uint8_t *frame, uint8_t length)
+{
+    // An ACK from the host aborts the running command
+    if (length == sizeof(emuAck) && memcmp(frame, emuAck, sizeof(emuAck)) == 0)
+    {
+        ackPending = false;
+        responsePending = false;
+        listingDeferred = false;
+        return true;
+    }
+
+    // 00 00 FF LEN LCS D4 CMD ... DCS 00, anything else is dropped like the
+    // chip drops it, and the host runs into its ACK timeout
+    if (length < 8 || frame[0] != 0x00 || frame[1] != 0x00 || frame[2] != 0xFF)
+    {
+        return true;
+    }
+    uint8_t frameLength = frame[3];
+    if ((uint8_t)(frameLength + frame[4]) != 0 || frameLength < 2 || 5 + frameLength + 2 > length)
+    {
+        return true;
+    }
+    uint8_t checksum = 0;
+    for (uint8_t i = 0; i <= frameLength; i++)
+    {
+        checksum += frame[5 + i];
+    }
+    if (checksum != 0 || frame[5] != PN532_HOST_TO_PN532)
+    {
+        return true;
+    }
+
+    commandCount++;
+    ackPending = true;
+    responsePending = false;
+    listingDeferred = false;
+    readyAtUs = micros() + frameLatencyUs;
+
+    processCommand(frame + 6, frameLength - 1);
+    return true;
+}
+
+bool PN532EmulatorTransport::readFrame(uint8_t *buffer, uint8_t length)
+{
+    memset(buffer, 0, length);
+
+    if (ackPending)
+    {
+        memcpy(buffer, emuAck, length < sizeof(emuAck) ? length : sizeof(emuAck));
+        ackPending = false;
+        readyAtUs = micros() + frameLatencyUs;
+        return true;
+    }
+
+    if (responsePending)
+    {
+        memcpy(buffer, response, length < responseLength ? length : responseLength);
+        responsePending = false;
+        return true;
+    }
+
+    return false;
+}
+
+// =============================================
+// COMMAND PROCESSING
+// =============================================
+
+void PN532EmulatorTransport::queueResponse(uint8_t command, const uint8_t *data, uint16_t length)
+{
+    uint8_t frameLength = length + 2;   // TFI + command code
+    uint8_t checksum = PN532_PN532_TO_HOST + command + 1;
+    uint16_t index = 0;
+
+    response[index++] = 0x00;
+    response[index++] = 0x00;
+    response[index++] = 0xFF;
+    response[index++] = frameLength;
+    response[index++] = (uint8_t)(~frameLength + 1);
+    response[index++] = PN532_PN532_TO_HOST;
+    response[index++] = command + 1;
+    for (uint16_t i = 0; i < length; i++)
+    {
+        response[index++] = data[i];
+        checksum += data[i];
+    }
+    response[index++] = (uint8_t)(~checksum + 1);
+    response[index++] = 0x00;
+    responseLength = index;
+
+    frameCount++;
+    if (corruptFrameEvery != 0 && frameCount % corruptFrameEvery == 0)
+    {
+        response[index - 2] ^= 0xFF;
+        errorsInjected++;
+    }
+    responsePending = true;
+}
+
+void PN532EmulatorTransport::processCommand(const uint8_t *command, uint8_t length)
+{
+    switch (command[0])
+    {
+    case PN532_COMMAND_GETFIRMWAREVERSION:
+    {
+        // PN532, firmware 1.6, ISO14443A/B and ISO18092 support
+        uint8_t version[] = {0x32, 0x01, 0x06, 0x07};
+        queueResponse(command[0], version, sizeof(version));
+        break;
+    }
+
+    case PN532_COMMAND_RFCONFIGURATION:
+        if (length >= 5 && command[1] == 0x05)
+        {
+            maxRetries = command[4];
+        }
+        queueResponse(command[0], NULL, 0);
+        break;
+
+    case PN532_COMMAND_INLISTPASSIVETARGET:
+        cardSelected = false;
+        authenticatedSector = -1;
+        if (cardPresent)
+        {
+            listTarget();
+        }
+        else if (maxRetries == 0xFF)
+        {
+            listingDeferred = true;     // Answers once a card is inserted
+        }
+        else
+        {
+            uint8_t none[] = {0x00};
+            queueResponse(command[0], none, sizeof(none));
+        }
+        break;
+
+    case PN532_COMMAND_INDATAEXCHANGE:
+        if (length < 2)
+        {
+            queueExchangeStatus(EMU_STATUS_TIMEOUT);
+            break;
+        }
+        processDataExchange(command + 2, length - 2);
+        break;
+
+    default:
+        // SAMConfiguration and anything not emulated just succeed
+        queueResponse(command[0], NULL, 0);
+        break;
+    }
+}
+
+void PN532EmulatorTransport::listTarget()
+{
+    uint8_t data[6 + sizeof(card.uid)];
+    data[0] = 1;    // NbTg
+    data[1] = 1;    // Tg
+    data[2] = card.sensRes >> 8;
+    data[3] = card.sensRes & 0xFF;
+    data[4] = card.sak;
+    data[5] = card.uidLength;
+    memcpy(data + 6, card.uid, card.uidLength);
+
+    cardSelected = true;
+    authenticatedSector = -1;
+    queueResponse(PN532_COMMAND_INLISTPASSIVETARGET, data, 6 + card.uidLength);
+}
+
+void PN532EmulatorTransport::queueExchangeStatus(uint8_t status)
+{
+    queueResponse(PN532_COMMAND_INDATAEXCHANGE, &status, 1);
+}
+
+void PN532EmulatorTransport::nak()
+{
+    // A NAK leaves the card in IDLE until it is selected again
+    cardSelected = false;
+    authenticatedSector = -1;
+    queueExchangeStatus(EMU_STATUS_TIMEOUT);
+}
+
+void PN532EmulatorTransport::processDataExchange(const uint8_t *data, uint8_t length)
+{
+    exchangeCount++;
+
+    if (!cardPresent || !cardSelected || length < 2)
+    {
+        queueExchangeStatus(EMU_STATUS_TIMEOUT);
+        return;
+    }
+
+    if (exchangeErrorEvery != 0 && exchangeCount % exchangeErrorEvery == 0)
+    {
+        errorsInjected++;
+        nak();
+        return;
+    }
+
+    uint8_t reply[1 + PN532_EMULATOR_FRAME_MAX - 12];
+    reply[0] = EMU_STATUS_OK;
+
+    switch (data[0])
+    {
+    case MIFARE_CMD_AUTH_A:
+    case MIFARE_CMD_AUTH_B:
+    {
+        uint8_t block = data[1];
+        if (!card.isClassic() || length < 12 || block * 16 >= card.memorySize)
+        {
+            nak();
+            return;
+        }
+        uint8_t sector = sectorOf(block);
+        const uint8_t *trailer = card.memory + trailerOf(sector) * 16;
+        const uint8_t *key = (data[0] == MIFARE_CMD_AUTH_A) ? trailer : trailer + 10;
+        if (memcmp(data + 2, key, 6) != 0 || memcmp(data + 8, card.uid, 4) != 0)
+        {
+            cardSelected = false;
+            authenticatedSector = -1;
+            queueExchangeStatus(EMU_STATUS_AUTH);
+            return;
+        }
+        authenticatedSector = sector;
+        queueResponse(PN532_COMMAND_INDATAEXCHANGE, reply, 1);
+        return;
+    }
+
+    case MIFARE_CMD_READ:
+    {
+        if (card.isClassic())
+        {
+            uint8_t block = data[1];
+            if (block * 16 >= card.memorySize || sectorOf(block) != authenticatedSector)
+            {
+                nak();
+                return;
+            }
+            memcpy(reply + 1, card.memory + block * 16, 16);
+            if (block == trailerOf(authenticatedSector))
+            {
+                memset(reply + 1, 0, 6);    // Key A never reads back
+            }
+        }
+        else
+        {
+            // Four pages, rolling over at the end of memory like the tag does
+            uint16_t pages = card.memorySize / NTAG_PAGE_SIZE;
+            if (data[1] >= pages)
+            {
+                nak();
+                return;
+            }
+            for (uint8_t i = 0; i < 16; i++)
+            {
+                reply[1 + i] = card.memory[(data[1] * NTAG_PAGE_SIZE + i) % card.memorySize];
+            }
+        }
+        queueResponse(PN532_COMMAND_INDATAEXCHANGE, reply, 17);
+        return;
+    }
+
+    case NTAG_CMD_FAST_READ:
+    {
+        uint16_t pages = card.memorySize / NTAG_PAGE_SIZE;
+        if (card.isClassic() || !card.fastRead || length < 3 || data[2] < data[1] || data[2] >= pages)
+        {
+            nak();
+            return;
+        }
+        uint16_t bytes = (data[2] - data[1] + 1) * NTAG_PAGE_SIZE;
+        if (bytes + 1 > (uint16_t)sizeof(reply))
+        {
+            nak();
+            return;
+        }
+        memcpy(reply + 1, card.memory + data[1] * NTAG_PAGE_SIZE, bytes);
+        queueResponse(PN532_COMMAND_INDATAEXCHANGE, reply, bytes + 1);
+        return;
+    }
+
+    default:
+        nak();
+        return;
+    }
+}
+
+uint8_t PN532EmulatorTransport::sectorOf(uint8_t block)
+{
+    if (block < 128)
+    {
+        return block / 4;
+    }
+    return 32 + (block - 128) / 16;
+}
+
+uint8_t PN532EmulatorTransport::trailerOf(uint8_t sector)
+{
+    if (sector < 32)
+    {
+        return sector * 4 + 3;
+    }
+    return 128 + (sector - 32) * 16 + 15;
+}
+
+// =============================================
+// CARD IMAGES
+// =============================================
+
+bool PN532EmulatorTransport::loadClassicDump(const uint8_t *dump, uint16_t length)
+{
+    if (length < 64 || length > PN532_EMULATOR_MAX_IMAGE || length % 16 != 0)
+    {
+        return false;
+    }
+
+    removeCard();
+    memset(&card, 0, sizeof(card));
+    memcpy(card.memory, dump, length);
+    card.memorySize = length;
+
+    // Manufacturer block: UID0-3, BCC, SAK, ATQA (LSB first)
+    memcpy(card.uid, dump, 4);
+    card.uidLength = 4;
+    card.sak = dump[5];
+    card.sensRes = ((uint16_t)dump[7] << 8) | dump[6];
+    return true;
+}
+
+bool PN532EmulatorTransport::loadType2Dump(const uint8_t *dump, uint16_t length, bool fastRead)
+{
+    if (length < 16 || length > PN532_EMULATOR_MAX_IMAGE || length % NTAG_PAGE_SIZE != 0)
+    {
+        return false;
+    }
+
+    removeCard();
+    memset(&card, 0, sizeof(card));
+    memcpy(card.memory, dump, length);
+    card.memorySize = length;
+
+    // Pages 0-1: UID0-2, BCC0, UID3-6
+    card.uid[0] = dump[0];
+    card.uid[1] = dump[1];
+    card.uid[2] = dump[2];
+    memcpy(card.uid + 3, dump + 4, 4);
+    card.uidLength = 7;
+    card.sak = 0x00;
+    card.sensRes = 0x0044;
+    card.fastRead = fastRead;
+    return true;
+}
+
+bool PN532EmulatorTransport::createSantriCard(bool classic, const uint8_t *uid, uint8_t uidLength, const char *ndefText)
+{
+    uint8_t image[CLASSIC_1K_SIZE];
+    uint16_t imageSize = classic ? CLASSIC_1K_SIZE : NTAG215_SIZE;
+    memset(image, 0, sizeof(image));
+
+    if (classic)
+    {
+        if (uidLength != 4)
+        {
+            return false;
+        }
+        memcpy(image, uid, 4);
+        image[4] = uid[0] ^ uid[1] ^ uid[2] ^ uid[3];
+        image[5] = 0x08;
+        image[6] = 0x04;
+        image[7] = 0x00;
+
+        // MAD key on sector 0, NFC Forum key on the data sectors
+        for (uint8_t sector = 0; sector < 16; sector++)
+        {
+            uint8_t *trailer = image + trailerOf(sector) * 16;
+            memcpy(trailer, sector == 0 ? madKey : ndefKey, 6);
+            trailer[6] = 0x7F;
+            trailer[7] = 0x07;
+            trailer[8] = 0x88;
+            trailer[9] = 0x40;
+            memset(trailer + 10, 0xFF, 6);
+        }
+    }
+    else
+    {
+        if (uidLength != 7)
+        {
+            return false;
+        }
+        image[0] = uid[0];
+        image[1] = uid[1];
+        image[2] = uid[2];
+        image[3] = 0x88 ^ uid[0] ^ uid[1] ^ uid[2];
+        memcpy(image + 4, uid + 3, 4);
+        image[8] = uid[3] ^ uid[4] ^ uid[5] ^ uid[6];
+        image[9] = 0x48;
+        // Capability container for NTAG215
+        image[12] = 0xE1;
+        image[13] = 0x10;
+        image[14] = 0x3E;
+        image[15] = 0x00;
+    }
+
+    // NDEF Text record ("en") wrapped in a TLV, short record if it fits
+    uint32_t textLength = strlen(ndefText);
+    uint32_t payloadLength = 3 + textLength;
+    uint8_t header[12];
+    uint8_t headerLength = 0;
+    bool shortRecord = payloadLength <= 0xFF;
+    header[headerLength++] = shortRecord ? 0xD1 : 0xC1;
+    header[headerLength++] = 0x01;
+    if (shortRecord)
+    {
+        header[headerLength++] = payloadLength;
+    }
+    else
+    {
+        header[headerLength++] = payloadLength >> 24;
+        header[headerLength++] = payloadLength >> 16;
+        header[headerLength++] = payloadLength >> 8;
+        header[headerLength++] = payloadLength & 0xFF;
+    }
+    header[headerLength++] = 'T';
+    header[headerLength++] = 0x02;
+    header[headerLength++] = 'e';
+    header[headerLength++] = 'n';
+
+    uint32_t messageLength = headerLength - 3 + payloadLength;
+    uint8_t tlv[4];
+    uint8_t tlvLength = 0;
+    tlv[tlvLength++] = 0x03;
+    if (messageLength < 0xFF)
+    {
+        tlv[tlvLength++] = messageLength;
+    }
+    else
+    {
+        tlv[tlvLength++] = 0xFF;
+        tlv[tlvLength++] = messageLength >> 8;
+        tlv[tlvLength++] = messageLength & 0xFF;
+    }
+
+    // Lay the bytes over the data area, stepping over Classic trailers
+    uint16_t position = classic ? 4 * 16 : 4 * NTAG_PAGE_SIZE;
+    uint16_t limit = classic ? CLASSIC_1K_SIZE : NTAG215_USER_END;
+    uint32_t total = tlvLength + headerLength + textLength + 1;
+    for (uint32_t i = 0; i < total; i++)
+    {
+        if (classic && position % 64 == 48)
+        {
+            position += 16;
+        }
+        if (position >= limit)
+        {
+            return false;
+        }
+
+        uint8_t b;
+        if (i < tlvLength)
+        {
+            b = tlv[i];
+        }
+        else if (i < (uint32_t)tlvLength + headerLength)
+        {
+            b = header[i - tlvLength];
+        }
+        else if (i < total - 1)
+        {
+            b = ndefText[i - tlvLength - headerLength];
+        }
+        else
+        {
+            b = 0xFE;   // Terminator TLV
+        }
+        image[position++] = b;
+    }
+
+    if (classic)
+    {
+        return loadClassicDump(image, imageSize);
+    }
+    return loadType2Dump(image, imageSize, true);
+}
+
+void PN532EmulatorTransport::removeCard()
+{
+    cardPresent = false;
+    cardSelected = false;
+    authenticatedSector = -1;
+}
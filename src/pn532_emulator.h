@@ -0,0 +1,107 @@
+#ifndef PN532_EMULATOR_H
+#define PN532_EMULATOR_H
+
+#include <Arduino.h>
+#include "pn532_transport.h"
+
+#define PN532_EMULATOR_MAX_IMAGE    4096    // Up to Classic 4K
+#define PN532_EMULATOR_FRAME_MAX    264
+
+// =============================================
+// EMULATED CARD
+// =============================================
+
+// Memory image of one ISO14443A card. Classic images are 16-byte blocks
+// with keys in the sector trailers, Type 2 images are 4-byte pages, both
+// in the layout of a raw dump (UID in block 0 / pages 0-2).
+struct EmulatedCard {
+    uint16_t sensRes;
+    uint8_t sak;
+    uint8_t uid[7];
+    uint8_t uidLength;
+    bool fastRead;          // Type 2 only: answers FAST_READ
+    uint16_t memorySize;
+    uint8_t memory[PN532_EMULATOR_MAX_IMAGE];
+
+    bool isClassic() const { return (sak & 0x08) != 0; }
+};
+
+// =============================================
+// PN532 EMULATOR TRANSPORT
+// =============================================
+
+// Software PN532 behind the PN532Transport interface. It decodes the same
+// host frames the chip gets over I2C/SPI and answers GetFirmwareVersion,
+// SAMConfiguration, RFConfiguration, InListPassiveTarget and InDataExchange
+// (Classic auth/READ, Type 2 READ/FAST_READ) from a loaded card image.
+// Every ACK and response frame is held back by a configurable latency, and
+// errors can be injected at a fixed rate so read strategies can be timed
+// and compared without a reader attached.
+class PN532EmulatorTransport : public PN532Transport {
+private:
+    EmulatedCard card;
+    bool cardPresent;
+    bool cardSelected;      // Listed and not halted by a NAK
+    int authenticatedSector;
+    uint8_t maxRetries;     // MxRtyPassiveActivation, 0xFF waits for a card
+
+    // Frames waiting for the host
+    bool ackPending;
+    bool responsePending;
+    bool listingDeferred;   // InListPassiveTarget waiting for a card
+    unsigned long readyAtUs;
+    unsigned long frameLatencyUs;
+    uint8_t response[PN532_EMULATOR_FRAME_MAX];
+    uint16_t responseLength;
+
+    // Error injection
+    uint16_t exchangeErrorEvery;
+    uint16_t corruptFrameEvery;
+    uint32_t exchangeCount;
+    uint32_t frameCount;
+    uint32_t commandCount;
+    uint32_t errorsInjected;
+
+    void processCommand(const uint8_t* command, uint8_t length);
+    void processDataExchange(const uint8_t* data, uint8_t length);
+    void listTarget();
+    void queueResponse(uint8_t command, const uint8_t* data, uint16_t length);
+    void queueExchangeStatus(uint8_t status);
+    void nak();
+
+    static uint8_t sectorOf(uint8_t block);
+    static uint8_t trailerOf(uint8_t sector);
+
+public:
+    PN532EmulatorTransport();
+
+    // PN532Transport
+    bool begin() override;
+    void wakeup() override;
+    bool isReady() override;
+    bool writeFrame(const uint8_t* frame, uint8_t length) override;
+    bool readFrame(uint8_t* buffer, uint8_t length) override;
+    const char* getName() const override { return "Emulator"; }
+
+    // Card images
+    bool loadClassicDump(const uint8_t* dump, uint16_t length);
+    bool loadType2Dump(const uint8_t* dump, uint16_t length, bool fastRead = true);
+    bool createSantriCard(bool classic, const uint8_t* uid, uint8_t uidLength, const char* ndefText);
+    void insertCard() { cardPresent = card.memorySize > 0; }
+    void removeCard();
+    bool isCardPresent() const { return cardPresent; }
+    EmulatedCard& getCard() { return card; }
+
+    // Timing and fault injection
+    void setFrameLatencyUs(unsigned long latencyUs) { frameLatencyUs = latencyUs; }
+    void setExchangeErrorEvery(uint16_t every) { exchangeErrorEvery = every; }   // 0 = off
+    void setCorruptFrameEvery(uint16_t every) { corruptFrameEvery = every; }     // 0 = off
+
+    // Counters
+    uint32_t getCommandCount() const { return commandCount; }
+    uint32_t getExchangeCount() const { return exchangeCount; }
+    uint32_t getErrorsInjected() const { return errorsInjected; }
+    void resetCounters();
+};
+
+#endif // PN532_EMULATOR_H
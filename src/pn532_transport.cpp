@@ -0,0 +1,169 @@
+#include "pn532_transport.h"
+#include "config.h"
+
+// =============================================
+// I2C TRANSPORT
+// =============================================
+
+#define PN532_I2C_READY 0x01
+
+PN532I2CTransport::PN532I2CTransport(TwoWire *wire, int8_t irqPin) : wire(wire), irqPin(irqPin), irqSeen(false)
+{
+}
+
+bool PN532I2CTransport::begin()
+{
+    if (irqPin >= 0)
+    {
+        pinMode(irqPin, INPUT_PULLUP);
+    }
+    return wire->begin(I2C_SDA_PIN, I2C_SCL_PIN);
+}
+
+void PN532I2CTransport::wakeup()
+{
+    // The PN532 wakes on its own address, give it time to come up
+    delay(10);
+}
+
+bool PN532I2CTransport::isReady()
+{
+    if (irqPin >= 0 && digitalRead(irqPin) == LOW)
+    {
+        irqSeen = true;
+        return true;
+    }
+    if (irqSeen)
+    {
+        return false;
+    }
+
+    // Without a (working) IRQ line the status byte has to be polled over
+    // the bus. IRQ stays low until the frame is read, so a wired line
+    // shows up here on the first response.
+    if (wire->requestFrom((uint8_t)PN532_I2C_ADDRESS, (size_t)1) != 1)
+    {
+        return false;
+    }
+    bool ready = (wire->read() & PN532_I2C_READY) != 0;
+    irqSeen = ready && irqPin >= 0 && digitalRead(irqPin) == LOW;
+    return ready;
+}
+
+bool PN532I2CTransport::writeFrame(const uint8_t *frame, uint8_t length)
+{
+    wire->beginTransmission(PN532_I2C_ADDRESS);
+    wire->write(frame, length);
+    return wire->endTransmission() == 0;
+}
+
+bool PN532I2CTransport::readFrame(uint8_t *buffer, uint8_t length)
+{
+    // Every I2C read starts again with the status byte
+    size_t expected = (size_t)length + 1;
+    if (wire->requestFrom((uint8_t)PN532_I2C_ADDRESS, expected) != expected)
+    {
+        return false;
+    }
+
+    if ((wire->read() & PN532_I2C_READY) == 0)
+    {
+        return false;
+    }
+
+    for (uint8_t i = 0; i < length; i++)
+    {
+        buffer[i] = wire->read();
+    }
+    return true;
+}
+
+// =============================================
+// SPI TRANSPORT
+// =============================================
+
+#define PN532_SPI_STATUS_READ   0x02
+#define PN532_SPI_DATA_WRITE    0x01
+#define PN532_SPI_DATA_READ     0x03
+#define PN532_SPI_READY         0x01
+
+PN532SPITransport::PN532SPITransport(SPIClass *spi, int8_t ssPin, int8_t sckPin, int8_t misoPin, int8_t mosiPin,
+                                     uint32_t clockHz, int8_t irqPin)
+    : spi(spi), settings(clockHz, LSBFIRST, SPI_MODE0), ssPin(ssPin), sckPin(sckPin), misoPin(misoPin),
+      mosiPin(mosiPin), irqPin(irqPin), irqSeen(false)
+{
+}
+
+bool PN532SPITransport::begin()
+{
+    pinMode(ssPin, OUTPUT);
+    digitalWrite(ssPin, HIGH);
+    if (irqPin >= 0)
+    {
+        pinMode(irqPin, INPUT_PULLUP);
+    }
+
+    // SS is driven by hand, the PN532 needs it low across a whole frame
+    spi->begin(sckPin, misoPin, mosiPin, -1);
+    return true;
+}
+
+void PN532SPITransport::wakeup()
+{
+    digitalWrite(ssPin, LOW);
+    delay(2);
+    digitalWrite(ssPin, HIGH);
+}
+
+bool PN532SPITransport::isReady()
+{
+    if (irqPin >= 0 && digitalRead(irqPin) == LOW)
+    {
+        irqSeen = true;
+        return true;
+    }
+    if (irqSeen)
+    {
+        return false;
+    }
+
+    // Status register poll until the IRQ line has proven to be wired
+    spi->beginTransaction(settings);
+    digitalWrite(ssPin, LOW);
+    spi->transfer(PN532_SPI_STATUS_READ);
+    uint8_t status = spi->transfer(0x00);
+    digitalWrite(ssPin, HIGH);
+    spi->endTransaction();
+
+    bool ready = (status & PN532_SPI_READY) != 0;
+    irqSeen = ready && irqPin >= 0 && digitalRead(irqPin) == LOW;
+    return ready;
+}
+
+bool PN532SPITransport::writeFrame(const uint8_t *frame, uint8_t length)
+{
+    spi->beginTransaction(settings);
+    digitalWrite(ssPin, LOW);
+    spi->transfer(PN532_SPI_DATA_WRITE);
+    for (uint8_t i = 0; i < length; i++)
+    {
+        spi->transfer(frame[i]);
+    }
+    digitalWrite(ssPin, HIGH);
+    spi->endTransaction();
+    return true;
+}
+
+bool PN532SPITransport::readFrame(uint8_t *buffer, uint8_t length)
+{
+    spi->beginTransaction(settings);
+    digitalWrite(ssPin, LOW);
+    spi->transfer(PN532_SPI_DATA_READ);
+    for (uint8_t i = 0; i < length; i++)
+    {
+        buffer[i] = spi->transfer(0x00);
+    }
+    digitalWrite(ssPin, HIGH);
+    spi->endTransaction();
+    return true;
+}
@@ -0,0 +1,91 @@
+#ifndef PN532_TRANSPORT_H
+#define PN532_TRANSPORT_H
+
+#include <Arduino.h>
+#include <Wire.h>
+#include <SPI.h>
+
+#define PN532_I2C_ADDRESS 0x24
+
+// =============================================
+// PN532 TRANSPORT INTERFACE
+// =============================================
+
+// Moves raw PN532 frames between the driver and the chip. Framing,
+// checksums and ACK handling live in PN532Driver, a transport only has to
+// know how its bus signals "response ready" and how to clock bytes.
+class PN532Transport {
+public:
+    virtual ~PN532Transport() {}
+
+    virtual bool begin() = 0;
+    virtual void wakeup() = 0;
+
+    // True when the PN532 has an ACK or response frame waiting
+    virtual bool isReady() = 0;
+
+    virtual bool writeFrame(const uint8_t* frame, uint8_t length) = 0;
+    // Reads length frame bytes (status/direction bytes already stripped)
+    virtual bool readFrame(uint8_t* buffer, uint8_t length) = 0;
+
+    virtual const char* getName() const = 0;
+
+    // True once the IRQ line has been seen signalling a response. Until
+    // then a transport with an IRQ pin also polls its status byte, so a
+    // board without the IRQ wire keeps working.
+    virtual bool hasWorkingIrq() const { return false; }
+};
+
+// =============================================
+// I2C TRANSPORT
+// =============================================
+
+class PN532I2CTransport : public PN532Transport {
+private:
+    TwoWire* wire;
+    int8_t irqPin;      // -1 polls the status byte over I2C instead
+    bool irqSeen;
+
+public:
+    PN532I2CTransport(TwoWire* wire, int8_t irqPin = -1);
+
+    bool begin() override;
+    void wakeup() override;
+    bool isReady() override;
+    bool writeFrame(const uint8_t* frame, uint8_t length) override;
+    bool readFrame(uint8_t* buffer, uint8_t length) override;
+    const char* getName() const override { return "I2C"; }
+    bool hasWorkingIrq() const override { return irqSeen; }
+};
+
+// =============================================
+// SPI TRANSPORT
+// =============================================
+
+// PN532 SPI is mode 0, LSB first, at most 5 MHz. The transport owns its
+// SPIClass so the reader is not on the LCD's I2C bus at all.
+class PN532SPITransport : public PN532Transport {
+private:
+    SPIClass* spi;
+    SPISettings settings;
+    int8_t ssPin;
+    int8_t sckPin;
+    int8_t misoPin;
+    int8_t mosiPin;
+    int8_t irqPin;      // -1 polls the status register instead
+    bool irqSeen;
+
+public:
+    PN532SPITransport(SPIClass* spi, int8_t ssPin, int8_t sckPin, int8_t misoPin, int8_t mosiPin,
+                      uint32_t clockHz, int8_t irqPin = -1);
+
+    bool begin() override;
+    void wakeup() override;
+    bool isReady() override;
+    bool writeFrame(const uint8_t* frame, uint8_t length) override;
+    bool readFrame(uint8_t* buffer, uint8_t length) override;
+    const char* getName() const override { return "SPI"; }
+    bool hasWorkingIrq() const override { return irqSeen; }
+};
+
+#endif // PN532_TRANSPORT_H
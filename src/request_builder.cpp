@@ -0,0 +1,140 @@
+#include "request_builder.h"
+
+// =============================================
+// CLASS IMPLEMENTATION
+// =============================================
+
+RequestBuilder::RequestBuilder(char *storage, size_t size)
+    : buffer(storage), capacity(size), format(BODY_URLENCODED), fieldCount(0)
+{
+    reset();
+}
+
+void RequestBuilder::reset()
+{
+    used = 0;
+    overflowed = false;
+    buffer[0] = '\0';
+}
+
+RequestBuilder &RequestBuilder::append(const char *text, size_t length)
+{
+    // One byte is kept for the terminator
+    size_t room = capacity - 1 - used;
+    if (length > room)
+    {
+        length = room;
+        overflowed = true;
+    }
+    memcpy(buffer + used, text, length);
+    used += length;
+    buffer[used] = '\0';
+    return *this;
+}
+
+RequestBuilder &RequestBuilder::append(const char *text)
+{
+    return append(text, strlen(text));
+}
+
+RequestBuilder &RequestBuilder::append(char c)
+{
+    return append(&c, 1);
+}
+
+RequestBuilder &RequestBuilder::appendNumber(uint32_t value)
+{
+    char digits[11];
+    int length = snprintf(digits, sizeof(digits), "%lu", (unsigned long)value);
+    return append(digits, length);
+}
+
+RequestBuilder &RequestBuilder::appendEncoded(const char *text)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    for (; *text; text++)
+    {
+        char c = *text;
+        if (isalnum((unsigned char)c) || c == '-' || c == '_' || c == '.' || c == '~')
+        {
+            append(c);
+        }
+        else
+        {
+            char escaped[3] = {'%', hex[(uint8_t)c >> 4], hex[(uint8_t)c & 0x0F]};
+            append(escaped, 3);
+        }
+    }
+    return *this;
+}
+
+RequestBuilder &RequestBuilder::appendCsvField(const char *text)
+{
+    // RFC 4180: a field with a separator, quote or line break is quoted,
+    // quotes inside it are doubled
+    if (strpbrk(text, ",\"\r\n") == nullptr)
+    {
+        return append(text);
+    }
+
+    append('"');
+    for (; *text; text++)
+    {
+        if (*text == '"')
+        {
+            append('"');
+        }
+        append(*text);
+    }
+    return append('"');
+}
+
+void RequestBuilder::beginForm(BodyFormat bodyFormat)
+{
+    format = bodyFormat;
+    fieldCount = 0;
+}
+
+void RequestBuilder::addField(const char *name, const char *value)
+{
+    if (format == BODY_MULTIPART)
+    {
+        append("--" REQUEST_FORM_BOUNDARY "\r\nContent-Disposition: form-data; name=\"");
+        append(name);
+        append("\"\r\n\r\n");
+        append(value);
+        append("\r\n");
+    }
+    else
+    {
+        if (fieldCount > 0)
+        {
+            append('&');
+        }
+        appendEncoded(name);
+        append('=');
+        appendEncoded(value);
+    }
+    fieldCount++;
+}
+
+void RequestBuilder::addField(const char *name, uint32_t value)
+{
+    char digits[11];
+    snprintf(digits, sizeof(digits), "%lu", (unsigned long)value);
+    addField(name, digits);
+}
+
+void RequestBuilder::endForm()
+{
+    if (format == BODY_MULTIPART)
+    {
+        append("--" REQUEST_FORM_BOUNDARY "--\r\n");
+    }
+}
+
+const char *RequestBuilder::contentType(BodyFormat bodyFormat)
+{
+    return bodyFormat == BODY_MULTIPART ? "multipart/form-data; boundary=" REQUEST_FORM_BOUNDARY
+                                        : "application/x-www-form-urlencoded";
+}
@@ -0,0 +1,71 @@
+#ifndef REQUEST_BUILDER_H
+#define REQUEST_BUILDER_H
+
+#include <Arduino.h>
+#include "config.h"
+
+#define REQUEST_FORM_BOUNDARY   "----SantriReaderBoundary"
+
+// Encoding of form fields, see API_BODY_FORMAT
+enum BodyFormat {
+    BODY_MULTIPART,         // multipart/form-data
+    BODY_URLENCODED         // application/x-www-form-urlencoded, also for query strings
+};
+
+// =============================================
+// REQUEST BUILDER CLASS
+// =============================================
+
+// Formats URLs, request bodies and whole HTTP requests into a fixed buffer
+// that is reused for every request, so building one never touches the
+// heap. Text that does not fit is cut off and flags the builder as
+// overflowed; such a request must not be sent. The buffer is provided by
+// RequestBuffer below, so builders of different sizes share one interface.
+class RequestBuilder {
+public:
+    RequestBuilder(char* storage, size_t size);
+    // Copies would write into the original's buffer
+    RequestBuilder(const RequestBuilder&) = delete;
+    RequestBuilder& operator=(const RequestBuilder&) = delete;
+
+    void reset();
+    RequestBuilder& append(const char* text);
+    RequestBuilder& append(const char* text, size_t length);
+    RequestBuilder& append(char c);
+    RequestBuilder& appendNumber(uint32_t value);
+    // Percent-encodes everything but unreserved characters (RFC 3986)
+    RequestBuilder& appendEncoded(const char* text);
+    // One text/csv field, quoted when it holds , " or a line break
+    RequestBuilder& appendCsvField(const char* text);
+
+    // Form fields in the chosen encoding: beginForm(), addField()..., endForm()
+    void beginForm(BodyFormat format);
+    void addField(const char* name, const char* value);
+    void addField(const char* name, uint32_t value);
+    void endForm();
+    static const char* contentType(BodyFormat format);
+
+    const char* c_str() const { return buffer; }
+    size_t length() const { return used; }
+    bool isOverflowed() const { return overflowed; }
+
+private:
+    char* buffer;
+    size_t capacity;
+    size_t used;
+    bool overflowed;
+    BodyFormat format;
+    uint8_t fieldCount;
+};
+
+// A RequestBuilder with its own Size-byte buffer
+template <size_t Size>
+class RequestBuffer : public RequestBuilder {
+public:
+    RequestBuffer() : RequestBuilder(storage, Size) {}
+
+private:
+    char storage[Size];
+};
+
+#endif // REQUEST_BUILDER_H
@@ -0,0 +1,370 @@
+#include "roster_store.h"
+#include <esp_crc.h>
+
+// =============================================
+// CLASS IMPLEMENTATION
+// =============================================
+
+RosterStore::RosterStore() : partition(nullptr), mutex(nullptr), halfSize(0), activeHalf(-1), entries(nullptr),
+    mapHandle(0), updating(false), updateFailed(false), updateHalf(0), headerBytes(0), entriesReceived(0),
+    updateCrc(0), writeOffset(0), bufferLength(0), lookups(0), localAnswers(0)
+{
+    memset(&activeHeader, 0, sizeof(activeHeader));
+    memset(&updateHeader, 0, sizeof(updateHeader));
+    memset(lastKey, 0, sizeof(lastKey));
+}
+
+bool RosterStore::begin()
+{
+    mutex = xSemaphoreCreateMutex();
+    if (mutex == NULL)
+    {
+        return false;
+    }
+
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t)ROSTER_PARTITION_SUBTYPE,
+                                         ROSTER_PARTITION_LABEL);
+    if (partition == nullptr)
+    {
+        Serial.println("No roster partition - validation stays online only");
+        return false;
+    }
+    halfSize = (partition->size / 2) & ~(partition->erase_size - 1);
+
+    // Newest half that checks out completely
+    RosterHeader headers[2];
+    bool valid[2];
+    for (uint8_t half = 0; half < 2; half++)
+    {
+        valid[half] = readHeader(half, headers[half]) && checkHeader(headers[half]);
+    }
+
+    for (uint8_t attempt = 0; attempt < 2 && activeHalf < 0; attempt++)
+    {
+        int8_t best = -1;
+        for (uint8_t half = 0; half < 2; half++)
+        {
+            if (valid[half] && (best < 0 || headers[half].generation > headers[best].generation))
+            {
+                best = half;
+            }
+        }
+        if (best < 0)
+        {
+            break;
+        }
+
+        if (mapHalf(best, headers[best]) && checkEntries(headers[best]))
+        {
+            break;
+        }
+
+        Serial.printf("Roster half %d failed its CRC check\n", best);
+        valid[best] = false;
+        if (entries != nullptr)
+        {
+            esp_partition_munmap(mapHandle);
+            entries = nullptr;
+        }
+        activeHalf = -1;
+    }
+
+    if (isLoaded())
+    {
+        Serial.printf("Roster v%lu loaded: %lu entries (half %d)\n", (unsigned long)activeHeader.version,
+                      (unsigned long)activeHeader.entryCount, activeHalf);
+    }
+    else
+    {
+        Serial.println("Roster partition empty, waiting for a download");
+    }
+    return true;
+}
+
+bool RosterStore::readHeader(uint8_t half, RosterHeader &header)
+{
+    return esp_partition_read(partition, halfOffset(half), &header, sizeof(header)) == ESP_OK;
+}
+
+bool RosterStore::checkHeader(const RosterHeader &header) const
+{
+    return header.magic == ROSTER_MAGIC && header.formatVersion == ROSTER_FORMAT_VERSION &&
+           header.entrySize == sizeof(RosterEntry) && header.entryCount <= maxEntries() &&
+           header.headerCrc == headerCrc(header);
+}
+
+bool RosterStore::mapHalf(uint8_t half, const RosterHeader &header)
+{
+    const void *mapped = nullptr;
+    esp_partition_mmap_handle_t handle;
+    if (esp_partition_mmap(partition, halfOffset(half), halfSize, ESP_PARTITION_MMAP_DATA, &mapped, &handle) != ESP_OK)
+    {
+        return false;
+    }
+
+    // Lookups may be running on another task, swap under the mutex
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    bool hadMapping = entries != nullptr;
+    esp_partition_mmap_handle_t oldHandle = mapHandle;
+    entries = (const RosterEntry *)((const uint8_t *)mapped + sizeof(RosterHeader));
+    mapHandle = handle;
+    activeHeader = header;
+    activeHalf = half;
+    xSemaphoreGive(mutex);
+
+    if (hadMapping)
+    {
+        esp_partition_munmap(oldHandle);
+    }
+    return true;
+}
+
+bool RosterStore::checkEntries(const RosterHeader &header)
+{
+    return esp_crc32_le(0, (const uint8_t *)entries, header.entryCount * sizeof(RosterEntry)) == header.entriesCrc;
+}
+
+uint32_t RosterStore::headerCrc(const RosterHeader &header)
+{
+    return esp_crc32_le(0, (const uint8_t *)&header, offsetof(RosterHeader, headerCrc));
+}
+
+// =============================================
+// LOOKUP
+// =============================================
+
+RosterLookup RosterStore::lookup(const uint8_t *uid, uint8_t uidLength, const String &induk)
+{
+    if (!isLoaded() || uidLength > sizeof(((RosterEntry *)0)->uid))
+    {
+        return ROSTER_NOT_FOUND;
+    }
+
+    uint8_t key[8] = {0};
+    memcpy(key, uid, uidLength);
+    key[7] = uidLength;
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    lookups++;
+
+    // Binary search straight over the mapped flash
+    const RosterEntry *found = nullptr;
+    uint32_t low = 0;
+    uint32_t high = activeHeader.entryCount;
+    while (low < high)
+    {
+        uint32_t middle = low + (high - low) / 2;
+        int order = memcmp(&entries[middle], key, sizeof(key));
+        if (order == 0)
+        {
+            found = &entries[middle];
+            break;
+        }
+        if (order < 0)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    RosterLookup result = ROSTER_NOT_FOUND;
+    if (found != nullptr)
+    {
+        bool sameInduk = induk.length() < ROSTER_INDUK_LENGTH &&
+                         strncmp(found->induk, induk.c_str(), ROSTER_INDUK_LENGTH) == 0;
+        result = (sameInduk && found->status == ROSTER_STATUS_ACTIVE) ? ROSTER_VALID : ROSTER_INVALID;
+        localAnswers++;
+    }
+
+    xSemaphoreGive(mutex);
+    return result;
+}
+
+// =============================================
+// STREAMED UPDATE
+// =============================================
+
+bool RosterStore::beginUpdate()
+{
+    if (!isAvailable())
+    {
+        return false;
+    }
+
+    updating = true;
+    updateFailed = false;
+    updateHalf = isLoaded() ? 1 - activeHalf : 0;
+    headerBytes = 0;
+    entriesReceived = 0;
+    updateCrc = 0;
+    writeOffset = halfOffset(updateHalf) + sizeof(RosterHeader);
+    bufferLength = 0;
+    memset(lastKey, 0, sizeof(lastKey));
+    memset(&updateHeader, 0, sizeof(updateHeader));
+    return true;
+}
+
+bool RosterStore::failUpdate(const char *reason)
+{
+    Serial.printf("Roster update failed: %s\n", reason);
+    updateFailed = true;
+    return false;
+}
+
+bool RosterStore::flushBuffer()
+{
+    if (bufferLength == 0)
+    {
+        return true;
+    }
+    if (esp_partition_write(partition, writeOffset, writeBuffer, bufferLength) != ESP_OK)
+    {
+        return failUpdate("flash write error");
+    }
+    writeOffset += bufferLength;
+    bufferLength = 0;
+    return true;
+}
+
+size_t RosterStore::writeUpdate(const uint8_t *data, size_t length)
+{
+    if (!updating || updateFailed)
+    {
+        return 0;
+    }
+
+    size_t index = 0;
+
+    // Header first: check it and erase only as much flash as it needs
+    while (headerBytes < sizeof(RosterHeader) && index < length)
+    {
+        ((uint8_t *)&updateHeader)[headerBytes++] = data[index++];
+        if (headerBytes < sizeof(RosterHeader))
+        {
+            continue;
+        }
+
+        if (updateHeader.magic != ROSTER_MAGIC || updateHeader.formatVersion != ROSTER_FORMAT_VERSION ||
+            updateHeader.entrySize != sizeof(RosterEntry))
+        {
+            failUpdate("unknown roster format");
+            return 0;
+        }
+        if (updateHeader.entryCount > maxEntries())
+        {
+            failUpdate("roster larger than the partition");
+            return 0;
+        }
+
+        uint32_t eraseSize = sizeof(RosterHeader) + updateHeader.entryCount * sizeof(RosterEntry);
+        eraseSize = (eraseSize + partition->erase_size - 1) & ~(partition->erase_size - 1);
+        if (esp_partition_erase_range(partition, halfOffset(updateHalf), eraseSize) != ESP_OK)
+        {
+            failUpdate("flash erase error");
+            return 0;
+        }
+    }
+
+    // Entries, checked for order as they pass so binary search stays valid
+    while (index < length)
+    {
+        if (entriesReceived >= updateHeader.entryCount)
+        {
+            failUpdate("more entries than announced");
+            return 0;
+        }
+
+        writeBuffer[bufferLength++] = data[index++];
+        if (bufferLength % sizeof(RosterEntry) != 0)
+        {
+            continue;
+        }
+
+        const uint8_t *entry = writeBuffer + bufferLength - sizeof(RosterEntry);
+        if (entriesReceived > 0 && memcmp(lastKey, entry, sizeof(lastKey)) >= 0)
+        {
+            failUpdate("entries not sorted by UID");
+            return 0;
+        }
+        memcpy(lastKey, entry, sizeof(lastKey));
+        updateCrc = esp_crc32_le(updateCrc, entry, sizeof(RosterEntry));
+        entriesReceived++;
+
+        if (bufferLength == sizeof(writeBuffer) && !flushBuffer())
+        {
+            return 0;
+        }
+    }
+    return length;
+}
+
+bool RosterStore::commitUpdate()
+{
+    if (!updating || updateFailed || !flushBuffer())
+    {
+        abortUpdate();
+        return false;
+    }
+    updating = false;
+
+    if (headerBytes < sizeof(RosterHeader) || entriesReceived != updateHeader.entryCount)
+    {
+        failUpdate("roster truncated");
+        return false;
+    }
+    if (updateCrc != updateHeader.entriesCrc)
+    {
+        failUpdate("entry CRC mismatch");
+        return false;
+    }
+
+    // The header is the commit point, until it is written the old half stays active
+    updateHeader.generation = isLoaded() ? activeHeader.generation + 1 : 1;
+    updateHeader.reserved = 0;
+    updateHeader.headerCrc = headerCrc(updateHeader);
+    if (esp_partition_write(partition, halfOffset(updateHalf), &updateHeader, sizeof(updateHeader)) != ESP_OK)
+    {
+        failUpdate("header write error");
+        return false;
+    }
+
+    if (!mapHalf(updateHalf, updateHeader))
+    {
+        failUpdate("mmap failed");
+        return false;
+    }
+
+    Serial.printf("Roster v%lu active: %lu entries (half %d)\n", (unsigned long)updateHeader.version,
+                  (unsigned long)updateHeader.entryCount, updateHalf);
+    return true;
+}
+
+void RosterStore::abortUpdate()
+{
+    // Whatever was written is ignored without a valid header
+    updating = false;
+    bufferLength = 0;
+}
+
+// =============================================
+// UPDATE SINK
+// =============================================
+
+size_t RosterUpdateSink::write(uint8_t value)
+{
+    return rosterStore.writeUpdate(&value, 1);
+}
+
+size_t RosterUpdateSink::write(const uint8_t *buffer, size_t size)
+{
+    return rosterStore.writeUpdate(buffer, size);
+}
+
+// =============================================
+// GLOBAL INSTANCE
+// =============================================
+
+RosterStore rosterStore;
@@ -0,0 +1,138 @@
+#ifndef ROSTER_STORE_H
+#define ROSTER_STORE_H
+
+#include <Arduino.h>
+#include <esp_partition.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include "config.h"
+
+#define ROSTER_MAGIC            0x52535452  // "RSTR"
+#define ROSTER_FORMAT_VERSION   1
+#define ROSTER_INDUK_LENGTH     20
+#define ROSTER_WRITE_BUFFER     512         // Bytes staged per flash write
+
+#define ROSTER_STATUS_BLOCKED   0
+#define ROSTER_STATUS_ACTIVE    1
+
+// =============================================
+// ROSTER FORMAT
+// =============================================
+
+// Roster image as served by ROSTER_ENDPOINT and stored in each half of the
+// roster partition: this header followed by entryCount entries sorted by
+// (uid, uidLength). All integers little-endian. The server leaves
+// generation and headerCrc at 0, the device fills them in on commit.
+struct RosterHeader {
+    uint32_t magic;
+    uint16_t formatVersion;
+    uint16_t entrySize;         // sizeof(RosterEntry)
+    uint32_t version;           // Roster version assigned by the server
+    uint32_t entryCount;
+    uint32_t entriesCrc;        // CRC32 of the entry table
+    uint32_t generation;        // Highest valid half is the active one
+    uint32_t reserved;
+    uint32_t headerCrc;         // Over everything above
+};
+
+struct RosterEntry {
+    uint8_t uid[7];             // Zero padded; uid + uidLength is the sort key
+    uint8_t uidLength;
+    uint8_t status;             // ROSTER_STATUS_*
+    uint8_t reserved[3];
+    char induk[ROSTER_INDUK_LENGTH];    // Zero padded
+};
+
+enum RosterLookup {
+    ROSTER_NOT_FOUND,           // Not in the roster (or none loaded), ask the server
+    ROSTER_VALID,
+    ROSTER_INVALID              // Blocked, or the card carries another induk
+};
+
+// =============================================
+// ROSTER STORE CLASS
+// =============================================
+
+// Student roster in a dedicated two-half flash partition. The active half
+// is memory-mapped and searched in place. Updates are streamed into the
+// other half, and its header is written last: a header with a valid CRC
+// and a higher generation makes the new half active. An interrupted
+// download never touches the active half.
+class RosterStore {
+private:
+    const esp_partition_t* partition;
+    SemaphoreHandle_t mutex;
+    uint32_t halfSize;
+
+    // Active half
+    int8_t activeHalf;          // -1 when no valid roster is stored
+    RosterHeader activeHeader;
+    const RosterEntry* entries;
+    esp_partition_mmap_handle_t mapHandle;
+
+    // Update in progress
+    bool updating;
+    bool updateFailed;
+    uint8_t updateHalf;
+    RosterHeader updateHeader;
+    uint32_t headerBytes;
+    uint32_t entriesReceived;
+    uint32_t updateCrc;
+    uint32_t writeOffset;
+    uint8_t writeBuffer[ROSTER_WRITE_BUFFER];
+    uint16_t bufferLength;
+    uint8_t lastKey[8];
+
+    // Counters
+    uint32_t lookups;
+    uint32_t localAnswers;
+
+    bool readHeader(uint8_t half, RosterHeader& header);
+    bool checkHeader(const RosterHeader& header) const;
+    bool mapHalf(uint8_t half, const RosterHeader& header);
+    bool checkEntries(const RosterHeader& header);
+    bool flushBuffer();
+    bool failUpdate(const char* reason);
+    uint32_t halfOffset(uint8_t half) const { return (uint32_t)half * halfSize; }
+    uint32_t maxEntries() const { return (halfSize - sizeof(RosterHeader)) / sizeof(RosterEntry); }
+
+    static uint32_t headerCrc(const RosterHeader& header);
+
+public:
+    RosterStore();
+
+    bool begin();
+    bool isAvailable() const { return partition != nullptr; }
+    bool isLoaded() const { return activeHalf >= 0; }
+    uint32_t getVersion() const { return isLoaded() ? activeHeader.version : 0; }
+    uint32_t getEntryCount() const { return isLoaded() ? activeHeader.entryCount : 0; }
+    uint32_t getMaxEntries() const { return isAvailable() ? maxEntries() : 0; }
+
+    RosterLookup lookup(const uint8_t* uid, uint8_t uidLength, const String& induk);
+    uint32_t getLookupCount() const { return lookups; }
+    uint32_t getLocalAnswerCount() const { return localAnswers; }
+
+    // Streamed update of the inactive half
+    bool beginUpdate();
+    size_t writeUpdate(const uint8_t* data, size_t length);   // Bytes taken, 0 on error
+    bool commitUpdate();
+    void abortUpdate();
+};
+
+// Stream adapter so HTTPClient::writeToStream() can feed an update
+class RosterUpdateSink : public Stream {
+public:
+    size_t write(uint8_t value) override;
+    size_t write(const uint8_t* buffer, size_t size) override;
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+};
+
+// =============================================
+// GLOBAL INSTANCE
+// =============================================
+
+extern RosterStore rosterStore;
+
+#endif // ROSTER_STORE_H
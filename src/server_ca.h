@@ -0,0 +1,14 @@
+#ifndef SERVER_CA_H
+#define SERVER_CA_H
+
+// Root (or intermediate) CA that signed the API server certificate, PEM
+// encoded, e.g.
+//   "-----BEGIN CERTIFICATE-----\n"
+//   "MIIDdzCCAl+gAwIBAgIEAgAAuTANBgkqhkiG9w0BAQUFADBaMQswCQYDVQQGEwJJ\n"
+//   ...
+//   "-----END CERTIFICATE-----\n";
+// Leave empty to pin API_TLS_FINGERPRINT from config.h instead. Only used
+// for https:// server URLs.
+static const char API_TLS_CA_CERT[] = "";
+
+#endif // SERVER_CA_H
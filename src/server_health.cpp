@@ -0,0 +1,174 @@
+#include "server_health.h"
+
+// =============================================
+// CLASS IMPLEMENTATION
+// =============================================
+
+ServerHealth::ServerHealth()
+    : state(BREAKER_CLOSED), srtt(0), rttvar(0), consecutiveFailures(0), openedAt(0), errorRate(0), recentCount(0),
+      recentNext(0), p95(0)
+{
+    memset(&stats, 0, sizeof(stats));
+    lock = xSemaphoreCreateMutex();
+}
+
+void ServerHealth::addSample(unsigned long rttMs)
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+    if (stats.samples == 0)
+    {
+        srtt = rttMs;
+        rttvar = rttMs / 2;
+    }
+    else
+    {
+        unsigned long deviation = rttMs > srtt ? rttMs - srtt : srtt - rttMs;
+        rttvar = (3 * rttvar + deviation) / 4;
+        srtt = (7 * srtt + rttMs) / 8;
+    }
+    stats.samples++;
+
+    recent[recentNext] = rttMs < 0xFFFF ? rttMs : 0xFFFF;
+    recentNext = (recentNext + 1) % SERVER_HEALTH_WINDOW;
+    if (recentCount < SERVER_HEALTH_WINDOW)
+    {
+        recentCount++;
+    }
+    updateP95();
+    xSemaphoreGive(lock);
+}
+
+void ServerHealth::recordSuccess()
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+    consecutiveFailures = 0;
+    errorRate = (7 * errorRate) / 8;
+    if (state != BREAKER_CLOSED)
+    {
+        state = BREAKER_CLOSED;
+        Serial.println("Server answered again, circuit closed");
+    }
+    xSemaphoreGive(lock);
+}
+
+void ServerHealth::recordFailure()
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+    stats.failures++;
+    errorRate = (7 * errorRate + 100) / 8;
+    if (consecutiveFailures < 255)
+    {
+        consecutiveFailures++;
+    }
+
+    if (state == BREAKER_HALF_OPEN)
+    {
+        state = BREAKER_OPEN;
+        openedAt = millis();
+    }
+    else if (state == BREAKER_CLOSED && consecutiveFailures >= API_BREAKER_THRESHOLD)
+    {
+        state = BREAKER_OPEN;
+        openedAt = millis();
+        stats.trips++;
+        Serial.printf("%u failed requests in a row, circuit open\n", consecutiveFailures);
+    }
+    xSemaphoreGive(lock);
+}
+
+void ServerHealth::reset()
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+    state = BREAKER_CLOSED;
+    srtt = 0;
+    rttvar = 0;
+    consecutiveFailures = 0;
+    errorRate = 0;
+    recentCount = 0;
+    recentNext = 0;
+    p95 = 0;
+    stats.samples = 0;
+    xSemaphoreGive(lock);
+}
+
+void ServerHealth::updateP95()
+{
+    // Lock held by the caller; insertion sort, the window is small
+    uint16_t sorted[SERVER_HEALTH_WINDOW];
+    for (uint8_t i = 0; i < recentCount; i++)
+    {
+        uint16_t value = recent[i];
+        uint8_t j = i;
+        for (; j > 0 && sorted[j - 1] > value; j--)
+        {
+            sorted[j] = sorted[j - 1];
+        }
+        sorted[j] = value;
+    }
+    p95 = sorted[(recentCount * 95 + 99) / 100 - 1];
+}
+
+unsigned long ServerHealth::getTimeout(unsigned long maxTimeout)
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+    unsigned long timeout = maxTimeout;
+    if (state == BREAKER_HALF_OPEN)
+    {
+        timeout = API_BREAKER_PROBE_TIMEOUT;
+    }
+    else if (stats.samples > 0)
+    {
+        timeout = srtt + 4 * rttvar;
+        if (timeout < API_TIMEOUT_MIN)
+        {
+            timeout = API_TIMEOUT_MIN;
+        }
+        // Backs off like TCP's RTO, a few doublings reach the maximum
+        for (uint8_t i = 0; i < consecutiveFailures && timeout < maxTimeout; i++)
+        {
+            timeout *= 2;
+        }
+    }
+    xSemaphoreGive(lock);
+    return timeout < maxTimeout ? timeout : maxTimeout;
+}
+
+unsigned long ServerHealth::getExpectedTime(unsigned long maxTimeout)
+{
+    if (stats.samples == 0)
+    {
+        return maxTimeout;
+    }
+    xSemaphoreTake(lock, portMAX_DELAY);
+    unsigned long expected = (srtt * (100 - errorRate) + maxTimeout * errorRate) / 100;
+    xSemaphoreGive(lock);
+    return expected;
+}
+
+bool ServerHealth::allowRequest()
+{
+    if (state != BREAKER_OPEN)
+    {
+        return true;
+    }
+    xSemaphoreTake(lock, portMAX_DELAY);
+    stats.failedFast++;
+    xSemaphoreGive(lock);
+    return false;
+}
+
+bool ServerHealth::isProbeDue()
+{
+    return state == BREAKER_OPEN && millis() - openedAt >= API_BREAKER_PROBE_INTERVAL;
+}
+
+void ServerHealth::beginProbe()
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+    if (state == BREAKER_OPEN)
+    {
+        state = BREAKER_HALF_OPEN;
+        stats.probes++;
+    }
+    xSemaphoreGive(lock);
+}
@@ -0,0 +1,86 @@
+#ifndef SERVER_HEALTH_H
+#define SERVER_HEALTH_H
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include "config.h"
+
+#define SERVER_HEALTH_WINDOW    32      // Recent response times kept for the p95
+
+enum BreakerState {
+    BREAKER_CLOSED,         // Requests go out normally
+    BREAKER_OPEN,           // Server considered down, requests fail at once
+    BREAKER_HALF_OPEN       // One probe request is on its way
+};
+
+struct ServerHealthStats {
+    uint32_t samples;           // Response times fed into the estimate
+    uint32_t failures;          // No answer, 5xx, 408 or 429
+    uint32_t trips;             // CLOSED -> OPEN
+    uint32_t failedFast;        // Requests refused while open
+    uint32_t probes;
+};
+
+// =============================================
+// SERVER HEALTH CLASS
+// =============================================
+
+// Smoothed response time of one API server and a circuit breaker on top
+// of it. Timeouts follow srtt + 4 * rttvar (RFC 6298), doubled for every
+// consecutive failure so a server that merely got slower is not cut off.
+// After API_BREAKER_THRESHOLD consecutive failures the breaker opens and
+// stays open until a probe gets an answer. The last SERVER_HEALTH_WINDOW
+// response times give the p95, and a smoothed error rate is kept for
+// choosing between servers. Safe to use from any task.
+class ServerHealth {
+public:
+    ServerHealth();
+
+    // A response arrived after rttMs, from the request start to its headers
+    void addSample(unsigned long rttMs);
+    void recordSuccess();
+    void recordFailure();
+    // Forget everything, e.g. for a new server
+    void reset();
+
+    // Timeout for the next request, never above maxTimeout
+    unsigned long getTimeout(unsigned long maxTimeout);
+    // Average wait for an answer when failed requests cost maxTimeout;
+    // maxTimeout itself until the first sample
+    unsigned long getExpectedTime(unsigned long maxTimeout);
+
+    // False while the breaker is open; a probe counts as allowed
+    bool allowRequest();
+    bool isProbeDue();
+    // OPEN -> HALF_OPEN, the caller sends the probe right after
+    void beginProbe();
+
+    BreakerState getState() const { return state; }
+    bool isOpen() const { return state != BREAKER_CLOSED; }
+    unsigned long getSmoothedRTT() const { return srtt; }
+    unsigned long getRTTVariance() const { return rttvar; }
+    // 95th percentile of the recent response times, 0 until the first sample
+    unsigned long getP95() const { return p95; }
+    uint8_t getErrorRatePercent() const { return errorRate; }
+    bool hasSamples() const { return stats.samples > 0; }
+    const ServerHealthStats& getStats() const { return stats; }
+
+private:
+    SemaphoreHandle_t lock;
+    volatile BreakerState state;
+    unsigned long srtt;             // ms, 0 until the first sample
+    unsigned long rttvar;           // ms
+    uint8_t consecutiveFailures;
+    unsigned long openedAt;
+    uint8_t errorRate;              // %, moves 1/8 of the way per request
+    uint16_t recent[SERVER_HEALTH_WINDOW];  // ms, ring of the latest samples
+    uint8_t recentCount;
+    uint8_t recentNext;
+    unsigned long p95;
+    ServerHealthStats stats;
+
+    void updateP95();
+};
+
+#endif // SERVER_HEALTH_H
@@ -0,0 +1,125 @@
+#include "validation_cache.h"
+
+// =============================================
+// CLASS IMPLEMENTATION
+// =============================================
+
+ValidationCache::ValidationCache() : useClock(0)
+{
+    clear();
+    memset(&stats, 0, sizeof(stats));
+}
+
+void ValidationCache::clear()
+{
+    memset(entries, 0, sizeof(entries));
+}
+
+int ValidationCache::find(const String &uid, const String &santriID)
+{
+    for (int i = 0; i < VALIDATION_CACHE_SIZE; i++)
+    {
+        if (entries[i].used && strcmp(entries[i].uid, uid.c_str()) == 0 &&
+            strcmp(entries[i].santriID, santriID.c_str()) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool ValidationCache::isExpired(const Entry &entry) const
+{
+    unsigned long ttl = entry.valid ? VALIDATION_CACHE_VALID_TTL : VALIDATION_CACHE_INVALID_TTL;
+    return millis() - entry.storedAt >= ttl;
+}
+
+ValidationCache::Lookup ValidationCache::lookup(const String &uid, const String &santriID)
+{
+    int index = find(uid, santriID);
+    if (index >= 0 && isExpired(entries[index]))
+    {
+        entries[index].used = false;
+        stats.expirations++;
+        index = -1;
+    }
+
+    if (index < 0)
+    {
+        stats.misses++;
+        return CACHE_MISS;
+    }
+
+    stats.hits++;
+    entries[index].lastUsed = ++useClock;
+    return entries[index].valid ? CACHE_VALID : CACHE_INVALID;
+}
+
+void ValidationCache::store(const String &uid, const String &santriID, bool valid)
+{
+    if (uid.length() >= VALIDATION_CACHE_UID_MAX || santriID.length() >= CARD_INDUK_MAX_LENGTH)
+    {
+        return;
+    }
+
+    // Same key, a free slot, or else the least recently used entry
+    int index = find(uid, santriID);
+    if (index < 0)
+    {
+        for (int i = 0; i < VALIDATION_CACHE_SIZE; i++)
+        {
+            if (!entries[i].used)
+            {
+                index = i;
+                break;
+            }
+            if (index < 0 || entries[i].lastUsed < entries[index].lastUsed)
+            {
+                index = i;
+            }
+        }
+
+        if (entries[index].used)
+        {
+            if (isExpired(entries[index]))
+            {
+                stats.expirations++;
+            }
+            else
+            {
+                stats.evictions++;
+            }
+        }
+    }
+
+    Entry &entry = entries[index];
+    entry.used = true;
+    entry.valid = valid;
+    entry.storedAt = millis();
+    entry.lastUsed = ++useClock;
+    strcpy(entry.uid, uid.c_str());
+    strcpy(entry.santriID, santriID.c_str());
+}
+
+uint8_t ValidationCache::getEntryCount() const
+{
+    uint8_t count = 0;
+    for (int i = 0; i < VALIDATION_CACHE_SIZE; i++)
+    {
+        if (entries[i].used)
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+uint8_t ValidationCache::getHitRatePercent() const
+{
+    uint32_t lookups = stats.hits + stats.misses;
+    if (lookups == 0)
+    {
+        return 0;
+    }
+    return (uint8_t)((stats.hits * 100ULL) / lookups);
+}
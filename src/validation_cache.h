@@ -0,0 +1,60 @@
+#ifndef VALIDATION_CACHE_H
+#define VALIDATION_CACHE_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "card_payload_parser.h"
+
+#define VALIDATION_CACHE_UID_MAX 21     // 10-byte UID as hex + terminator
+
+struct ValidationCacheStats {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t evictions;                 // Live entries pushed out by LRU
+    uint32_t expirations;
+};
+
+// =============================================
+// VALIDATION CACHE CLASS
+// =============================================
+
+// Server verdicts keyed by (UID, santri ID), valid and invalid answers
+// with their own TTL. Fixed table with least-recently-used eviction; a
+// lookup is a linear scan of VALIDATION_CACHE_SIZE short strings.
+class ValidationCache {
+public:
+    enum Lookup {
+        CACHE_MISS,
+        CACHE_VALID,
+        CACHE_INVALID
+    };
+
+    ValidationCache();
+
+    Lookup lookup(const String& uid, const String& santriID);
+    void store(const String& uid, const String& santriID, bool valid);
+    void clear();
+
+    uint8_t getEntryCount() const;
+    const ValidationCacheStats& getStats() const { return stats; }
+    uint8_t getHitRatePercent() const;
+
+private:
+    struct Entry {
+        bool used;
+        bool valid;
+        unsigned long storedAt;
+        uint32_t lastUsed;              // LRU clock value of the last hit or store
+        char uid[VALIDATION_CACHE_UID_MAX];
+        char santriID[CARD_INDUK_MAX_LENGTH];
+    };
+
+    Entry entries[VALIDATION_CACHE_SIZE];
+    uint32_t useClock;
+    ValidationCacheStats stats;
+
+    int find(const String& uid, const String& santriID);
+    bool isExpired(const Entry& entry) const;
+};
+
+#endif // VALIDATION_CACHE_H
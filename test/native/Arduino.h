@@ -0,0 +1,153 @@
+#ifndef NATIVE_ARDUINO_H
+#define NATIVE_ARDUINO_H
+
+// =============================================
+// HOST STAND-IN FOR THE ARDUINO CORE
+// =============================================
+
+// Just enough of Arduino.h for the card reading modules (payload parser,
+// base64, PN532 driver and emulator, NFCHandler) to build in [env:native].
+// Header-only so the test runner links nothing but src/ and the suite.
+// Serial output is dropped to keep the test report readable.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <string>
+#include <thread>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH            1
+#define LOW             0
+#define INPUT           0x01
+#define OUTPUT          0x03
+#define INPUT_PULLUP    0x05
+#define RISING          0x01
+#define FALLING         0x02
+#define CHANGE          0x03
+#define DEC             10
+#define HEX             16
+
+#define IRAM_ATTR
+#define PROGMEM
+#define F(text) (text)
+
+// =============================================
+// TIME AND PINS
+// =============================================
+
+inline unsigned long micros()
+{
+    static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    return (unsigned long)std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+inline unsigned long millis() { return micros() / 1000; }
+inline void delay(unsigned long ms) { std::this_thread::sleep_for(std::chrono::milliseconds(ms)); }
+inline void delayMicroseconds(unsigned int us) { std::this_thread::sleep_for(std::chrono::microseconds(us)); }
+inline void yield() {}
+
+// No IRQ or RESET line is wired on the host, inputs read idle high
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t, uint8_t) {}
+inline int digitalRead(uint8_t) { return HIGH; }
+inline int digitalPinToInterrupt(int pin) { return pin; }
+inline void attachInterrupt(int, void (*)(), int) {}
+inline void detachInterrupt(int) {}
+
+// =============================================
+// STRING
+// =============================================
+
+class String {
+private:
+    std::string text;
+
+    static std::string format(unsigned long long value, int base, bool negative)
+    {
+        char digits[72];
+        int position = sizeof(digits) - 1;
+        digits[position] = '\0';
+        do
+        {
+            int digit = value % base;
+            digits[--position] = digit < 10 ? '0' + digit : 'a' + digit - 10;
+            value /= base;
+        } while (value != 0);
+        if (negative)
+        {
+            digits[--position] = '-';
+        }
+        return std::string(digits + position);
+    }
+
+    static std::string formatSigned(long long value, int base)
+    {
+        if (value < 0 && base == DEC)
+        {
+            return format((unsigned long long)(-value), base, true);
+        }
+        return format((unsigned long long)value, base, false);
+    }
+
+public:
+    String() {}
+    String(const char* value) : text(value ? value : "") {}
+    String(char value) : text(1, value) {}
+    String(unsigned char value, int base = DEC) : text(format(value, base, false)) {}
+    String(int value, int base = DEC) : text(formatSigned(value, base)) {}
+    String(unsigned int value, int base = DEC) : text(format(value, base, false)) {}
+    String(long value, int base = DEC) : text(formatSigned(value, base)) {}
+    String(unsigned long value, int base = DEC) : text(format(value, base, false)) {}
+
+    unsigned int length() const { return text.size(); }
+    const char* c_str() const { return text.c_str(); }
+    bool isEmpty() const { return text.empty(); }
+    bool reserve(unsigned int size) { text.reserve(size); return true; }
+    char charAt(unsigned int index) const { return index < text.size() ? text[index] : 0; }
+    char operator[](unsigned int index) const { return charAt(index); }
+
+    String& operator+=(const String& other) { text += other.text; return *this; }
+    String& operator+=(const char* other) { text += other; return *this; }
+    String& operator+=(char other) { text += other; return *this; }
+
+    bool operator==(const String& other) const { return text == other.text; }
+    bool operator==(const char* other) const { return text == other; }
+    bool operator!=(const String& other) const { return text != other.text; }
+    bool operator!=(const char* other) const { return text != other; }
+};
+
+inline String operator+(const String& a, const String& b) { String result(a); result += b; return result; }
+inline String operator+(const String& a, const char* b) { String result(a); result += b; return result; }
+inline String operator+(const char* a, const String& b) { String result(a); result += b; return result; }
+
+// =============================================
+// SERIAL
+// =============================================
+
+class Print {
+public:
+    virtual ~Print() {}
+
+    template <typename T>
+    size_t print(const T&, int = DEC) { return 0; }
+    template <typename T>
+    size_t println(const T&, int = DEC) { return 0; }
+    size_t println() { return 0; }
+    size_t printf(const char*, ...) { return 0; }
+};
+
+class HardwareSerial : public Print {
+public:
+    void begin(unsigned long) {}
+};
+
+inline HardwareSerial Serial;
+
+#endif // NATIVE_ARDUINO_H
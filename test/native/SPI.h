@@ -0,0 +1,15 @@
+#ifndef NATIVE_SPI_H
+#define NATIVE_SPI_H
+
+#include <Arduino.h>
+
+// Types only, the SPI transport is not built for the host
+class SPIClass;
+
+class SPISettings {
+public:
+    SPISettings() {}
+    SPISettings(uint32_t, uint8_t, uint8_t) {}
+};
+
+#endif // NATIVE_SPI_H
@@ -0,0 +1,7 @@
+#ifndef NATIVE_WIRE_H
+#define NATIVE_WIRE_H
+
+// Type only, the I2C transport is not built for the host
+class TwoWire;
+
+#endif // NATIVE_WIRE_H
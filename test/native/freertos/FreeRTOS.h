@@ -0,0 +1,15 @@
+#ifndef NATIVE_FREERTOS_H
+#define NATIVE_FREERTOS_H
+
+#include <stdint.h>
+
+// Types and macros NFCHandler's IRQ path refers to, never run on the host
+typedef void* TaskHandle_t;
+typedef int BaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE 0
+#define pdTRUE  1
+#define portYIELD_FROM_ISR(woken) (void)(woken)
+
+#endif // NATIVE_FREERTOS_H
@@ -0,0 +1,8 @@
+#ifndef NATIVE_FREERTOS_TASK_H
+#define NATIVE_FREERTOS_TASK_H
+
+#include "FreeRTOS.h"
+
+inline void vTaskNotifyGiveFromISR(TaskHandle_t, BaseType_t*) {}
+
+#endif // NATIVE_FREERTOS_TASK_H
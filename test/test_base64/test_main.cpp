@@ -0,0 +1,237 @@
+#include <Arduino.h>
+#include <unity.h>
+#include "mybase64.h"
+
+// =============================================
+// BASE64 DECODING
+// =============================================
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+static int decode(uint8_t *output, int outputSize, const char *input)
+{
+    return b64_decode_into(output, outputSize, input, strlen(input));
+}
+
+void test_round_trip_all_lengths()
+{
+    char plain[64];
+    char encoded[96];
+    uint8_t decoded[64];
+    for (int i = 0; i < (int)sizeof(plain); i++)
+    {
+        plain[i] = (char)(i * 37 + 11);
+    }
+
+    for (int length = 0; length <= (int)sizeof(plain); length++)
+    {
+        int encodedLength = b64_encode(encoded, plain, length);
+        TEST_ASSERT_EQUAL_INT(b64_enc_len(length), encodedLength);
+        TEST_ASSERT_EQUAL_INT(length, b64_decode_into(decoded, b64_dec_max_len(encodedLength), encoded, encodedLength));
+        TEST_ASSERT_EQUAL_MEMORY(plain, decoded, length);
+    }
+}
+
+void test_unpadded_tail()
+{
+    uint8_t decoded[8];
+    TEST_ASSERT_EQUAL_INT(1, decode(decoded, sizeof(decoded), "QQ"));
+    TEST_ASSERT_EQUAL_INT('A', decoded[0]);
+    TEST_ASSERT_EQUAL_INT(2, decode(decoded, sizeof(decoded), "QUI"));
+    TEST_ASSERT_EQUAL_MEMORY("AB", decoded, 2);
+}
+
+void test_basic_auth_credentials()
+{
+    // "admin:rahasia" as sent in an Authorization: Basic header
+    uint8_t decoded[16];
+    TEST_ASSERT_EQUAL_INT(13, decode(decoded, sizeof(decoded), "YWRtaW46cmFoYXNpYQ=="));
+    TEST_ASSERT_EQUAL_MEMORY("admin:rahasia", decoded, 13);
+}
+
+void test_long_input_fits_max_len()
+{
+    // Longer than the 96 bytes credentials used to be decoded into
+    char plain[300];
+    char encoded[404];
+    for (int i = 0; i < (int)sizeof(plain); i++)
+    {
+        plain[i] = 'a' + i % 26;
+    }
+    int encodedLength = b64_encode(encoded, plain, sizeof(plain));
+
+    uint8_t decoded[300];
+    TEST_ASSERT_EQUAL_INT(sizeof(decoded), b64_dec_max_len(encodedLength));
+    TEST_ASSERT_EQUAL_INT(sizeof(plain), b64_decode_into(decoded, sizeof(decoded), encoded, encodedLength));
+    TEST_ASSERT_EQUAL_MEMORY(plain, decoded, sizeof(plain));
+}
+
+void test_invalid_input()
+{
+    uint8_t decoded[16];
+    TEST_ASSERT_EQUAL_INT(-1, decode(decoded, sizeof(decoded), "QU*C"));
+    TEST_ASSERT_EQUAL_INT(-1, decode(decoded, sizeof(decoded), "QUJDR"));    // One digit tail
+    TEST_ASSERT_EQUAL_INT(-1, decode(decoded, sizeof(decoded), "QUJD\nRUY="));
+}
+
+void test_output_too_small()
+{
+    uint8_t decoded[4];
+    TEST_ASSERT_EQUAL_INT(-1, decode(decoded, 2, "QUJD"));
+    TEST_ASSERT_EQUAL_INT(-1, decode(decoded, 3, "QUJDRA"));
+    TEST_ASSERT_EQUAL_INT(4, decode(decoded, 4, "QUJDRA"));
+}
+
+void test_digit_lookup()
+{
+    TEST_ASSERT_EQUAL_INT(0, b64_value('A'));
+    TEST_ASSERT_EQUAL_INT(63, b64_value('/'));
+    TEST_ASSERT_EQUAL_INT(B64_PAD, b64_value('='));
+    TEST_ASSERT_EQUAL_INT(B64_INVALID, b64_value('-'));
+    TEST_ASSERT_EQUAL_INT(B64_INVALID, b64_value(0xFF));
+}
+
+// =============================================
+// DECODE MICROBENCHMARK
+// =============================================
+
+// The decoder as it was before the lookup table: a linear search of the
+// alphabet for every digit. Kept here only as the benchmark reference.
+static unsigned char baseline_lookup(char c)
+{
+    for (int i = 0; i < 64; i++)
+    {
+        if (b64_alphabet[i] == c)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void baseline_a4_to_a3(unsigned char *a3, unsigned char *a4)
+{
+    a3[0] = (a4[0] << 2) + ((a4[1] & 0x30) >> 4);
+    a3[1] = ((a4[1] & 0xf) << 4) + ((a4[2] & 0x3c) >> 2);
+    a3[2] = ((a4[2] & 0x3) << 6) + a4[3];
+}
+
+static int baseline_decode(char *output, const char *input, int inputLen)
+{
+    int i = 0;
+    int decLen = 0;
+    unsigned char a3[3];
+    unsigned char a4[4];
+
+    while (inputLen--)
+    {
+        if (*input == '=')
+        {
+            break;
+        }
+
+        a4[i++] = *(input++);
+        if (i == 4)
+        {
+            for (i = 0; i < 4; i++)
+            {
+                a4[i] = baseline_lookup(a4[i]);
+            }
+            baseline_a4_to_a3(a3, a4);
+            for (i = 0; i < 3; i++)
+            {
+                output[decLen++] = a3[i];
+            }
+            i = 0;
+        }
+    }
+
+    if (i)
+    {
+        for (int j = i; j < 4; j++)
+        {
+            a4[j] = '\0';
+        }
+        for (int j = 0; j < 4; j++)
+        {
+            a4[j] = baseline_lookup(a4[j]);
+        }
+        baseline_a4_to_a3(a3, a4);
+        for (int j = 0; j < i - 1; j++)
+        {
+            output[decLen++] = a3[j];
+        }
+    }
+    output[decLen] = '\0';
+    return decLen;
+}
+
+#define BENCH_PLAIN_SIZE    3072    // 4 KB of base64
+#define BENCH_ITERATIONS    2000
+
+static void reportTiming(const char *name, int encodedLength, unsigned long elapsedUs)
+{
+    char line[128];
+    snprintf(line, sizeof(line), "%s: %d chars x %d: %lu us, %.2f ns/char", name, encodedLength, BENCH_ITERATIONS,
+             elapsedUs, elapsedUs * 1000.0 / ((double)encodedLength * BENCH_ITERATIONS));
+    TEST_MESSAGE(line);
+}
+
+void test_decode_benchmark()
+{
+    static char plain[BENCH_PLAIN_SIZE];
+    static char encoded[BENCH_PLAIN_SIZE / 3 * 4 + 4];
+    static uint8_t decoded[BENCH_PLAIN_SIZE];
+    static char baselineDecoded[BENCH_PLAIN_SIZE + 1];
+    for (int i = 0; i < BENCH_PLAIN_SIZE; i++)
+    {
+        plain[i] = (char)(i * 131 + 7);
+    }
+    int encodedLength = b64_encode(encoded, plain, BENCH_PLAIN_SIZE);
+
+    unsigned long start = micros();
+    uint32_t total = 0;
+    for (int i = 0; i < BENCH_ITERATIONS; i++)
+    {
+        total += baseline_decode(baselineDecoded, encoded, encodedLength);
+    }
+    unsigned long baselineUs = micros() - start;
+    TEST_ASSERT_EQUAL_UINT32((uint32_t)BENCH_PLAIN_SIZE * BENCH_ITERATIONS, total);
+    TEST_ASSERT_EQUAL_MEMORY(plain, baselineDecoded, BENCH_PLAIN_SIZE);
+
+    start = micros();
+    total = 0;
+    for (int i = 0; i < BENCH_ITERATIONS; i++)
+    {
+        total += b64_decode_into(decoded, sizeof(decoded), encoded, encodedLength);
+    }
+    unsigned long elapsedUs = micros() - start;
+    TEST_ASSERT_EQUAL_UINT32((uint32_t)BENCH_PLAIN_SIZE * BENCH_ITERATIONS, total);
+    TEST_ASSERT_EQUAL_MEMORY(plain, decoded, BENCH_PLAIN_SIZE);
+
+    reportTiming("baseline b64_decode", encodedLength, baselineUs);
+    reportTiming("b64_decode_into", encodedLength, elapsedUs);
+    char line[64];
+    snprintf(line, sizeof(line), "speedup %.1fx", elapsedUs > 0 ? (double)baselineUs / elapsedUs : 0.0);
+    TEST_MESSAGE(line);
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_round_trip_all_lengths);
+    RUN_TEST(test_unpadded_tail);
+    RUN_TEST(test_basic_auth_credentials);
+    RUN_TEST(test_long_input_fits_max_len);
+    RUN_TEST(test_invalid_input);
+    RUN_TEST(test_output_too_small);
+    RUN_TEST(test_digit_lookup);
+    RUN_TEST(test_decode_benchmark);
+    return UNITY_END();
+}
@@ -0,0 +1,407 @@
+#include <unity.h>
+#include "card_payload_parser.h"
+#include "mybase64.h"
+
+// =============================================
+// CARD PAYLOAD PARSER
+// =============================================
+
+// Card images are built the way the santri cards are written: optional
+// Lock Control TLV, NDEF TLV holding one Text record ("en") whose text is
+// the base64 JSON, then the Terminator TLV.
+
+#define CARD_IMAGE_MAX 2048
+
+static uint8_t image[CARD_IMAGE_MAX];
+static size_t imageLength;
+static CardPayloadParser parser;
+
+void setUp()
+{
+    imageLength = 0;
+}
+
+void tearDown()
+{
+}
+
+static void put(uint8_t b)
+{
+    TEST_ASSERT_LESS_THAN(CARD_IMAGE_MAX, imageLength);
+    image[imageLength++] = b;
+}
+
+static void buildCardText(const char *text, bool longRecord = false, bool lockTlv = false)
+{
+    imageLength = 0;
+    if (lockTlv)
+    {
+        put(0x01);
+        put(0x03);
+        put(0xA0);
+        put(0x10);
+        put(0x44);
+    }
+
+    uint32_t textLength = strlen(text);
+    uint32_t payloadLength = 3 + textLength;
+    uint32_t messageLength = 3 + (longRecord ? 4 : 1) + payloadLength;
+
+    put(0x03);
+    if (messageLength < 0xFF)
+    {
+        put(messageLength);
+    }
+    else
+    {
+        put(0xFF);
+        put(messageLength >> 8);
+        put(messageLength & 0xFF);
+    }
+
+    put(longRecord ? 0xC1 : 0xD1);
+    put(0x01);
+    if (longRecord)
+    {
+        put(payloadLength >> 24);
+        put(payloadLength >> 16);
+        put(payloadLength >> 8);
+    }
+    put(payloadLength & 0xFF);
+    put('T');
+    put(0x02);
+    put('e');
+    put('n');
+    for (uint32_t i = 0; i < textLength; i++)
+    {
+        put(text[i]);
+    }
+    put(0xFE);
+}
+
+static void buildCard(const char *json, bool longRecord = false, bool lockTlv = false)
+{
+    static char encoded[CARD_IMAGE_MAX];
+    TEST_ASSERT_LESS_THAN(sizeof(encoded), (size_t)b64_enc_len(strlen(json)));
+    int length = b64_encode(encoded, (char *)json, strlen(json));
+    encoded[length] = '\0';
+    buildCardText(encoded, longRecord, lockTlv);
+}
+
+static CardPayloadParser::Result parseInChunks(size_t chunk)
+{
+    parser.reset();
+    CardPayloadParser::Result result = CardPayloadParser::PARSE_MORE;
+    for (size_t offset = 0; offset < imageLength && result == CardPayloadParser::PARSE_MORE; offset += chunk)
+    {
+        size_t length = imageLength - offset < chunk ? imageLength - offset : chunk;
+        result = parser.feed(image + offset, length);
+    }
+    return result;
+}
+
+static const size_t chunkSizes[] = {1, 3, 16, 1000};
+
+static void assertFieldsInAllChunkSizes(const char *nama, const char *induk)
+{
+    for (size_t i = 0; i < sizeof(chunkSizes) / sizeof(chunkSizes[0]); i++)
+    {
+        char message[32];
+        snprintf(message, sizeof(message), "chunk size %u", (unsigned)chunkSizes[i]);
+        TEST_ASSERT_EQUAL_INT_MESSAGE(CardPayloadParser::PARSE_DONE, parseInChunks(chunkSizes[i]), message);
+        TEST_ASSERT_EQUAL_STRING_MESSAGE(nama, parser.getNama(), message);
+        TEST_ASSERT_EQUAL_STRING_MESSAGE(induk, parser.getInduk(), message);
+    }
+}
+
+static void assertErrorInAllChunkSizes(const char *error)
+{
+    for (size_t i = 0; i < sizeof(chunkSizes) / sizeof(chunkSizes[0]); i++)
+    {
+        char message[32];
+        snprintf(message, sizeof(message), "chunk size %u", (unsigned)chunkSizes[i]);
+        TEST_ASSERT_EQUAL_INT_MESSAGE(CardPayloadParser::PARSE_ERROR, parseInChunks(chunkSizes[i]), message);
+        TEST_ASSERT_EQUAL_STRING_MESSAGE(error, parser.getError(), message);
+    }
+}
+
+// =============================================
+// WELL-FORMED PAYLOADS
+// =============================================
+
+void test_plain_card()
+{
+    buildCard("{\"induk\":\"196600\",\"nama\":\"Inggrit Destiana Nugraeni\"}");
+    assertFieldsInAllChunkSizes("Inggrit Destiana Nugraeni", "196600");
+}
+
+void test_stops_after_both_fields()
+{
+    buildCard("{\"nama\":\"Ahmad\",\"induk\":\"1001\",\"kelas\":\"XI IPA 2\",\"catatan\":\"panjang sekali\"}");
+    TEST_ASSERT_EQUAL_INT(CardPayloadParser::PARSE_DONE, parseInChunks(1));
+    TEST_ASSERT_LESS_THAN(imageLength - 20, parser.getBytesConsumed());
+}
+
+void test_escapes()
+{
+    buildCard("{\"nama\":\"Siti \\\"Ica\\\" A\\\\isyah \\u00e9\\u20ac\\/\",\"induk\":\"21\\u0030045\"}");
+    assertFieldsInAllChunkSizes("Siti \"Ica\" A\\isyah \xC3\xA9\xE2\x82\xAC/", "210045");
+}
+
+void test_nested_arrays_and_objects_are_skipped()
+{
+    buildCard("{\"asrama\":{\"gedung\":\"B\",\"kamar\":[12,[13,{\"nama\":\"x\"}]],\"s\":\"]}\\\"\"},"
+              "\"wali\":[\"Bapak\",\"Ibu\"],\"nama\":\"Fatimah\",\"induk\":\"3003\"}");
+    assertFieldsInAllChunkSizes("Fatimah", "3003");
+}
+
+void test_whitespace_literals_and_unknown_keys()
+{
+    buildCard(" {\n  \"aktif\" : true ,\n  \"saldo\": 15000,\n  \"foto\": null,\n"
+              "  \"keterangan_sangat_panjang\": \"x\",\n  \"induk\" : 4004 ,\n  \"nama\" : \"Umar\"\n}\n");
+    assertFieldsInAllChunkSizes("Umar", "4004");
+}
+
+void test_unpadded_base64()
+{
+    // 32 bytes of JSON end on a two-character base64 group
+    const char *json = "{\"nama\":\"Ali\",\"induk\":\"1234567\"}";
+    char encoded[64];
+    int length = b64_encode(encoded, (char *)json, strlen(json));
+    while (length > 0 && encoded[length - 1] == '=')
+    {
+        length--;
+    }
+    encoded[length] = '\0';
+    buildCardText(encoded);
+    assertFieldsInAllChunkSizes("Ali", "1234567");
+}
+
+void test_base64_with_line_breaks()
+{
+    buildCardText("eyJuYW1hIjoiWmFp\r\nbmFiIiwiaW5kdWsi\r\nOiI1NTUifQ==");
+    assertFieldsInAllChunkSizes("Zainab", "555");
+}
+
+void test_long_record_behind_lock_tlv()
+{
+    char json[600];
+    int length = snprintf(json, sizeof(json), "{\"catatan\":\"");
+    for (int i = 0; i < 400; i++)
+    {
+        json[length++] = 'a' + i % 26;
+    }
+    snprintf(json + length, sizeof(json) - length, "\",\"nama\":\"Yusuf\",\"induk\":\"7007\"}");
+
+    buildCard(json, true, true);
+    TEST_ASSERT_GREATER_THAN(0xFF, imageLength);
+    assertFieldsInAllChunkSizes("Yusuf", "7007");
+}
+
+void test_overlong_nama_is_truncated()
+{
+    char json[300];
+    int length = snprintf(json, sizeof(json), "{\"nama\":\"");
+    for (int i = 0; i < 150; i++)
+    {
+        json[length++] = 'N';
+    }
+    snprintf(json + length, sizeof(json) - length, "\",\"induk\":\"8008\"}");
+    buildCard(json, true);
+
+    TEST_ASSERT_EQUAL_INT(CardPayloadParser::PARSE_DONE, parseInChunks(16));
+    TEST_ASSERT_EQUAL_INT(CARD_NAMA_MAX_LENGTH - 1, strlen(parser.getNama()));
+    TEST_ASSERT_EQUAL_STRING("8008", parser.getInduk());
+}
+
+void test_missing_nama_is_left_blank()
+{
+    buildCard("{\"induk\":\"2002\",\"kelas\":\"8A\"}");
+    assertFieldsInAllChunkSizes("", "2002");
+    TEST_ASSERT_FALSE(parser.hasNama());
+}
+
+void test_reset_at_message()
+{
+    buildCard("{\"nama\":\"Hasan\",\"induk\":\"9009\"}");
+    parser.resetAtMessage(image[1]);
+    TEST_ASSERT_EQUAL_INT(CardPayloadParser::PARSE_DONE, parser.feed(image + 2, image[1]));
+    TEST_ASSERT_EQUAL_STRING("Hasan", parser.getNama());
+    TEST_ASSERT_EQUAL_STRING("9009", parser.getInduk());
+}
+
+// =============================================
+// MALFORMED PAYLOADS
+// =============================================
+
+void test_error_no_ndef_tlv()
+{
+    imageLength = 0;
+    put(0x00);
+    put(0x00);
+    put(0xFE);
+    assertErrorInAllChunkSizes("No NDEF TLV");
+}
+
+void test_error_unknown_tlv()
+{
+    imageLength = 0;
+    put(0x42);
+    put(0x00);
+    assertErrorInAllChunkSizes("Unknown TLV");
+}
+
+void test_error_not_an_object()
+{
+    buildCard("[\"nama\",\"induk\"]");
+    assertErrorInAllChunkSizes("JSON payload is not an object");
+}
+
+void test_error_invalid_base64()
+{
+    buildCardText("eyJuYW1hIjo*IkEifQ==");
+    assertErrorInAllChunkSizes("Invalid base64 payload");
+}
+
+void test_error_truncated_json()
+{
+    buildCard("{\"nama\":\"Bilal\",\"induk\":\"10");
+    assertErrorInAllChunkSizes("Incomplete JSON payload");
+}
+
+void test_error_message_shorter_than_record()
+{
+    buildCard("{\"nama\":\"Khadijah\",\"induk\":\"1111\"}");
+    image[1] -= 10;     // TLV ends inside the record
+    assertErrorInAllChunkSizes("NDEF message ended early");
+}
+
+void test_error_missing_induk()
+{
+    buildCard("{\"nama\":\"X\"}");
+    assertErrorInAllChunkSizes("No induk in card payload");
+
+    buildCard("{\"nama\":\"X\",\"induk\":null}");
+    assertErrorInAllChunkSizes("No induk in card payload");
+}
+
+void test_error_bad_unicode_escape()
+{
+    buildCard("{\"nama\":\"\\u00zz\",\"induk\":\"1\"}");
+    assertErrorInAllChunkSizes("Invalid JSON unicode escape");
+}
+
+// =============================================
+// CORPUS BENCHMARK
+// =============================================
+
+#define CORPUS_CARDS        64
+#define CORPUS_ITERATIONS   200
+
+// Parses a corpus of card images shaped like the ones in the field (short
+// and long records, extra fields before and after, nested values) in
+// 16-byte blocks as NFCHandler feeds them, and reports the throughput.
+void test_corpus_benchmark()
+{
+    static uint8_t corpus[CORPUS_CARDS][CARD_IMAGE_MAX];
+    static size_t corpusLength[CORPUS_CARDS];
+    static const char *names[] = {"Ali", "Siti Aisyah", "Muhammad Fathurrahman Al-Hakim",
+                                  "Inggrit Destiana Nugraeni", "Nur \\\"Ica\\\" Hidayah"};
+    size_t totalBytes = 0;
+
+    for (int card = 0; card < CORPUS_CARDS; card++)
+    {
+        char json[700];
+        int length = 0;
+        if (card % 4 == 1)
+        {
+            length += snprintf(json + length, sizeof(json) - length, "{\"kelas\":\"%d\",\"asrama\":{\"kamar\":[%d,%d]},",
+                               7 + card % 6, card, card + 1);
+        }
+        else if (card % 4 == 3)
+        {
+            length += snprintf(json + length, sizeof(json) - length, "{\"catatan\":\"");
+            for (int i = 0; i < 300 + card; i++)
+            {
+                json[length++] = 'a' + i % 26;
+            }
+            length += snprintf(json + length, sizeof(json) - length, "\",");
+        }
+        else
+        {
+            json[length++] = '{';
+        }
+
+        if (card % 2 == 0)
+        {
+            length += snprintf(json + length, sizeof(json) - length, "\"induk\":\"%06d\",\"nama\":\"%s\"",
+                               190000 + card, names[card % 5]);
+        }
+        else
+        {
+            length += snprintf(json + length, sizeof(json) - length, "\"nama\":\"%s\",\"induk\":\"%06d\"",
+                               names[card % 5], 190000 + card);
+        }
+        snprintf(json + length, sizeof(json) - length, ",\"saldo\":%d}", card * 1000);
+
+        buildCard(json, length > 200, card % 3 == 0);
+        memcpy(corpus[card], image, imageLength);
+        corpusLength[card] = imageLength;
+        totalBytes += imageLength;
+    }
+
+    unsigned long start = micros();
+    uint32_t consumed = 0;
+    for (int iteration = 0; iteration < CORPUS_ITERATIONS; iteration++)
+    {
+        for (int card = 0; card < CORPUS_CARDS; card++)
+        {
+            parser.reset();
+            CardPayloadParser::Result result = CardPayloadParser::PARSE_MORE;
+            for (size_t offset = 0; offset < corpusLength[card] && result == CardPayloadParser::PARSE_MORE; offset += 16)
+            {
+                size_t length = corpusLength[card] - offset < 16 ? corpusLength[card] - offset : 16;
+                result = parser.feed(corpus[card] + offset, length);
+            }
+            TEST_ASSERT_EQUAL_INT(CardPayloadParser::PARSE_DONE, result);
+            consumed += parser.getBytesConsumed();
+        }
+    }
+    unsigned long elapsedUs = micros() - start;
+    if (elapsedUs == 0)
+    {
+        elapsedUs = 1;
+    }
+
+    char line[160];
+    snprintf(line, sizeof(line), "%d cards x %d: %lu us, %.2f us/card, %.1f MB/s parsed (%u of %u image bytes read)",
+             CORPUS_CARDS, CORPUS_ITERATIONS, elapsedUs, (double)elapsedUs / (CORPUS_CARDS * CORPUS_ITERATIONS),
+             (double)consumed / elapsedUs, (unsigned)(consumed / CORPUS_ITERATIONS), (unsigned)totalBytes);
+    TEST_MESSAGE(line);
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_plain_card);
+    RUN_TEST(test_stops_after_both_fields);
+    RUN_TEST(test_escapes);
+    RUN_TEST(test_nested_arrays_and_objects_are_skipped);
+    RUN_TEST(test_whitespace_literals_and_unknown_keys);
+    RUN_TEST(test_unpadded_base64);
+    RUN_TEST(test_base64_with_line_breaks);
+    RUN_TEST(test_long_record_behind_lock_tlv);
+    RUN_TEST(test_overlong_nama_is_truncated);
+    RUN_TEST(test_missing_nama_is_left_blank);
+    RUN_TEST(test_reset_at_message);
+    RUN_TEST(test_error_no_ndef_tlv);
+    RUN_TEST(test_error_unknown_tlv);
+    RUN_TEST(test_error_not_an_object);
+    RUN_TEST(test_error_invalid_base64);
+    RUN_TEST(test_error_truncated_json);
+    RUN_TEST(test_error_message_shorter_than_record);
+    RUN_TEST(test_error_missing_induk);
+    RUN_TEST(test_error_bad_unicode_escape);
+    RUN_TEST(test_corpus_benchmark);
+    return UNITY_END();
+}
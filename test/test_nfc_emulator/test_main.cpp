@@ -0,0 +1,402 @@
+#include <unity.h>
+#include "nfc_handler.h"
+#include "card_dumps.h"
+#include "mybase64.h"
+
+// =============================================
+// NFC HANDLER ON THE PN532 EMULATOR
+// =============================================
+
+// Drives the real NFCHandler -> PN532Driver -> frame path against recorded
+// card dumps, so detection, sector authentication, FAST_READ and the
+// streaming parser run exactly as they do behind a reader.
+
+static PN532EmulatorTransport emulator;
+static NFCHandler reader(&emulator);
+
+void setUp()
+{
+    emulator.setFrameLatencyUs(0);
+    emulator.setExchangeErrorEvery(0);
+    emulator.setCorruptFrameEvery(0);
+    emulator.resetCounters();
+}
+
+void tearDown()
+{
+    emulator.removeCard();
+}
+
+static void insertClassic(const uint8_t *dump)
+{
+    TEST_ASSERT_TRUE(emulator.loadClassicDump(dump, sizeof(classic1kDump)));
+    emulator.insertCard();
+}
+
+static void insertNtag(bool fastRead)
+{
+    TEST_ASSERT_TRUE(emulator.loadType2Dump(ntag215Dump, sizeof(ntag215Dump), fastRead));
+    emulator.insertCard();
+}
+
+void test_begin_finds_emulated_pn532()
+{
+    TEST_ASSERT_TRUE(reader.isReady());
+    TEST_ASSERT_EQUAL_STRING("Emulator", reader.getTransportName());
+    TEST_ASSERT_FALSE(reader.usesIrqDetection());
+}
+
+void test_classic_dump_detection()
+{
+    insertClassic(classic1kDump);
+
+    CardSession session;
+    TEST_ASSERT_TRUE(reader.detectCard(session));
+    TEST_ASSERT_EQUAL_STRING("5a3c910e", session.uidHex.c_str());
+    TEST_ASSERT_EQUAL_UINT8(NFC_CARD_CLASSIC_1K, session.cardType);
+    TEST_ASSERT_EQUAL_HEX8(0x08, session.sak);
+    TEST_ASSERT_TRUE(session.firstBlockValid);
+    TEST_ASSERT_EQUAL_MEMORY(classic1kDump + 4 * NFC_BLOCK_SIZE, session.firstBlock, NFC_BLOCK_SIZE);
+    TEST_ASSERT_EQUAL_INT(1, session.authenticatedSector);
+}
+
+void test_detect_returns_on_empty_reader()
+{
+    // Polled idle loop: an empty reader must not hold up the state machine
+    CardSession session;
+    unsigned long start = millis();
+    TEST_ASSERT_FALSE(reader.detectCard(session));
+    TEST_ASSERT_FALSE(reader.isCardPresent());
+    TEST_ASSERT_EQUAL_STRING("", reader.getCardUID().c_str());
+    TEST_ASSERT_LESS_THAN_UINT32(3 * NFC_DETECT_TIMEOUT, millis() - start);
+
+    // A card inserted afterwards is found on the next poll
+    insertClassic(classic1kDump);
+    TEST_ASSERT_TRUE(reader.detectCard(session));
+    TEST_ASSERT_EQUAL_STRING("5a3c910e", session.uidHex.c_str());
+}
+
+void test_detect_times_out_when_chip_keeps_searching()
+{
+    // MxRty 0xFF: the chip never answers an empty field, the host gives up
+    // after NFC_DETECT_TIMEOUT and aborts the command with an ACK
+    PN532Driver driver(&emulator);
+    TEST_ASSERT_TRUE(driver.setPassiveActivationRetries(0xFF));
+
+    CardSession session;
+    unsigned long start = millis();
+    TEST_ASSERT_FALSE(reader.detectCard(session));
+    unsigned long elapsedMs = millis() - start;
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(NFC_DETECT_TIMEOUT, elapsedMs);
+    TEST_ASSERT_LESS_THAN_UINT32(3 * NFC_DETECT_TIMEOUT, elapsedMs);
+
+    // The aborted listing does not answer a later command
+    insertClassic(classic1kDump);
+    TEST_ASSERT_TRUE(driver.setPassiveActivationRetries(NFC_PASSIVE_ACTIVATION_RETRIES));
+    TEST_ASSERT_TRUE(reader.detectCard(session));
+}
+
+void test_classic_dump_reads_santri_fields()
+{
+    insertClassic(classic1kDump);
+
+    CardSession session;
+    String nama;
+    String induk;
+    TEST_ASSERT_TRUE(reader.detectCard(session));
+    TEST_ASSERT_TRUE(reader.readSantriData(session, nama, induk));
+    TEST_ASSERT_EQUAL_STRING("Inggrit Destiana Nugraeni", nama.c_str());
+    TEST_ASSERT_EQUAL_STRING("196600", induk.c_str());
+
+    // "kelas" and "kamar" follow "nama", their blocks are never read
+    const NFCReadStats &stats = reader.getLastReadStats();
+    TEST_ASSERT_GREATER_THAN(0, stats.blocksSkipped);
+    TEST_ASSERT_EQUAL_UINT8(stats.blocksRead, stats.exchanges);
+}
+
+void test_ntag_dump_reads_with_fast_read()
+{
+    insertNtag(true);
+
+    CardSession session;
+    String nama;
+    String induk;
+    TEST_ASSERT_TRUE(reader.detectCard(session));
+    TEST_ASSERT_EQUAL_STRING("049f2b6a315d80", session.uidHex.c_str());
+    TEST_ASSERT_EQUAL_UINT8(NFC_CARD_ULTRALIGHT, session.cardType);
+    TEST_ASSERT_TRUE(reader.readSantriData(session, nama, induk));
+    TEST_ASSERT_EQUAL_STRING("Siti \"Ica\" Aisyah", nama.c_str());
+    TEST_ASSERT_EQUAL_STRING("210045", induk.c_str());
+
+    // Several 16-byte blocks per FAST_READ exchange
+    const NFCReadStats &stats = reader.getLastReadStats();
+    TEST_ASSERT_TRUE(session.fastReadSupported);
+    TEST_ASSERT_LESS_THAN(stats.blocksRead, stats.exchanges);
+}
+
+void test_ntag_dump_falls_back_to_read()
+{
+    insertNtag(false);
+
+    CardSession session;
+    String nama;
+    String induk;
+    TEST_ASSERT_TRUE(reader.detectCard(session));
+    TEST_ASSERT_TRUE(reader.readSantriData(session, nama, induk));
+    TEST_ASSERT_EQUAL_STRING("Siti \"Ica\" Aisyah", nama.c_str());
+    TEST_ASSERT_EQUAL_STRING("210045", induk.c_str());
+    TEST_ASSERT_FALSE(session.fastReadSupported);
+}
+
+void test_first_block_retry_reselects_card()
+{
+    for (int card = 0; card < 2; card++)
+    {
+        if (card == 0)
+        {
+            insertClassic(classic1kDump);
+        }
+        else
+        {
+            insertNtag(true);
+        }
+
+        // Every exchange at detection NAKs, which halts the card
+        CardSession session;
+        String nama;
+        String induk;
+        emulator.setExchangeErrorEvery(1);
+        TEST_ASSERT_TRUE(reader.detectCard(session));
+        TEST_ASSERT_FALSE(session.firstBlockValid);
+
+        emulator.setExchangeErrorEvery(0);
+        TEST_ASSERT_TRUE(reader.readSantriData(session, nama, induk));
+        TEST_ASSERT_EQUAL_STRING(card == 0 ? "196600" : "210045", induk.c_str());
+    }
+}
+
+void test_classic_wrong_key_fails()
+{
+    uint8_t dump[sizeof(classic1kDump)];
+    memcpy(dump, classic1kDump, sizeof(dump));
+    memset(dump + 7 * NFC_BLOCK_SIZE, 0xFF, 6);     // Key A of sector 1
+    insertClassic(dump);
+
+    CardSession session;
+    String nama;
+    String induk;
+    TEST_ASSERT_TRUE(reader.detectCard(session));
+    TEST_ASSERT_FALSE(session.firstBlockValid);
+    TEST_ASSERT_FALSE(reader.readSantriData(session, nama, induk));
+    String error = reader.getLastError();
+    TEST_ASSERT_EQUAL_STRING("Failed to read NDEF block", error.c_str());
+}
+
+void test_card_without_induk_is_rejected()
+{
+    static const uint8_t uid[] = {0x11, 0x22, 0x33, 0x44};
+    TEST_ASSERT_TRUE(emulator.createSantriCard(true, uid, sizeof(uid), "eyJuYW1hIjoiWCJ9"));   // {"nama":"X"}
+    emulator.insertCard();
+
+    CardSession session;
+    String nama;
+    String induk;
+    TEST_ASSERT_TRUE(reader.detectCard(session));
+    TEST_ASSERT_FALSE(reader.readSantriData(session, nama, induk));
+    String error = reader.getLastError();
+    TEST_ASSERT_EQUAL_STRING("No induk in card payload", error.c_str());
+}
+
+// Classic 4K image with sector 16 (MAD2) keyed like sector 0, so reading
+// it with the NFC Forum key fails
+static void insertClassic4K(const char *json)
+{
+    static uint8_t image[4096];
+    static char text[2600];
+    static const uint8_t madKey[6] = {0xA0, 0xA1, 0xA2, 0xA3, 0xA4, 0xA5};
+    static const uint8_t ndefKey[6] = {0xD3, 0xF7, 0xD3, 0xF7, 0xD3, 0xF7};
+    memset(image, 0, sizeof(image));
+
+    static const uint8_t manufacturer[] = {0x7E, 0x41, 0x09, 0xC2, 0x04, 0x18, 0x02, 0x00};
+    memcpy(image, manufacturer, sizeof(manufacturer));
+    for (int sector = 0; sector < 40; sector++)
+    {
+        int trailer = sector < 32 ? sector * 4 + 3 : 128 + (sector - 32) * 16 + 15;
+        bool directory = sector == 0 || sector == NFC_CLASSIC_MAD2_SECTOR;
+        memcpy(image + trailer * 16, directory ? madKey : ndefKey, 6);
+        memset(image + trailer * 16 + 10, 0xFF, 6);
+    }
+
+    uint32_t textLength = b64_encode(text, (char *)json, strlen(json));
+    uint32_t payloadLength = 3 + textLength;
+    uint32_t messageLength = 7 + payloadLength;
+    uint8_t header[] = {0x03, 0xFF, (uint8_t)(messageLength >> 8), (uint8_t)messageLength,
+                        0xC1, 0x01, 0x00, 0x00, (uint8_t)(payloadLength >> 8), (uint8_t)payloadLength,
+                        'T', 0x02, 'e', 'n'};
+
+    // Lay the TLVs over the data blocks, stepping over trailers and MAD2
+    int block = 4;
+    int offset = 0;
+    uint32_t total = sizeof(header) + textLength + 1;
+    for (uint32_t i = 0; i < total; i++)
+    {
+        while (true)
+        {
+            int sector = block < 128 ? block / 4 : 32 + (block - 128) / 16;
+            int trailer = sector < 32 ? sector * 4 + 3 : 128 + (sector - 32) * 16 + 15;
+            if (block != trailer && sector != NFC_CLASSIC_MAD2_SECTOR)
+            {
+                break;
+            }
+            block++;
+        }
+
+        uint8_t b = 0xFE;   // Terminator TLV
+        if (i < sizeof(header))
+        {
+            b = header[i];
+        }
+        else if (i < total - 1)
+        {
+            b = text[i - sizeof(header)];
+        }
+        image[block * 16 + offset] = b;
+        if (++offset == 16)
+        {
+            offset = 0;
+            block++;
+        }
+    }
+
+    TEST_ASSERT_TRUE(emulator.loadClassicDump(image, sizeof(image)));
+    emulator.insertCard();
+}
+
+void test_classic_4k_message_past_mad2_sector()
+{
+    static char json[2000];
+    int length = snprintf(json, sizeof(json), "{\"catatan\":\"");
+    for (int i = 0; i < 1500; i++)
+    {
+        json[length++] = 'a' + i % 26;
+    }
+    snprintf(json + length, sizeof(json) - length, "\",\"nama\":\"Abdullah\",\"induk\":\"404040\"}");
+    insertClassic4K(json);
+
+    CardSession session;
+    String nama;
+    String induk;
+    TEST_ASSERT_TRUE(reader.detectCard(session));
+    TEST_ASSERT_EQUAL_UINT8(NFC_CARD_CLASSIC_4K, session.cardType);
+    TEST_ASSERT_TRUE(reader.readSantriData(session, nama, induk));
+    TEST_ASSERT_EQUAL_STRING("Abdullah", nama.c_str());
+    TEST_ASSERT_EQUAL_STRING("404040", induk.c_str());
+    TEST_ASSERT_GREATER_THAN(NFC_CLASSIC_1K_DATA_BLOCKS, reader.getLastReadStats().blocksRead);
+}
+
+void test_classic_1k_rejects_message_beyond_card()
+{
+    uint8_t dump[sizeof(classic1kDump)];
+    memcpy(dump, classic1kDump, sizeof(dump));
+    static const uint8_t longTlv[] = {0x03, 0xFF, 0x03, 0x00};     // 768 byte message
+    memcpy(dump + 4 * NFC_BLOCK_SIZE, longTlv, sizeof(longTlv));
+    insertClassic(dump);
+
+    CardSession session;
+    String nama;
+    String induk;
+    TEST_ASSERT_TRUE(reader.detectCard(session));
+    TEST_ASSERT_FALSE(reader.readSantriData(session, nama, induk));
+    String error = reader.getLastError();
+    TEST_ASSERT_EQUAL_STRING("NDEF message too large", error.c_str());
+}
+
+void test_exchange_error_fails_cleanly()
+{
+    insertClassic(classic1kDump);
+
+    CardSession session;
+    String nama;
+    String induk;
+    TEST_ASSERT_TRUE(reader.detectCard(session));
+
+    // Authentication and block 4 went through at detection, block 5 NAKs
+    emulator.setExchangeErrorEvery(3);
+    TEST_ASSERT_FALSE(reader.readSantriData(session, nama, induk));
+    String error = reader.getLastError();
+    TEST_ASSERT_EQUAL_STRING("Failed to read data block", error.c_str());
+    TEST_ASSERT_EQUAL_UINT32(1, emulator.getErrorsInjected());
+}
+
+void test_removal_needs_confirmed_misses()
+{
+    insertClassic(classic1kDump);
+
+    CardSession session;
+    TEST_ASSERT_TRUE(reader.detectCard(session));
+    reader.rememberCard(session);
+    TEST_ASSERT_TRUE(reader.isAwaitingRemoval());
+    TEST_ASSERT_FALSE(reader.updatePresence());
+
+    emulator.removeCard();
+    for (int i = 1; i < NFC_REMOVAL_CONFIRM_CHECKS; i++)
+    {
+        TEST_ASSERT_FALSE(reader.updatePresence());
+    }
+    TEST_ASSERT_TRUE(reader.updatePresence());
+    TEST_ASSERT_FALSE(reader.isAwaitingRemoval());
+}
+
+void test_read_time_at_configured_latency()
+{
+    emulator.setFrameLatencyUs(NFC_EMULATOR_FRAME_LATENCY_US);
+
+    const char *names[] = {"Classic 1K", "NTAG215 FAST_READ", "NTAG215 READ"};
+    for (int card = 0; card < 3; card++)
+    {
+        if (card == 0)
+        {
+            insertClassic(classic1kDump);
+        }
+        else
+        {
+            insertNtag(card == 1);
+        }
+
+        CardSession session;
+        String nama;
+        String induk;
+        unsigned long start = micros();
+        TEST_ASSERT_TRUE(reader.detectCard(session));
+        TEST_ASSERT_TRUE(reader.readSantriData(session, nama, induk));
+        unsigned long elapsedUs = micros() - start;
+
+        const NFCReadStats &stats = reader.getLastReadStats();
+        char line[128];
+        snprintf(line, sizeof(line), "%s: %u blocks in %u exchanges, read %lu us, tap to fields %lu us",
+                 names[card], stats.blocksRead, stats.exchanges, stats.totalUs, elapsedUs);
+        TEST_MESSAGE(line);
+    }
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    reader.begin();
+    RUN_TEST(test_begin_finds_emulated_pn532);
+    RUN_TEST(test_classic_dump_detection);
+    RUN_TEST(test_detect_returns_on_empty_reader);
+    RUN_TEST(test_detect_times_out_when_chip_keeps_searching);
+    RUN_TEST(test_classic_dump_reads_santri_fields);
+    RUN_TEST(test_ntag_dump_reads_with_fast_read);
+    RUN_TEST(test_ntag_dump_falls_back_to_read);
+    RUN_TEST(test_first_block_retry_reselects_card);
+    RUN_TEST(test_classic_wrong_key_fails);
+    RUN_TEST(test_card_without_induk_is_rejected);
+    RUN_TEST(test_classic_4k_message_past_mad2_sector);
+    RUN_TEST(test_classic_1k_rejects_message_beyond_card);
+    RUN_TEST(test_exchange_error_fails_cleanly);
+    RUN_TEST(test_removal_needs_confirmed_misses);
+    RUN_TEST(test_read_time_at_configured_latency);
+    return UNITY_END();
+}